@@ -14,6 +14,8 @@
 #include <memory>
 #include <algorithm>
 #include <vector>
+#include <thread>
+#include <atomic>
 using std::vector;
 
 #include "readseq.h"
@@ -116,14 +118,40 @@ cd[del_3+1][3] = {
   {-2, -1, 0}
 };
 
-struct Cell {
-  FType          what : 16;
-  CodonLocations loc : 16;
-  float          score;
-};
+// Traceback of a cell, FType in the low 3 bits and CodonLocations above
+static byte const noTrace = 7;
+
+static inline byte
+traceCode(FType const what, CodonLocations const loc)
+{
+  return what | (loc << 3);
+}
+
+static inline FType
+traceWhat(byte const t)
+{
+  return static_cast<FType>(t & 7);
+}
+
+static inline CodonLocations
+traceLoc(byte const t)
+{
+  return static_cast<CodonLocations>(t >> 3);
+}
 
 typedef int Codon[3];
 
+// Codon bases are nucleotide codes (0-4), or -1 before the start of the
+// read. Codons are indexed by the 6^3 possible combinations.
+
+static uint const nCodonIndices = 6*6*6;
+
+static inline uint
+codonIndex(int const c0, int const c1, int const c2)
+{
+  return 36*(c0+1) + 6*(c1+1) + (c2+1);
+}
+
 /**
  * Provides scoring for alignment + correction
  */
@@ -142,12 +170,40 @@ public:
   
   uint getAAIndicesOfCodon(Codon const codon, int (&aas)[16]) const;
   uint getAAofFuzzyCodon(Codon const codon, int (&aas)[16]) const;
-    
+
+  // Scores of codon (by codonIndex)
+  double matchScore(uint codon, int j) const {
+    return matchTable[codon * nAA + j];
+  }
+  double insertCodon(uint codon) const {
+    return insertTable[codon];
+  }
+  double matchDelete(uint codon, int j) const {
+    return correctedMatchTable[codon * nAA + j];
+  }
+  double insertCodonDelete(uint codon) const {
+    return correctedInsertTable[codon];
+  }
+  double matchDuplicate(uint codon, int j) const {
+    return correctedMatchTable[codon * nAA + j];
+  }
+  // Largest score of any codon matched to amino acid j
+  double bestMatch(int j) const {
+    return bestMatchTable[j];
+  }
+
+private:
   double matchScore(Codon const codon, int j) const;
   double insertCodon(Codon const codon) const;
-  double matchDelete(Codon const codon, int j) const;
-  double insertCodonDelete(Codon const codon) const;
-  double matchDuplicate(Codon const codon, int j) const;
+  
+  // scores of all codons, precomputed since each codon is decoded and
+  // possibly expanded when scored. [nCodonIndices x nAA], [nCodonIndices]
+  vector<double>	matchTable;
+  vector<double>	insertTable;
+  // with the correction penalty added
+  vector<double>	correctedMatchTable;
+  vector<double>	correctedInsertTable;
+  vector<double>	bestMatchTable;
 };
 
 FScore::FScore(const int*                           _geneticCode,
@@ -155,8 +211,36 @@ FScore::FScore(const int*                           _geneticCode,
 	       const int*                           _scores) :
   geneticCode(_geneticCode),
   scores(_scores),
-  correctionScores(_correctionScores)
-{}
+  correctionScores(_correctionScores),
+  matchTable(nCodonIndices * nAA),
+  insertTable(nCodonIndices),
+  correctedMatchTable(nCodonIndices * nAA),
+  correctedInsertTable(nCodonIndices),
+  bestMatchTable(nAA, 0)
+{
+  for(int c0 = -1; c0 <= anynuc; ++c0) {
+    for(int c1 = -1; c1 <= anynuc; ++c1) {
+      for(int c2 = -1; c2 <= anynuc; ++c2) {
+	// bases before the read start come first, and the last one is in
+	if( c2 < 0 || (c1 < 0 && c0 >= 0) ) {
+	  continue;
+	}
+	Codon const codon = {c0, c1, c2};
+	uint const ci = codonIndex(c0, c1, c2);
+	
+	insertTable[ci] = insertCodon(codon);
+	correctedInsertTable[ci] = insertTable[ci] + correctionScores.correctionPenalty;
+	for(uint j = 0; j < nAA; ++j) {
+	  double const m = matchScore(codon, j);
+	  matchTable[ci * nAA + j] = m;
+	  correctedMatchTable[ci * nAA + j] = m + correctionScores.correctionPenalty;
+	  bestMatchTable[j] = std::max(bestMatchTable[j],
+				       std::max(m, correctedMatchTable[ci * nAA + j]));
+	}
+      }
+    }
+  }
+}
 
 inline int
 FScore::translate(uint const v) const
@@ -227,7 +311,7 @@ FScore::getAAIndicesOfCodon(Codon const codon, int (&aas)[16]) const
   return n;
 }
     
-inline double
+double
 FScore::matchScore(Codon const codon, int j) const
 {
   double score = 0;
@@ -266,7 +350,7 @@ FScore::matchScore(Codon const codon, int j) const
   return score;
 }
 
-inline double
+double
 FScore::insertCodon(Codon const codon) const
 {
   int aas[16];
@@ -285,25 +369,6 @@ FScore::insertCodon(Codon const codon) const
   return correctionScores.stopCodonPenalty + correctionScores.indelPenalty;
 }
 
-inline double
-FScore::matchDelete(Codon const codon, int j) const
-{
-  return matchScore(codon, j) + correctionScores.correctionPenalty;
-}
-
-inline double
-FScore::insertCodonDelete(Codon const codon) const
-{
-  return insertCodon(codon) + correctionScores.correctionPenalty;
-}
-
-inline double
-FScore::matchDuplicate(Codon const codon, int j) const
-{
-  return matchScore(codon, j) + correctionScores.correctionPenalty;
-}
-
-
 class AlignAndCorrect {
 public:
   FScore const scores;
@@ -316,7 +381,34 @@ public:
   const byte* aa;
 
   // [i,j] is the score of the best alignment of i nucs [0.. i-1] and j AA [0 .. j-1]
-  Cell** nodes;
+  float** nodes;
+  // and how it was reached
+  byte** trace;
+  
+  // Storage for nodes and trace, kept between alignments and grown as needed
+  vector<float>	arena;
+  vector<byte>	traceArena;
+  vector<float*> rows;
+  vector<byte*> traceRows;
+
+  // Match scores of each codon along the reference, [j] for aa[j-1]. Scores
+  // with the correction penalty are at codon + nCodonIndices. Filled on
+  // first use in an alignment.
+  vector<float>	profile;
+  vector<bool>	inProfile;
+
+  // bestPrefix[j], sum of the best matches of aa[0..j-1]: bounds the score of
+  // alignments outside the band
+  vector<double> bestPrefix;
+
+  // Cells of row i are computed for rowLo[i] <= j <= rowHi[i]. The band is
+  // the diagonals dlo <= i - 3j <= dhi, which is the full matrix when
+  // dlo = -3naa and dhi = nRead. Each row is padded with unreachable cells,
+  // one before and two after.
+  vector<uint>	rowLo;
+  vector<uint>	rowHi;
+  int dlo;
+  int dhi;
 
   struct Result {
     uint matches;
@@ -329,6 +421,9 @@ public:
     uint aaFreeEnd;
     uint dnaFreeStart;
     uint aaFreeStart;
+
+    // of the alignment
+    double score;
     
     vector<int>		alignedFramedRead;
     vector<int>		alignedAA;
@@ -347,9 +442,24 @@ public:
 
   void getCodon(CodonLocations const cloc, int const idna, int (&codon)[3]) const;
 
-  Result doAlignment(const byte* read, uint nRead, const byte* aa, uint naa);
+  // codonIndex of getCodon
+  uint codonAt(CodonLocations const cloc, int const idna) const;
 
-  void scoreCell(uint idna, uint jaa);
+  // Align in a band of diagonals around the expected one, of 'band' on each side,
+  // or the full matrix when 0. The band is doubled while the alignment runs
+  // close to its edges, or while an alignment entirely outside it might score
+  // better. An alignment partly outside the band may still be missed.
+  Result doAlignment(const byte* read, uint nRead, const byte* aa, uint naa, uint band = 0);
+
+  void scoreRow(uint idna);
+
+private:
+  void layout(int dlo, int dhi);
+
+  const float* profileOf(uint codon, bool corrected);
+
+  // Diagonals visited by the alignment are returned in [dmin,dmax]
+  Result traceback(int& dmin, int& dmax) const;
 };
 
 AlignAndCorrect::AlignAndCorrect(const int* sub,
@@ -358,7 +468,10 @@ AlignAndCorrect::AlignAndCorrect(const int* sub,
   scores(geneticCode, cscores, sub),
   nRead(0),
   naa(0),
-  nodes(0)
+  nodes(0),
+  trace(0),
+  dlo(0),
+  dhi(0)
 {}
 
 inline void
@@ -372,126 +485,269 @@ AlignAndCorrect::getCodon(CodonLocations const cloc, int const idna, int (&codon
   }
 }
 
+inline uint
+AlignAndCorrect::codonAt(CodonLocations const cloc, int const idna) const
+{
+  int codon[3];
+  getCodon(cloc, idna, codon);
+  return codonIndex(codon[0], codon[1], codon[2]);
+}
+
+inline const float*
+AlignAndCorrect::profileOf(uint const codon, bool const corrected)
+{
+  uint const k = corrected ? codon + nCodonIndices : codon;
+  float* const p = &profile[k * (naa+1)];
+  if( ! inProfile[k] ) {
+    for(uint j = 1; j <= naa; ++j) {
+      p[j] = corrected ? scores.matchDelete(codon, aa[j-1]) : scores.matchScore(codon, aa[j-1]);
+    }
+    inProfile[k] = true;
+  }
+  return p;
+}
+
+// Row passes over n cells, written for the compiler to vectorise (as it
+// does with -O3, for whatever instruction set it targets): take score
+// 'prev[j] + add[j]' (or a fixed 'add') for cell j when strictly better.
+
+static inline void
+bestOf(float* __restrict__ sc, byte* __restrict__ tr, const float* __restrict__ prev,
+       const float* __restrict__ add, uint const n, byte const code)
+{
+  for(uint j = 0; j < n; ++j) {
+    float const c = prev[j] + add[j];
+    float const s = sc[j];
+    byte const m = -(c > s);
+    sc[j] = m ? c : s;
+    tr[j] = (code & m) | (tr[j] & ~m);
+  }
+}
+
+static inline void
+bestOf(float* __restrict__ sc, byte* __restrict__ tr, const float* __restrict__ prev,
+       float const add, uint const n, byte const code)
+{
+  for(uint j = 0; j < n; ++j) {
+    float const c = prev[j] + add;
+    float const s = sc[j];
+    byte const m = -(c > s);
+    sc[j] = m ? c : s;
+    tr[j] = (code & m) | (tr[j] & ~m);
+  }
+}
+
+// Cells of one row depend on rows idna-2 .. idna-4, and on the previous
+// cell of the row only through a gap in the read. All other ways are
+// taken in passes over the row, first one wins ties, then the gap in a
+// sequential pass (it wins ties).
+
 void
-AlignAndCorrect::scoreCell(uint const idna, uint const jaa)
+AlignAndCorrect::scoreRow(uint const idna)
 {
-  Cell& c = nodes[idna][jaa];
-    
-  if (idna < 2 || jaa == 0) {
-    c.score = 0;
-    c.what = /*some kind of none;*/ (FType)200;
-  } else {
-    // gap in AA
-    double const insAA = nodes[idna][jaa - 1].score + scores.correctionScores.indelPenalty;
-    c.score = insAA;
-    c.what = ins_ref;
+  uint const lo = rowLo[idna];
+  uint const hi = rowHi[idna];
+  float* const sc = nodes[idna];
+  byte* const tr = trace[idna];
+  
+  if( idna < 2 || lo == 0 ) {
+    uint const e = idna < 2 ? hi : 0;
+    for(uint j = lo; j <= e; ++j) {
+      sc[j] = 0;
+      tr[j] = noTrace;
+    }
+    if( idna < 2 ) {
+      return;
+    }
+  }
+  
+  uint const from = std::max(lo, 1U);
+  if( from > hi ) {
+    return;
+  }
+  uint const n = hi - from + 1;
+  float* const s = sc + from;
+  byte* const t = tr + from;
+  for(uint j = 0; j < n; ++j) {
+    s[j] = -std::numeric_limits<float>::infinity();
+    t[j] = noTrace;
+  }
 
-    int curaa = aa[jaa-1];
-    
-    if( idna >= 3 ) {
-      // no insertions or deleteions to codon
-      int codon[3];
-      getCodon(match_ins, idna, codon);    
-      double const sc = scores.matchScore(codon, curaa);
-      // match to AA
-      double const matchNuc = nodes[idna-3][jaa - 1].score + sc;
-      if( matchNuc > c.score ) {
-	c.score = matchNuc;
-	c.what = match;
-	c.loc = match_ins;
-      }
-	
-      // codon not matching - insert gap in AA
-      double const insNuc = nodes[idna-3][jaa].score + scores.insertCodon(codon);
-      if( insNuc > c.score ) {
-	c.score = insNuc;
-	c.what = ins_read;
-	c.loc = match_ins;
-      }	  
-    }
-
-    if( idna >= 4 ) {
-      // nuc was inserted to frame. 4 possible ways	
-      int codon[3];
-      for(uint m = del_0; m <= del_3 ; ++m) {
-	getCodon(static_cast<CodonLocations>(m), idna, codon);    
-	
-	// nuc was inserted to frame and codon matched to AA
-	double const delAndMatch = nodes[idna-4][jaa - 1].score + scores.matchDelete(codon, curaa);
-	if( delAndMatch > c.score ) {
-	  c.score = delAndMatch;
-	  c.what = match_delete;
-	  c.loc = static_cast<CodonLocations>(m);
-	}
-	  
-	// nuc was inserted to frame and codon deleted
-	double const insAndDelete = nodes[idna-4][jaa].score + scores.insertCodonDelete(codon);
-	if( insAndDelete > c.score ) {
-	  c.score = insAndDelete;
-	  c.what = ins_read_delete;
-	  c.loc = static_cast<CodonLocations>(m);
-	}
-      }
+  if( idna >= 3 ) {
+    // no insertions or deleteions to codon
+    uint const codon = codonAt(match_ins, idna);
+    const float* const prev = nodes[idna-3];
+    // match to AA
+    bestOf(s, t, prev + from - 1, profileOf(codon, false) + from, n, traceCode(match, match_ins));
+    // codon not matching - insert gap in AA
+    bestOf(s, t, prev + from, float(scores.insertCodon(codon)), n, traceCode(ins_read, match_ins));
+  }
+
+  if( idna >= 4 ) {
+    // nuc was inserted to frame. 4 possible ways	
+    const float* const prev = nodes[idna-4];
+    for(uint m = del_0; m <= del_3 ; ++m) {
+      CodonLocations const loc = static_cast<CodonLocations>(m);
+      uint const codon = codonAt(loc, idna);
+      // nuc was inserted to frame and codon matched to AA
+      bestOf(s, t, prev + from - 1, profileOf(codon, true) + from, n, traceCode(match_delete, loc));
+      // nuc was inserted to frame and codon deleted
+      bestOf(s, t, prev + from, float(scores.insertCodonDelete(codon)), n,
+	     traceCode(ins_read_delete, loc));
+    }
+  }
+
+  {
+    // nuc was deleted in frame. 3 possible ways
+    const float* const prev = nodes[idna-2];
+    for(uint m = dup_0; m <= dup_2 ; ++m) {
+      CodonLocations const loc = static_cast<CodonLocations>(m);
+      uint const codon = codonAt(loc, idna);
+      //  nuc was deleted in frame and codon matched to AA
+      bestOf(s, t, prev + from - 1, profileOf(codon, true) + from, n, traceCode(match_duplicate, loc));
+      // nuc was inserted to frame and codon deleted
+      bestOf(s, t, prev + from, float(scores.insertCodonDelete(codon)), n,
+	     traceCode(ins_read_duplicate, loc));
     }
+  }
 
-    if( idna >= 2 ) {
-      // nuc was deleted in frame. 3 possible ways
-      int codon[3];
-      for(uint m = dup_0; m <= dup_2 ; ++m) {
-	getCodon(static_cast<CodonLocations>(m), idna, codon);  
-	
-	//  nuc was deleted in frame and codon matched to AA
-	double const delAndMatch = nodes[idna-2][jaa - 1].score + scores.matchDuplicate(codon, curaa);
-	if( delAndMatch > c.score ) {
-	  c.score = delAndMatch;
-	  c.what = match_duplicate;
-	  c.loc = static_cast<CodonLocations>(m);
-	}
-	  
-	// nuc was inserted to frame and codon deleted
-	double const insAndDelete = nodes[idna-2][jaa].score + scores.insertCodonDelete(codon);
-	if( insAndDelete > c.score ) {
-	  c.score = insAndDelete;
-	  c.what = ins_read_duplicate;
-	  c.loc = static_cast<CodonLocations>(m);
-	}
-      }
+  // gap in AA
+  float const indel = scores.correctionScores.indelPenalty;
+  for(uint j = from; j <= hi; ++j) {
+    float const insAA = sc[j-1] + indel;
+    if( ! (sc[j] > insAA) ) {
+      sc[j] = insAA;
+      tr[j] = traceCode(ins_ref, match_ins);
     }
   }
 }
 
+// floor(a/3) for any sign of a
+static inline int
+floorDiv3(int const a)
+{
+  return a >= 0 ? a / 3 : -((2 - a) / 3);
+}
+
+void
+AlignAndCorrect::layout(int const dlo, int const dhi)
+{
+  this->dlo = dlo;
+  this->dhi = dhi;
+  
+  rowLo.resize(nRead+1);
+  rowHi.resize(nRead+1);
+  ulong nCells = 0;
+  for(uint i = 0; i <= nRead; ++i) {
+    rowLo[i] = std::max(0, -floorDiv3(dhi - int(i)));
+    rowHi[i] = std::min(int(naa), floorDiv3(int(i) - dlo));
+    nCells += rowHi[i] - rowLo[i] + 1 + 3;
+  }
+  
+  if( arena.size() < nCells ) {
+    arena.resize(nCells);
+    traceArena.resize(nCells);
+  }
+  rows.resize(nRead+1);
+  traceRows.resize(nRead+1);
+  nodes = &rows[0];
+  trace = &traceRows[0];
+
+  float* c = &arena[0];
+  byte* t = &traceArena[0];
+  for(uint i = 0; i <= nRead; ++i) {
+    uint const n = rowHi[i] - rowLo[i] + 1;
+    c[0] = c[n+1] = c[n+2] = -std::numeric_limits<float>::infinity();
+    t[0] = t[n+1] = t[n+2] = noTrace;
+    nodes[i] = c + 1 - rowLo[i];
+    trace[i] = t + 1 - rowLo[i];
+    c += n + 3;
+    t += n + 3;
+  }
+}
+
 AlignAndCorrect::Result
-AlignAndCorrect::doAlignment(const byte* read, uint nRead, const byte* aa, uint naa)
+AlignAndCorrect::doAlignment(const byte* read, uint nRead, const byte* aa, uint naa, uint band)
 {
   this->nRead = nRead;
   this->naa = naa;
   this->aa = aa;
   this->read = read;
-      
-  nodes = new Cell* [(nRead+1)];
-  nodes[0] = new Cell[(nRead+1)*(naa+1)];
-  for(uint k = 1; k <= nRead; ++k) {
-    nodes[k] = nodes[k-1] + (naa+1);
-  }
 
-  for(uint i = 0; i <= nRead; i++) {
-    for(uint j = 0; j <= naa; j++) {
-      scoreCell(i, j);
+  int const dFirst = -3*int(naa);
+  int const dLast = nRead;
+  // diagonals of alignments starting or ending together
+  int const d0 = std::min(0, int(nRead) - 3*int(naa));
+  int const d1 = std::max(0, int(nRead) - 3*int(naa));
+
+  if( profile.size() < 2*nCodonIndices*(naa+1) ) {
+    profile.resize(2*nCodonIndices*(naa+1));
+  }
+  inProfile.assign(2*nCodonIndices, false);
+  
+  if( band > 0 ) {
+    bestPrefix.resize(naa+1);
+    bestPrefix[0] = 0;
+    for(uint j = 1; j <= naa; ++j) {
+      bestPrefix[j] = bestPrefix[j-1] + std::max(scores.bestMatch(aa[j-1]), 0.0);
     }
   }
+  
+  // narrow bands may lack a path to the borders
+  int w = band > 0 ? std::max(band, 6U) : -1;
+  while( true ) {
+    bool const full = w < 0 || (d0 - w <= dFirst && d1 + w >= dLast);
+    layout(full ? dFirst : d0 - w, full ? dLast : d1 + w);
+
+    for(uint i = 0; i <= nRead; i++) {
+      scoreRow(i);
+    }
+    
+    int dmin, dmax;
+    Result res = traceback(dmin, dmax);
+
+    // a better path might leave the band when this one runs close to its edge
+    bool widen = full ? false :
+      (dlo > dFirst && dmin - dlo < 4) || (dhi < dLast && dhi - dmax < 4);
+
+    if( ! (full || widen) ) {
+      // Alignments above the band (i - 3j > dhi) match only residues up to
+      // (nRead - dhi)/3, those below it only from -dlo/3 on. One residue of
+      // slack on each side for codons crossing the edge.
+      double outside = 0;
+      if( dhi < dLast ) {
+	int const j = std::min(int(naa), floorDiv3(int(nRead) - dhi) + 1);
+	outside = std::max(outside, bestPrefix[std::max(j, 0)]);
+      }
+      if( dlo > dFirst ) {
+	int const j = std::max(0, floorDiv3(-dlo) - 1);
+	outside = std::max(outside, bestPrefix[naa] - bestPrefix[std::min(j, int(naa))]);
+      }
+      widen = res.score < outside;
+    }
+    
+    if( ! widen ) {
+      return res;
+    }
+    w *= 2;
+  }
+}
 
+AlignAndCorrect::Result
+AlignAndCorrect::traceback(int& dmin, int& dmax) const
+{
   int icur = -1, jcur = -1;
   double maxval = std::numeric_limits<double>::lowest();
   for( uint i = 0; i <= nRead; i++ ) {
-    if( maxval < nodes[i][naa].score ) {
+    if( rowHi[i] == naa && maxval < nodes[i][naa] ) {
       icur = i;
-      maxval = nodes[i][naa].score;
+      maxval = nodes[i][naa];
     }
   }
-  for( uint j = 0; j <= naa; j++ ) {
-    if( maxval < nodes[nRead][j].score ) {
+  for( uint j = rowLo[nRead]; j <= rowHi[nRead]; j++ ) {
+    if( maxval < nodes[nRead][j] ) {
       jcur = j;
-      maxval = nodes[nRead][j].score;
+      maxval = nodes[nRead][j];
     }	
   }
 
@@ -503,15 +759,19 @@ AlignAndCorrect::doAlignment(const byte* read, uint nRead, const byte* aa, uint
     
   Result res;
 
+  res.score = maxval;
   res.dnaFreeEnd = nRead - icur;
   res.aaFreeEnd = naa - jcur;
-    
+
+  dmin = dmax = icur - 3*jcur;
   while( icur > 1 && jcur > 0 ) {
-    Cell const& cur = nodes[icur][jcur];
+    FType const what = traceWhat(trace[icur][jcur]);
+    dmin = std::min(dmin, icur - 3*jcur);
+    dmax = std::max(dmax, icur - 3*jcur);
 
     Codon codon;
-    if( cur.what != ins_ref ) {
-      getCodon(cur.loc, icur, codon);
+    if( what != ins_ref ) {
+      getCodon(traceLoc(trace[icur][jcur]), icur, codon);
     } else {
       codon[2] = codon[1] = codon[0] = gap;
       res.dnaBoundries.push_back(0);
@@ -525,7 +785,7 @@ AlignAndCorrect::doAlignment(const byte* read, uint nRead, const byte* aa, uint
     bool aagap = false;
     int const icurbefore = icur;
     
-    switch( cur.what ) {
+    switch( what ) {
       case match: {
 	icur -= 3;
 	jcur -= 1;
@@ -592,23 +852,302 @@ AlignAndCorrect::doAlignment(const byte* read, uint nRead, const byte* aa, uint
   }
   res.aaFreeStart = jcur;
   res.dnaFreeStart = icur;
-	
-  delete [] nodes[0];
-  delete [] nodes;
+  dmin = std::min(dmin, icur - 3*jcur);
+  dmax = std::max(dmax, icur - 3*jcur);
 
   return res;
 }
 
+// Index of the k-mers of reference proteins, for picking the references a
+// read is likely to align to. Reads are translated in all 6 frames, and
+// references are ranked by the number of distinct k-mers they share with
+// the best frame.
+
+class ProteinIndex {
+public:
+  // A reference shortlisted for a read
+  struct Candidate {
+    uint ref;
+    uint shared;
+    // shared with the reverse complement of the read
+    bool reversed;
+  };
+  
+  ProteinIndex(vector< vector<byte> > const& refs, uint k);
+
+  uint const k;
+  vector< vector<byte> > const refs;
+
+  // Work space of shortlist, one per thread
+  struct Work {
+    // per reference, shared k-mers with current frame and position in cans + 1
+    vector<uint> counts;
+    vector<uint> slot;
+    vector<uint> kmers;
+    vector<uint> touched;
+  };
+  
+  // Up to 'top' references sharing at least one k-mer with 'read', best
+  // first (lower index on ties).
+  void shortlist(const byte* read, uint nRead, int const (&geneticCode)[64], uint top,
+		 vector<Candidate>& cans, Work& w) const;
+
+  static uint const maxK = 5;
+  
+private:
+  // Only the 20 natural AA are used
+  static uint const nCodes = 20;
+  
+  // references containing each k-mer (each once), k-mer 'c' at
+  // [offsets[c], offsets[c+1])
+  vector<uint> offsets;
+  vector<uint> postings;
+
+  // Distinct k-mers in a translated frame of read
+  void frameKmers(const byte* read, uint nRead, uint frame, bool reversed,
+		  int const (&geneticCode)[64], vector<uint>& kmers) const;
+};
+
+ProteinIndex::ProteinIndex(vector< vector<byte> > const& refs, uint const k) :
+  k(k),
+  refs(refs)
+{
+  uint nKmers = 1;
+  for(uint i = 0; i < k; ++i) {
+    nKmers *= nCodes;
+  }
+  
+  // (k-mer, reference) pairs, each once
+  vector< std::pair<uint,uint> > pairs;
+  for(uint r = 0; r < refs.size(); ++r) {
+    vector<byte> const& p = refs[r];
+    uint const b = pairs.size();
+    uint key = 0, run = 0;
+    for(uint i = 0; i < p.size(); ++i) {
+      if( p[i] < nCodes ) {
+	key = (key * nCodes + p[i]) % nKmers;
+	run += 1;
+	if( run >= k ) {
+	  pairs.push_back(std::make_pair(key, r));
+	}
+      } else {
+	run = 0;
+      }
+    }
+    std::sort(pairs.begin() + b, pairs.end());
+    pairs.erase(std::unique(pairs.begin() + b, pairs.end()), pairs.end());
+  }
+  std::stable_sort(pairs.begin(), pairs.end(),
+		   [](std::pair<uint,uint> const& a, std::pair<uint,uint> const& b) {
+		     return a.first < b.first; });
+
+  offsets.assign(nKmers + 1, 0);
+  postings.resize(pairs.size());
+  for(uint i = 0; i < pairs.size(); ++i) {
+    offsets[pairs[i].first + 1] += 1;
+    postings[i] = pairs[i].second;
+  }
+  for(uint c = 0; c < nKmers; ++c) {
+    offsets[c+1] += offsets[c];
+  }
+}
+
+void
+ProteinIndex::frameKmers(const byte* const read, uint const nRead, uint const frame,
+			 bool const reversed, int const (&geneticCode)[64],
+			 vector<uint>& kmers) const
+{
+  uint const nKmers = offsets.size() - 1;
+  kmers.clear();
+  uint key = 0, run = 0;
+  for(uint i = frame; i + 3 <= nRead; i += 3) {
+    int aa = -1;
+    int c[3];
+    for(uint l = 0; l < 3; ++l) {
+      // reverse complement: A,G,C,T are 0,1,2,3
+      c[l] = reversed ? read[nRead-1-(i+l)] : read[i+l];
+      if( c[l] > 3 ) {
+	break;
+      }
+      if( reversed ) {
+	c[l] = 3 - c[l];
+      }
+      if( l == 2 ) {
+	aa = geneticCode[16*c[0] + 4*c[1] + c[2]];
+      }
+    }
+    if( 0 <= aa && aa < int(nCodes) ) {
+      key = (key * nCodes + aa) % nKmers;
+      run += 1;
+      if( run >= k ) {
+	kmers.push_back(key);
+      }
+    } else {
+      run = 0;
+    }
+  }
+  std::sort(kmers.begin(), kmers.end());
+  kmers.erase(std::unique(kmers.begin(), kmers.end()), kmers.end());
+}
+
+void
+ProteinIndex::shortlist(const byte* const read, uint const nRead,
+			int const (&geneticCode)[64], uint const top,
+			vector<Candidate>& cans, Work& w) const
+{
+  if( w.counts.size() != refs.size() ) {
+    w.counts.assign(refs.size(), 0);
+    w.slot.assign(refs.size(), 0);
+  }
+  cans.clear();
+  
+  for(uint f = 0; f < 6; ++f) {
+    bool const reversed = f >= 3;
+    frameKmers(read, nRead, f % 3, reversed, geneticCode, w.kmers);
+    for(auto const c : w.kmers) {
+      for(uint i = offsets[c]; i < offsets[c+1]; ++i) {
+	uint const r = postings[i];
+	if( w.counts[r]++ == 0 ) {
+	  w.touched.push_back(r);
+	}
+      }
+    }
+    // keep the best frame of each reference
+    for(auto const r : w.touched) {
+      if( w.slot[r] == 0 ) {
+	Candidate const x = {r, w.counts[r], reversed};
+	cans.push_back(x);
+	w.slot[r] = cans.size();
+      } else {
+	Candidate& x = cans[w.slot[r] - 1];
+	if( x.shared < w.counts[r] ) {
+	  x.shared = w.counts[r];
+	  x.reversed = reversed;
+	}
+      }
+      w.counts[r] = 0;
+    }
+    w.touched.clear();
+  }
+  for(auto const& x : cans) {
+    w.slot[x.ref] = 0;
+  }
+  
+  auto const better = [](Candidate const& a, Candidate const& b) {
+    return a.shared > b.shared || (a.shared == b.shared && a.ref < b.ref); };
+  if( cans.size() > top ) {
+    std::partial_sort(cans.begin(), cans.begin() + top, cans.end(), better);
+    cans.resize(top);
+  } else {
+    std::sort(cans.begin(), cans.end(), better);
+  }
+}
+
+static const char* const indexCapName = "PROTEININDEX";
+
+static void
+proteinIndexDestructor(PyObject* const o)
+{
+  if( PyCapsule_IsValid(o, indexCapName) ) {
+    void* c = PyCapsule_GetPointer(o, indexCapName);
+    delete reinterpret_cast<ProteinIndex*>(c);
+  }
+}
+
+// Genetic code (64 AA indices, -1 for stop codons). Sets a python error
+// when false.
+
+static bool
+readGeneticCode(PyObject* const pGeneticCode, int (&geneticCode)[64])
+{
+  if( ! (PySequence_Check(pGeneticCode) && PySequence_Size(pGeneticCode) == 64) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: invalid genetic code");
+    return false;
+  }
+  
+  PyObject* const s = PySequence_Fast(pGeneticCode, "error");
+  for(uint k = 0; k < 64; ++k) {
+    PyObject* const o = PySequence_Fast_GET_ITEM(s,k);
+    int const m = PyInt_AS_LONG(o);
+    if ( ! ( -1 <= m && m < (int)nAA ) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: invalid genetic code");
+      Py_DECREF(s);
+      return false;
+    }
+    geneticCode[k] = m;
+  }
+  Py_DECREF(s);
+  return true;
+}
+
+// Codes of each sequence in pSeqs, DNA (stripped of gaps) or amino acids.
+// Sets a python error when false.
+
+static bool
+readSequences(PyObject* const pSeqs, bool const aminoAcids, vector< vector<byte> >& seqs)
+{
+  if( ! PySequence_Check(pSeqs) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not sequences") ;
+    return false;
+  }
+  
+  uint const n = PySequence_Size(pSeqs);
+  seqs.resize(n);
+  PyObject* const sqs = PySequence_Fast(pSeqs, "error");
+  for(uint k = 0; k < n; ++k) {
+    PyObject* const o = PySequence_Fast_GET_ITEM(sqs, k);
+    uint len = 0;
+    byte* const s = aminoAcids ? readAASequence(o, len) : readSequence(o, len, true);
+    if( ! s ) {
+      Py_DECREF(sqs);
+      return false;
+    }
+    seqs[k].assign(s, s + len);
+    delete [] s;
+  }
+  Py_DECREF(sqs);
+  return true;
+}
+
+// AA score matrix and genetic code of acorrect. Sets a python error when
+// false.
+
+static bool
+readCorrectionArgs(PyObject* const	pScoreMatrix,
+		   PyObject* const	pGeneticCode,
+		   vector<int>&		scoreMatrix,
+		   int			(&geneticCode)[64])
+{
+  if( ! (PySequence_Check(pScoreMatrix) && PySequence_Size(pScoreMatrix) == nAA * nAA) ) {
+     PyErr_SetString(PyExc_ValueError, "wrong args: invalid AA score matrix");
+     return false;
+  }
+
+  scoreMatrix.resize(nAA * nAA);
+  {
+    PyObject* const s = PySequence_Fast(pScoreMatrix, "error");
+    for(uint k = 0; k < nAA*nAA; ++k) {
+      PyObject* const o = PySequence_Fast_GET_ITEM(s,k);
+      int const m = PyInt_AS_LONG(o);
+      scoreMatrix[k] = m;
+    }
+    Py_DECREF(s);
+  }
+
+  return readGeneticCode(pGeneticCode, geneticCode);
+}
+
 PyObject*
 aaCorrect(PyObject*, PyObject* args, PyObject* kwds)
 {
   static const char* kwlist[] = {"seq", "aaseq", "scoreMatrix", "geneticCode",
-				 "indel", "correction", "stopCodon", 
+				 "indel", "correction", "stopCodon", "band",
 				 static_cast<const char*>(0)};
 
   double indelPenalty = -10;
   double correctionPenalty = -10;
   double stopCodonPenalty = -100;
+  uint band = 0;
 
   PyObject* pScoreMatrix;
   PyObject* pGeneticCode;
@@ -616,9 +1155,9 @@ aaCorrect(PyObject*, PyObject* args, PyObject* kwds)
   PyObject* pseq = 0;
   PyObject* paaseq = 0;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OOOO|ddd", const_cast<char**>(kwlist),
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OOOO|dddI", const_cast<char**>(kwlist),
 				    &pseq,&paaseq,&pScoreMatrix,&pGeneticCode,
-				    &indelPenalty,&correctionPenalty,&stopCodonPenalty)) {
+				    &indelPenalty,&correctionPenalty,&stopCodonPenalty,&band)) {
     PyErr_SetString(PyExc_ValueError, "wrong args.") ;
     return 0;
   }
@@ -628,41 +1167,12 @@ aaCorrect(PyObject*, PyObject* args, PyObject* kwds)
     return 0;
   }
 
-  if( ! (PySequence_Check(pScoreMatrix) && PySequence_Size(pScoreMatrix) == nAA * nAA) ) {
-     PyErr_SetString(PyExc_ValueError, "wrong args: invalid AA score matrix");
-     return 0;
-  }
-
-  if( ! (PySequence_Check(pGeneticCode) && PySequence_Size(pGeneticCode) == 64) ) {
-    PyErr_SetString(PyExc_ValueError, "wrong args: invalid genetic code");
-  }
-  
   CorrectionScores<float> const scores(indelPenalty, correctionPenalty, stopCodonPenalty);
 
-  int* const scoreMatrix = new int[nAA * nAA];
-  std::unique_ptr<int> dscoreMatrix(scoreMatrix);  // releases pointer
-  {
-    PyObject* const s = PySequence_Fast(pScoreMatrix, "error");
-    for(uint k = 0; k < nAA*nAA; ++k) {
-      PyObject* const o = PySequence_Fast_GET_ITEM(s,k);
-      int const m = PyInt_AS_LONG(o);
-      scoreMatrix[k] = m;
-    }
-    Py_DECREF(s);
-  }
-
+  vector<int> scoreMatrix;
   int geneticCode[64];
-  {
-    PyObject* const s = PySequence_Fast(pGeneticCode, "error");
-    for(uint k = 0; k < 64; ++k) {
-      PyObject* const o = PySequence_Fast_GET_ITEM(s,k);
-      int const m = PyInt_AS_LONG(o);
-      if ( ! ( -1 <= m && m < (int)nAA ) ) {
-	PyErr_SetString(PyExc_ValueError, "wrong args: invalid genetic code");
-	return 0;
-      }
-      geneticCode[k] = m;
-    }
+  if( ! readCorrectionArgs(pScoreMatrix, pGeneticCode, scoreMatrix, geneticCode) ) {
+    return 0;
   }
 
   uint nseq=0, naa=0;
@@ -676,9 +1186,9 @@ aaCorrect(PyObject*, PyObject* args, PyObject* kwds)
     return 0;
   }
   
-  AlignAndCorrect ac(scoreMatrix, scores, geneticCode);
+  AlignAndCorrect ac(&scoreMatrix[0], scores, geneticCode);
 
-  AlignAndCorrect::Result const& res = ac.doAlignment(dirtyRead, nseq, peptide, naa);
+  AlignAndCorrect::Result const& res = ac.doAlignment(dirtyRead, nseq, peptide, naa, band);
 
   PyObject* tup = PyTuple_New(4);
   {
@@ -767,6 +1277,275 @@ aaCorrect(PyObject*, PyObject* args, PyObject* kwds)
   return tup;
 }
 
+// Codes as a string of (signed) bytes
+
+template<typename T>
+static PyObject*
+asByteString(vector<T> const& v, bool const reversed)
+{
+  uint const n = v.size();
+  PyObject* const s = PyString_FromStringAndSize(0, n);
+  char* const c = PyString_AS_STRING(s);
+  for(uint i = 0; i < n; ++i) {
+    c[i] = static_cast<char>(v[reversed ? n-1-i : i]);
+  }
+  return s;
+}
+
+PyObject*
+aaCorrectMany(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char* kwlist[] = {"seqs", "aaseqs", "scoreMatrix", "geneticCode",
+				 "refIndex", "indel", "correction", "stopCodon", "threads", "band",
+				 "candidates", static_cast<const char*>(0)};
+
+  double indelPenalty = -10;
+  double correctionPenalty = -10;
+  double stopCodonPenalty = -100;
+  uint nThreads = 1;
+  uint band = 0;
+  uint nCandidates = 3;
+  
+  PyObject* pScoreMatrix;
+  PyObject* pGeneticCode;
+  PyObject* pseqs = 0;
+  PyObject* paaseqs = 0;
+  PyObject* pRefIndex = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OOOO|OdddIII", const_cast<char**>(kwlist),
+				    &pseqs,&paaseqs,&pScoreMatrix,&pGeneticCode,&pRefIndex,
+				    &indelPenalty,&correctionPenalty,&stopCodonPenalty,
+				    &nThreads,&band,&nCandidates)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  ProteinIndex const* const index = PyCapsule_IsValid(paaseqs, indexCapName) ?
+    reinterpret_cast<ProteinIndex*>(PyCapsule_GetPointer(paaseqs, indexCapName)) : 0;
+  
+  if( ! (PySequence_Check(pseqs) && (index || PySequence_Check(paaseqs))) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not sequences") ;
+    return 0;
+  }
+
+  CorrectionScores<float> const scores(indelPenalty, correctionPenalty, stopCodonPenalty);
+
+  vector<int> scoreMatrix;
+  int geneticCode[64];
+  if( ! readCorrectionArgs(pScoreMatrix, pGeneticCode, scoreMatrix, geneticCode) ) {
+    return 0;
+  }
+
+  uint const nSeqs = PySequence_Size(pseqs);
+  uint const nRefs = index ? index->refs.size() : PySequence_Size(paaseqs);
+  
+  // reference of each read
+  vector<uint> refIndex(nSeqs, 0);
+  if( index ) {
+    if( pRefIndex && pRefIndex != Py_None ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: refIndex with a reference index") ;
+      return 0;
+    }
+  } else if( pRefIndex && pRefIndex != Py_None ) {
+    if( ! (PySequence_Check(pRefIndex) && uint(PySequence_Size(pRefIndex)) == nSeqs) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: refIndex") ;
+      return 0;
+    }
+    for(uint k = 0; k < nSeqs; ++k) {
+      PyObject* const o = PySequence_GetItem(pRefIndex, k);
+      long const r = PyInt_AsLong(o);
+      Py_DECREF(o);
+      if( ! (0 <= r && r < long(nRefs)) ) {
+	PyErr_SetString(PyExc_ValueError, "wrong args: refIndex") ;
+	return 0;
+      }
+      refIndex[k] = r;
+    }
+  } else if( nRefs == nSeqs ) {
+    for(uint k = 0; k < nSeqs; ++k) {
+      refIndex[k] = k;
+    }
+  } else if( nRefs != 1 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: expecting one reference, or one per read");
+    return 0;
+  }
+  
+  vector< vector<byte> > reads;
+  vector< vector<byte> > aaseqs;
+  if( ! (readSequences(pseqs, false, reads) && (index || readSequences(paaseqs, true, aaseqs))) ) {
+    return 0;
+  }
+  vector< vector<byte> > const& peptides = index ? index->refs : aaseqs;
+
+  vector<AlignAndCorrect::Result> results(nSeqs);
+  // reads aligned reverse complemented
+  vector<bool> reversed(nSeqs, false);
+  std::atomic<uint> next(0);
+  
+  // one aligner per thread, reusing its DP storage between reads
+  auto const work = [&](void) {
+    AlignAndCorrect ac(&scoreMatrix[0], scores, geneticCode);
+    ProteinIndex::Work w;
+    vector<ProteinIndex::Candidate> cans;
+    vector<byte> rc;
+    
+    for(uint k = next++; k < nSeqs; k = next++) {
+      vector<byte> const& r = reads[k];
+      if( ! index ) {
+	vector<byte> const& p = peptides[refIndex[k]];
+	results[k] = ac.doAlignment(r.empty() ? 0 : &r[0], r.size(), p.empty() ? 0 : &p[0],
+				    p.size(), band);
+	continue;
+      }
+
+      // keep the best scoring of the shortlisted references
+      index->shortlist(r.empty() ? 0 : &r[0], r.size(), geneticCode, nCandidates, cans, w);
+      if( cans.empty() ) {
+	// nothing to align to
+	refIndex[k] = nRefs;
+	continue;
+      }
+      for(uint c = 0; c < cans.size(); ++c) {
+	const byte* sq = r.empty() ? 0 : &r[0];
+	if( cans[c].reversed ) {
+	  rc.resize(r.size());
+	  for(uint i = 0; i < r.size(); ++i) {
+	    byte const x = r[r.size()-1-i];
+	    rc[i] = x < 4 ? 3 - x : x;
+	  }
+	  sq = rc.empty() ? 0 : &rc[0];
+	}
+	vector<byte> const& p = peptides[cans[c].ref];
+	AlignAndCorrect::Result res = ac.doAlignment(sq, r.size(), p.empty() ? 0 : &p[0],
+						     p.size(), band);
+	if( c == 0 || res.score > results[k].score ) {
+	  results[k] = std::move(res);
+	  refIndex[k] = cans[c].ref;
+	  reversed[k] = cans[c].reversed;
+	}
+      }
+    }
+  };
+
+  Py_BEGIN_ALLOW_THREADS
+  uint const nt = std::max(1U, std::min(nThreads, nSeqs));
+  if( nt == 1 ) {
+    work();
+  } else {
+    vector<std::thread> pool;
+    for(uint t = 0; t < nt; ++t) {
+      pool.push_back(std::thread(work));
+    }
+    for(auto& t : pool) {
+      t.join();
+    }
+  }
+  Py_END_ALLOW_THREADS
+
+  PyObject* const r = PyList_New(nSeqs);
+  for(uint k = 0; k < nSeqs; ++k) {
+    if( refIndex[k] == nRefs ) {
+      Py_INCREF(Py_None);
+      PyList_SET_ITEM(r, k, Py_None);
+      continue;
+    }
+    AlignAndCorrect::Result const& res = results[k];
+    PyObject* const tup = PyTuple_New(6);
+    PyTuple_SET_ITEM(tup, 0, asByteString(res.alignedFramedRead, true));
+    PyTuple_SET_ITEM(tup, 1, asByteString(res.alignedAA, true));
+    uint const stats[] = {res.matches, res.mismatches, res.gaps,
+			  res.correctionDeletions, res.correctionInsertions,
+			  res.dnaFreeStart, res.dnaFreeEnd, res.aaFreeStart, res.aaFreeEnd};
+    uint const nStats = sizeof(stats)/sizeof(stats[0]);
+    PyObject* const st = PyTuple_New(nStats);
+    for(uint i = 0; i < nStats; ++i) {
+      PyTuple_SET_ITEM(st, i, PyInt_FromLong(stats[i]));
+    }
+    PyTuple_SET_ITEM(tup, 2, st);
+    PyTuple_SET_ITEM(tup, 3, asByteString(res.dnaBoundries, true));
+    PyTuple_SET_ITEM(tup, 4, PyInt_FromLong(refIndex[k]));
+    PyTuple_SET_ITEM(tup, 5, PyBool_FromLong(reversed[k]));
+    PyList_SET_ITEM(r, k, tup);
+  }
+  return r;
+}
+
+PyObject*
+proteinIndex(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char* kwlist[] = {"aaseqs", "k", static_cast<const char*>(0)};
+  PyObject* paaseqs = 0;
+  uint k = 4;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|I", const_cast<char**>(kwlist),
+				    &paaseqs,&k) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( ! (0 < k && k <= ProteinIndex::maxK) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: k out of range") ;
+    return 0;
+  }
+  
+  vector< vector<byte> > refs;
+  if( ! readSequences(paaseqs, true, refs) ) {
+    return 0;
+  }
+
+  ProteinIndex* index;
+  Py_BEGIN_ALLOW_THREADS
+  index = new ProteinIndex(refs, k);
+  Py_END_ALLOW_THREADS
+  
+  return PyCapsule_New(index, indexCapName, proteinIndexDestructor);
+}
+
+PyObject*
+shortlist(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char* kwlist[] = {"seqs", "index", "geneticCode", "top",
+				 static_cast<const char*>(0)};
+  PyObject* pseqs = 0;
+  PyObject* pIndex = 0;
+  PyObject* pGeneticCode = 0;
+  uint top = 3;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OOO|I", const_cast<char**>(kwlist),
+				    &pseqs,&pIndex,&pGeneticCode,&top) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( ! PyCapsule_IsValid(pIndex, indexCapName) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a protein index") ;
+    return 0;
+  }
+  ProteinIndex const& index =
+    *reinterpret_cast<ProteinIndex*>(PyCapsule_GetPointer(pIndex, indexCapName));
+  
+  int geneticCode[64];
+  vector< vector<byte> > reads;
+  if( ! (readGeneticCode(pGeneticCode, geneticCode) && readSequences(pseqs, false, reads)) ) {
+    return 0;
+  }
+
+  ProteinIndex::Work w;
+  vector<ProteinIndex::Candidate> cans;
+  PyObject* const r = PyList_New(reads.size());
+  for(uint k = 0; k < reads.size(); ++k) {
+    vector<byte> const& sq = reads[k];
+    index.shortlist(sq.empty() ? 0 : &sq[0], sq.size(), geneticCode, top, cans, w);
+    PyObject* const l = PyList_New(cans.size());
+    for(uint i = 0; i < cans.size(); ++i) {
+      PyList_SET_ITEM(l, i, Py_BuildValue("(IIO)", cans[i].ref, cans[i].shared,
+					  cans[i].reversed ? Py_True : Py_False));
+    }
+    PyList_SET_ITEM(r, k, l);
+  }
+  return r;
+}
+
 #include "seqslist.cc"
 
 // template <typename T>
@@ -783,10 +1562,10 @@ aaCorrect(PyObject*, PyObject* args, PyObject* kwds)
 //   return v;
 // }
 
-inline float
-maxit(const float* const x, uint start, uint const end)
+inline int
+maxit(const int* const x, uint start, uint const end)
 {
-  float v = x[start];
+  int v = x[start];
   start += 1;
   
   while( start < end ) {
@@ -815,10 +1594,10 @@ maxit(const float* const x, uint start, uint const end)
 // }
 
 inline int
-imax(const float* const x, uint start, uint const end)
+imax(const long* const x, uint start, uint const end)
 {
   int i = start;
-  float v = x[i];
+  long v = x[i];
   start += 1;
   
   while( start < end ) {
@@ -891,15 +1670,15 @@ compat(uint const i, uint const ip)
 }
 
 // Reversed sort: order reported as an indices permutation. Cool C++-11
-// features. 
+// features. Equal scores keep their order, as in imax.
 static inline void
-sortv(const float* const v, uint const n, int* inds)
+sortv(const long* const v, uint const n, int* inds)
 {
   for(uint k = 0; k < n; ++k) {
     inds[k] = k;
   }
   auto const fcmp = [v] (int i1, int i2) -> bool { return v[i1] > v[i2]; };
-  std::sort(inds, inds + n, fcmp);
+  std::stable_sort(inds, inds + n, fcmp);
 }
 
 inline float
@@ -953,136 +1732,172 @@ cost(byte const x, byte const y, const byte* const nb)
 }
 #endif
 
-static byte*
-getAAcons(SeqsList const& seqs, int const (&geneticCode)[64], uint& fstart)
+// 64 scores for each DNA triplet, 16 for each pair, 4 for each singleton
+static uint const dsb = (64 + 16 + 4);
+// double the trouble by adding a "deleted state" score for each combination.
+static uint const nv = 2*dsb;
+
+// Scores are kept multiplied by 6, so that the halves and thirds of costs
+// are integers. Sums are then exact, ties between states are real ties, and
+// totals do not depend on the order sequences are added in.
+static int const scoreScale = 6;
+
+// Add the scores of one aligned sequence to 'profile' [nSites x nv]. 'nb'
+// [nSites x 2] and 'rows' [2 x nv] are work space.
+static void
+addSeqScores(const byte* const seq, uint const nSites, int const (&geneticCode)[64],
+	     byte* const nb, int* const rows, long* const profile)
 {
-  uint const nSeq = seqs.nSeqs;
-  uint const nSites = seqs.seqslen[0];
-  // 0 is left, 1 is right
-  byte* const nb = new byte [nSites*2];
-
-  // 64 scores for each DNA triplet, 16 for each pair, 4 for each singleton
-  uint const dsb = (64 + 16 + 4);
-  // double the trouble by adding a "deleted state" score for each combination.
-  uint const nv = 2*dsb;
-
-  // per sequence scores accumulated here
-  float** const seqScore = new float* [nSites];
-  // total scores accumulated here
-  float** const profileScore = new float* [nSites];
-
-  uint const nCells = nSites * nv;
-  seqScore[0] = new float [nCells];
-  profileScore[0] = new float [nCells];
-  std::fill(profileScore[0], profileScore[0]+nCells, 0);
-  
-  for(uint k = 1; k < nSites; ++k) {
-    seqScore[k] = seqScore[k-1] + nv;
-    profileScore[k] = profileScore[k-1] + nv;
+  // Establish neighbors
+  nb[2*0 + 0] = gap;
+  for(uint si = 1; si < nSites; ++si) {
+    nb[2*si+0] = (seq[si-1] != gap) ? seq[si-1] : nb[2*(si-1)+0];
   }
 
-  for(uint ns = 0; ns < nSeq; ++ns) {
-    const byte* seq = seqs.seqs[ns];
-    // Establish neighbors
-    nb[2*0 + 0] = gap;
-    for(uint si = 1; si < nSites; ++si) {
-      nb[2*si+0] = (seq[si-1] != gap) ? seq[si-1] : nb[2*(si-1)+0];
-    }
-
-    nb[2*(nSites-1) + 1] = gap;
-    for(uint si = nSites-1; si > 0; --si) {
-      nb[2*(si-1) + 1] = (seq[si] != gap) ? seq[si] : nb[2*si + 1];
-    }
+  nb[2*(nSites-1) + 1] = gap;
+  for(uint si = nSites-1; si > 0; --si) {
+    nb[2*(si-1) + 1] = (seq[si] != gap) ? seq[si] : nb[2*si + 1];
+  }
 
-    // Not sure if skipping stop codon cases altogether would make code slower
-    // or faster. I hope it makes little difference since usually the number of
-    // stop codons is smalll. 
-    float const stopCodonPenalty = -50000;
+  // Not sure if skipping stop codon cases altogether would make code slower
+  // or faster. I hope it makes little difference since usually the number of
+  // stop codons is smalll. 
+  int const stopCodonPenalty = -50000 * scoreScale;
     
-    // first column special case. duplicate code to avoide checks in the busy
-    // main loop  .
-    {
-      uint const si = 0;
-      byte const xi = seq[si];
-      const byte* const nbsi = nb + 2*si;
-      float const c[4] = {cost(xi, 0, nbsi),cost(xi, 1, nbsi),
-			  cost(xi, 2, nbsi),cost(xi, 3, nbsi)};
+  // first column special case. duplicate code to avoide checks in the busy
+  // main loop  .
+  {
+    uint const si = 0;
+    byte const xi = seq[si];
+    const byte* const nbsi = nb + 2*si;
+    int const c[4] = {scoreScale * int(cost(xi, 0, nbsi)), scoreScale * int(cost(xi, 1, nbsi)),
+		      scoreScale * int(cost(xi, 2, nbsi)), scoreScale * int(cost(xi, 3, nbsi))};
 
-      auto const scsi = seqScore[si];
+    auto const scsi = rows;
       
-      for(uint i = 0; i < 4; ++i) {
-	scsi[64+16 + i] = c[i]; 
-	for(uint j = 0; j < 4; ++j) {
-	  scsi[64 + 4*j + i] = c[i]/2;
-	  for(uint k = 0; k < 4; ++k) {
-	    uint const ii = 16*k + 4*j + i;
-	    // assume any wildcard is not all stop codons???
-	    scsi[ii] = geneticCode[ii] >= 0 ? c[i]/3 : stopCodonPenalty;
-	  }
+    for(uint i = 0; i < 4; ++i) {
+      scsi[64+16 + i] = c[i]; 
+      for(uint j = 0; j < 4; ++j) {
+	scsi[64 + 4*j + i] = c[i]/2;
+	for(uint k = 0; k < 4; ++k) {
+	  uint const ii = 16*k + 4*j + i;
+	  // assume any wildcard is not all stop codons???
+	  scsi[ii] = geneticCode[ii] >= 0 ? c[i]/3 : stopCodonPenalty;
 	}
       }
-      float const dc = cost(xi, gap, nbsi);
-      for(uint i = 0; i < dsb; ++i) {
-	scsi[dsb+i] = dc;
-      }
     }
+    int const dc = scoreScale * int(cost(xi, gap, nbsi));
+    for(uint i = 0; i < dsb; ++i) {
+      scsi[dsb+i] = dc;
+    }
+  }
+  // add column scores to profile 
+  for(uint i = 0; i < nv; ++i) {
+    profile[i] += rows[i];
+  }
     
-    for(uint si = 1; si < nSites; ++si) {
-      // nuc at site si
-      byte const xi = seq[si];
-      const byte* const nbsi = nb + 2*si;
-      // match costs to nuc
-      // Its fun when you have 4 cases forever. Well, at least until we get back
-      // the samples from mars.
-      float const c[4] = {cost(xi, 0, nbsi), cost(xi, 1, nbsi),
-			  cost(xi, 2, nbsi), cost(xi, 3, nbsi)};
-
-      float const cd2[4] = {c[0]/2, c[1]/2, c[2]/2, c[3]/2};
-      float const cd3[4] = {c[0]/3, c[1]/3, c[2]/3, c[3]/3};
-
-      auto const scsi = seqScore[si];
-      auto const scsim1 = seqScore[si-1];
+  for(uint si = 1; si < nSites; ++si) {
+    // nuc at site si
+    byte const xi = seq[si];
+    const byte* const nbsi = nb + 2*si;
+    // match costs to nuc
+    // Its fun when you have 4 cases forever. Well, at least until we get back
+    // the samples from mars.
+    int const c[4] = {scoreScale * int(cost(xi, 0, nbsi)), scoreScale * int(cost(xi, 1, nbsi)),
+		      scoreScale * int(cost(xi, 2, nbsi)), scoreScale * int(cost(xi, 3, nbsi))};
+
+    int const cd2[4] = {c[0]/2, c[1]/2, c[2]/2, c[3]/2};
+    int const cd3[4] = {c[0]/3, c[1]/3, c[2]/3, c[3]/3};
+
+    // only the previous column is kept
+    auto const scsi = rows + (si & 1) * nv;
+    auto const scsim1 = rows + ((si-1) & 1) * nv;
 	
-      float const anyEndU = maxit(scsim1, 0, 64);
-      float const anyEndD = maxit(scsim1, dsb, dsb+64);
-      // score of a frame ending at previous column. (previous column may be
-      // deleted or not). 
-      float const anyEnd = std::max(anyEndU,anyEndD);
-
-      for(uint i = 0; i < 4; ++i) {
-	scsi[64+16 + i] = anyEnd + c[i]; 
-	for(uint j = 0; j < 4; ++j) {
-	  uint const jj = 64+16+j;
-	  float const m0 = std::max(scsim1[jj], scsim1[dsb + jj]);
-	  scsi[64 + 4*j + i] = m0 + cd2[i]; //c[i]/2;
+    int const anyEndU = maxit(scsim1, 0, 64);
+    int const anyEndD = maxit(scsim1, dsb, dsb+64);
+    // score of a frame ending at previous column. (previous column may be
+    // deleted or not). 
+    int const anyEnd = std::max(anyEndU,anyEndD);
+
+    for(uint i = 0; i < 4; ++i) {
+      scsi[64+16 + i] = anyEnd + c[i]; 
+      for(uint j = 0; j < 4; ++j) {
+	uint const jj = 64+16+j;
+	int const m0 = std::max(scsim1[jj], scsim1[dsb + jj]);
+	scsi[64 + 4*j + i] = m0 + cd2[i]; //c[i]/2;
 	  
-	  for(uint k = 0; k < 4; ++k) {
-	    uint const ii = 16*k + 4*j + i;
-	    // assume any wildcard is not all stop codons???
-	    if( geneticCode[ii] >= 0 ) {
-	      uint const kj = 64 + 4*k + j;
-	      float const m1 = std::max(scsim1[kj], scsim1[dsb + kj]);
-	      scsi[ii] = m1 + cd3[i]; // c[i]/3;
-	    } else {
-	      scsi[ii] = stopCodonPenalty;
-	    }
+	for(uint k = 0; k < 4; ++k) {
+	  uint const ii = 16*k + 4*j + i;
+	  // assume any wildcard is not all stop codons???
+	  if( geneticCode[ii] >= 0 ) {
+	    uint const kj = 64 + 4*k + j;
+	    int const m1 = std::max(scsim1[kj], scsim1[dsb + kj]);
+	    scsi[ii] = m1 + cd3[i]; // c[i]/3;
+	  } else {
+	    scsi[ii] = stopCodonPenalty;
 	  }
 	}
       }
-      float const dc = cost(xi, gap, nbsi);
-      for(uint i = 0; i < dsb; ++i) {
-	scsi[dsb+i] = std::max(scsim1[i], scsim1[dsb + i]) + dc;
-      }
     }
-    // add sequence scores to profile score matrix
-    {
-      float* s = seqScore[0];
-      float* p = profileScore[0];
+    int const dc = scoreScale * int(cost(xi, gap, nbsi));
+    for(uint i = 0; i < dsb; ++i) {
+      scsi[dsb+i] = std::max(scsim1[i], scsim1[dsb + i]) + dc;
+    }
+    
+    long* const p = profile + si * nv;
+    for(uint i = 0; i < nv; ++i) {
+      p[i] += scsi[i];
+    }
+  }
+}
+
+static byte*
+getAAcons(SeqsList const& seqs, int const (&geneticCode)[64], uint& fstart, uint const nThreads)
+{
+  uint const nSeq = seqs.nSeqs;
+  uint const nSites = seqs.seqslen[0];
+  uint const nCells = nSites * nv;
+
+  // total scores accumulated here, exactly (see scoreScale), so they do not
+  // depend on how sequences are split between threads.
+  vector<long> profile(nCells, 0);
+  
+  uint const nt = std::max(1U, std::min(nThreads, nSeq));
+  // partial totals of threads other than the first
+  vector< vector<long> > partial(nt-1);
+  std::atomic<uint> next(0);
+
+  auto const work = [&](uint const t) {
+    vector<byte> nb(nSites*2);
+    vector<int> rows(2*nv);
+    long* const p = t == 0 ? &profile[0] : &(partial[t-1] = vector<long>(nCells, 0))[0];
+    for(uint ns = next++; ns < nSeq; ns = next++) {
+      addSeqScores(seqs.seqs[ns], nSites, geneticCode, &nb[0], &rows[0], p);
+    }
+  };
+  
+  if( nt == 1 ) {
+    work(0);
+  } else {
+    vector<std::thread> pool;
+    for(uint t = 1; t < nt; ++t) {
+      pool.push_back(std::thread(work, t));
+    }
+    work(0);
+    for(auto& t : pool) {
+      t.join();
+    }
+    for(auto const& q : partial) {
       for(uint i = 0; i < nCells; ++i) {
-	*p++ += *s++;
+	profile[i] += q[i];
       }
     }
   }
+  
+  vector<long*> profileScore(nSites);
+  for(uint k = 0; k < nSites; ++k) {
+    profileScore[k] = &profile[k * nv];
+  }
 
   byte* states = new byte [nSites];
   int* istates = new int [nSites];
@@ -1179,13 +1994,6 @@ getAAcons(SeqsList const& seqs, int const (&geneticCode)[64], uint& fstart)
   int const frame = decode(prevColCode,t) - 1;
   fstart = lastNonDeletedColumn + ((3-frame) % 3);
   
-  delete [] profileScore[0];
-  delete [] seqScore[0];
-  delete [] seqScore;
-  delete [] profileScore;
-
-  delete [] nb;
-
   delete [] istates;
   
   return states;
@@ -1195,14 +2003,15 @@ getAAcons(SeqsList const& seqs, int const (&geneticCode)[64], uint& fstart)
 PyObject*
 aaCons(PyObject*, PyObject* args, PyObject* kwds)
 {
-  static const char* kwlist[] = {"seqs", "geneticCode",
+  static const char* kwlist[] = {"seqs", "geneticCode", "threads",
 				 static_cast<const char*>(0)};
 
   PyObject* pGeneticCode;
   PyObject* pseqs = 0;
+  uint nThreads = 1;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO", const_cast<char**>(kwlist),
-				    &pseqs,&pGeneticCode) ) {
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|I", const_cast<char**>(kwlist),
+				    &pseqs,&pGeneticCode,&nThreads) ) {
     PyErr_SetString(PyExc_ValueError, "wrong args.") ;
     return 0;
   }
@@ -1212,19 +2021,9 @@ aaCons(PyObject*, PyObject* args, PyObject* kwds)
     return 0;
   }
 
-  if( ! (PySequence_Check(pGeneticCode) && PySequence_Size(pGeneticCode) == 64) ) {
-    PyErr_SetString(PyExc_ValueError, "wrong args: invalid genetic code");
-  }
-  
   int geneticCode[64];
-  {
-    PyObject* const s = PySequence_Fast(pGeneticCode, "error");
-    for(uint k = 0; k < 64; ++k) {
-      PyObject* const o = PySequence_Fast_GET_ITEM(s,k);
-      int const m = PyInt_AS_LONG(o);
-      assert( -1 <= m && m < (int)nAA );
-      geneticCode[k] = m;
-    }
+  if( ! readGeneticCode(pGeneticCode, geneticCode) ) {
+    return 0;
   }
 
   std::unique_ptr<const SeqsList> seqs(readSeqsIn(pseqs, false));
@@ -1232,7 +2031,10 @@ aaCons(PyObject*, PyObject* args, PyObject* kwds)
     return 0;
   }
   uint fstart;
-  const byte* s = getAAcons(*seqs, geneticCode, fstart);
+  const byte* s;
+  Py_BEGIN_ALLOW_THREADS
+  s = getAAcons(*seqs, geneticCode, fstart, nThreads);
+  Py_END_ALLOW_THREADS
 
   PyObject* tup = PyTuple_New(2);
   
@@ -1257,10 +2059,39 @@ PyDoc_STRVAR(aalign__doc__,
 
 static PyMethodDef aalignMethods[] = {
   {"acorrect",	(PyCFunction)aaCorrect, METH_VARARGS|METH_KEYWORDS,
-   "Align DNA to AA reference and correct errors."},
+   "Align DNA to AA reference and correct errors. With a positive 'band', only"
+   " alignments within 'band' nucleotides of the reference diagonal are considered, for"
+   " reads nearly collinear with the reference. The band is widened while the alignment"
+   " runs near its edges, or while the residues out of its reach could score more than the"
+   " alignment found, so it saves time mostly on close matches. The band is a heuristic:"
+   " an alignment leaving and re-entering it can be missed, giving a worse alignment than"
+   " with the full matrix."},
+  
+  {"acorrectMany",	(PyCFunction)aaCorrectMany, METH_VARARGS|METH_KEYWORDS,
+   "As acorrect, for many DNA sequences, each aligned to one of 'aaseqs': the one given in"
+   " 'refIndex', else the only one or the one in the same position. Done in parallel with"
+   " 'threads', and with 'band' as in acorrect. 'aaseqs' may be a proteinIndex, and then"
+   " each sequence is aligned to the best scoring of the 'candidates' references"
+   " shortlisted for it (reverse complemented when seeded on the reverse strand). For each"
+   " sequence returns the aligned DNA, aligned AA and DNA boundaries as strings of signed"
+   " bytes (array('b', s) gives the codes of acorrect), the statistics as a tuple"
+   " (matches, mismatches, gaps, correctionDeletions, correctionInsertions, dnaFreeStart,"
+   " dnaFreeEnd, aaFreeStart, aaFreeEnd), the reference index and whether the sequence"
+   " was reverse complemented. A sequence with no shortlisted reference is not aligned,"
+   " and gets None."},
+  
+  {"proteinIndex",	(PyCFunction)proteinIndex, METH_VARARGS|METH_KEYWORDS,
+   "Index of the 'k'-mers (k <= 5) of amino acid sequences 'aaseqs', for shortlist and"
+   " acorrectMany."},
+  
+  {"shortlist",	(PyCFunction)shortlist, METH_VARARGS|METH_KEYWORDS,
+   "For each DNA sequence, up to 'top' references of 'index' sharing most distinct k-mers"
+   " with one of its 6 frames translated by 'geneticCode', as (reference, shared,"
+   " reversed)."},
   
   {"aacons",	(PyCFunction)aaCons, METH_VARARGS|METH_KEYWORDS,
-   "Valid coding amino acid from a nuclieotide alignment."},
+   "Valid coding amino acid from a nuclieotide alignment. Sequences are scored in"
+   " parallel with 'threads'."},
   
   {NULL, NULL, 0, NULL}        /* Sentinel */
 };
@@ -179,7 +179,7 @@ def seqMultiAlign(seqs, scores = defaultMatchScores, report=False) :
   
   a = calign.globalAlign(seqs[0], seqs[1], scores=scores)
   ns = 2
-  p = calign.createProfile(a)
+  p = calign.createProfile(a, native = True)
 
   a = tuple(iton(x) for x in a)
   
@@ -198,15 +198,8 @@ def seqMultiAlign(seqs, scores = defaultMatchScores, report=False) :
                                                     gapPenalty=defaultMatchScores.gap)
 
     if extendLeft > 0 or extendRight > 0 :
-      gapProfile = [0,0,0,0,0,ns]
-      p1 = tuple((list(gapProfile) for k in range(extendLeft))) + p \
-           + tuple((list(gapProfile) for k in range(extendRight)))
-    else :
-      p1 = p
-    
-    for k,n in enumerate(pa) :
-      p1[k][n] += 1
-    p = p1
+      p.pad(extendLeft, extendRight)
+    p.add(pa)
       
     if extendLeft > 0 or extendRight > 0 :
       fr = '-'*extendLeft
@@ -299,7 +292,6 @@ def refineAlignment(al, ci = [0], drop = False, mx = -1, rev = False, verbose =
   if not isinstance(al, list) :
     al = list(al)
     
-  p = calign.createProfile(al)
   if rev:
     can = [(k,s) for k,s in enumerate(al) if all([s[x] == '-' for x in ci])]
   else :
@@ -316,10 +308,12 @@ def refineAlignment(al, ci = [0], drop = False, mx = -1, rev = False, verbose =
   changed = 0
   if len(can) :
     
-    pr = calign.createProfile([s for n,s in can])
-    p2 = tuple([[a-b for a,b in zip(x,y)] for x,y in zip(p,pr)])
+    p2 = calign.createProfile(al, native = True)
+    for n,s in can:
+      p2.remove(s)
     if drop:
-      p2,rx = removeColumns(p2, ci)
+      rx = toRanges(ci)
+      p2.removeColumns(ci)
     
     for n,s in can:
       if len(s.replace('-','')) <= len(p2) :
@@ -348,27 +342,31 @@ def refineSingle(al, gapPenalty = defaultMatchScores.gap) :
   if not isinstance(al, list) :
     al = list(al)
     
-  p = calign.createProfile(al)
+  p = calign.createProfile(al, native = True)
 
   q = []
   for k,s in enumerate(al) :
-    ps = calign.createProfile([s])
-    p2 = tuple([[a-b for a,b in zip(x,y)] for x,y in zip(p,ps)])
-
-    q.append( calign.profileAlign(s, p2, gapPenalty = gapPenalty) )
+    p.remove(s)
+    q.append( calign.profileAlign(s, p, gapPenalty = gapPenalty) )
+    p.add(s)
 
   return q
 
 def mpc(seqs, nRefines = 4, gapPenalty = defaultMatchScores.gap) :
+  """ Consensus of seqs and their alignment. The alignment is refined by
+  realigning each sequence to the rest (with a linear 'gapPenalty'), until the
+  consensus does not change or after 'nRefines' more rounds. A realigned
+  sequence is kept only when it improves the score."""
   al = seqMultiAlign(seqs, scores = defaultMatchScores._replace(gap = gapPenalty))
+  scores = defaultMatchScores._replace(gap = gapPenalty, gape = gapPenalty)
 
   c0 = stripseq(cons(calign.createProfile(al)))
-  r = refineSingle(al, gapPenalty = gapPenalty)
+  r = calign.refineAlignment(al, scores = scores, rounds = 1)[0]
   c1 = stripseq(cons(calign.createProfile(r)))
   cnt = 0
   while c0 != c1 and cnt < nRefines:
     c0 = c1
-    r = refineSingle(r, gapPenalty = gapPenalty)
+    r = calign.refineAlignment(r, scores = scores, rounds = 1)[0]
     c1 = stripseq(cons(calign.createProfile(r)))
     cnt += 1
   return c1, r
@@ -485,7 +483,31 @@ def trimendsp(p, th = .6) :
   #print len(p), len(p[j:i+1])
   return p[j:i+1]
 
-def mpa(tr, seqs, scores = defaultMatchScores, trimEnd = None) :
+def guideTreeJoins(tr, seqs) :
+  """ Sequences of tree taxa and the tree joins, as expected by
+  calign.progressiveAlign. """
+  dseqs = dict(seqs)
+  sq, joins, ids = [], [], dict()
+  nTaxa = len(tr.get_terminals())
+  for n in getPostOrder(tr) :
+    if not n.succ :
+      ids[n.id] = len(sq)
+      sq.append(dseqs[n.data.taxon.strip("'")])
+    else :
+      ids[n.id] = nTaxa + len(joins)
+      joins.append([ids[x] for x in n.succ])
+  return sq, joins
+
+def mpa(tr, seqs, scores = defaultMatchScores, trimEnd = None, threads = 1) :
+  """ Profile of the progressive alignment of 'seqs' along guide tree 'tr', as
+  returned by calign.prof2profAlign (a tuple of per column counts). """
+  if trimEnd is None :
+    sq, joins = guideTreeJoins(tr, seqs)
+    if len(sq) < 2 :
+      return None
+    p = calign.progressiveAlign(sq, joins, scores = scores, threads = threads)[1]
+    return tuple(tuple(c) for c in p.columns())
+  
   dseqs = dict(seqs)
   #scores = (None,None,gapPenalty,feg)
   for n in getPostOrder(tr) :
@@ -497,16 +519,16 @@ def mpa(tr, seqs, scores = defaultMatchScores, trimEnd = None) :
       if s1[1] :
         if s2[1] :
           a = calign.globalAlign(s1[1],s2[1], scores = scores)
-          data.seq = (calign.createProfile(a),None)
+          data.seq = (calign.createProfile(a, native = True),None)
         else :
-          p1,p2 = calign.createProfile(s1[1:]), s2[0]
+          p1,p2 = calign.createProfile(s1[1:], native = True), s2[0]
           pa = calign.prof2profAlign(p1,p2, scores = scores)
           data.seq = (trimendsp(pa, trimEnd) if trimEnd is not None else pa,None)
           #print len(pa)
       else :
         p1 = s1[0]
         if s2[1] :
-          p2 = calign.createProfile(s2[1:])
+          p2 = calign.createProfile(s2[1:], native = True)
         else :
           p2 = s2[0]
         pa = calign.prof2profAlign(p1,p2, scores = scores)
@@ -548,9 +570,9 @@ def mpat(tr, seqs) :
       if s1[1] :
         if s2[1] :
           a = calign.globalAlign(s1[1],s2[1])
-          data.seq = (calign.createProfile(a),None)
+          data.seq = (calign.createProfile(a, native = True),None)
         else :
-          p1,p2 = calign.createProfile(s1[1:]), s2[0]
+          p1,p2 = calign.createProfile(s1[1:], native = True), s2[0]
           #assert all([sum(x)==sum(p1[0]) for x in p1])
           #assert all([sum(x)==sum(p2[0]) for x in p2])
           pa = calign.prof2profAlign(p1,p2)
@@ -559,7 +581,7 @@ def mpat(tr, seqs) :
       else :
         p1 = s1[0]
         if s2[1] :
-          p2 = calign.createProfile(s2[1:])
+          p2 = calign.createProfile(s2[1:], native = True)
         else :
           p2 = s2[0]
         #assert all([sum(x)==sum(p1[0]) for x in p1])
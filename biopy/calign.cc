@@ -10,9 +10,17 @@
 #include <cassert>
 
 #include <limits>
+#include <cstring>
 #include<memory>
 #include <algorithm>
+#include <numeric>
 #include <vector>
+#include <queue>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 using std::vector;
 
 enum ComparisonResult {
@@ -95,6 +103,7 @@ public:
   }
   
   MatchScoreValues(T mt, T mis, T gapo, T* gape, bool free) :
+    values(0),
     matchScore(mt),
     misMatchScore(mis),
     gapOpen(gapo),
@@ -181,41 +190,13 @@ public:
     return mt * matchScore + ms * misMatchScore + gp * gapPenalty;
   }
 
-  // gaps across profiles count as a match. maybe they need another match score?
+  // As scoreGap, with the n * pn new gaps paying the extension penalty
   inline T
-  scoreMatching(const int* const p2j,
-		ProfileCounts const& ri, ProfileCounts const& cj,
-		const ProfileCounts* const iCounts) const {
-    int mt = ri.matches + cj.matches;
-    int ms = ri.mis     + cj.mis;
-    int gp = ri.gaps    + cj.gaps;
-
-    for(int k = 0; k < 4; ++k) {
-      if( int const n = p2j[k] ) {
-	auto const& ck = iCounts[k];
-	mt += n * ck.matches;
-	ms += n * ck.mis;
-	//gp += n * ck.gaps;
-	mt += n * ck.gaps;
-      }
-    }
-    {
-      if( int const n = p2j[gap] ) {
-	//gp += n * iCounts[gap].gaps;
-	mt += n * iCounts[gap].gaps;	
-      }
-    }
-    {
-      if( int const n = p2j[anynuc] ) {
-	auto const& an = iCounts[anynuc];
-	mt += n * an.matches;
-	//gp += n * an.gaps;
-	mt += n * an.gaps;	
-      }
-    }      
-
-    T const sm = matchScore * mt + misMatchScore * ms + gp * gapPenalty;
-    return sm;
+  scoreGapExtend(ProfileCounts const& pc, uint n, uint pn) const {
+    uint const mt = pc.matches;
+    uint const ms = pc.mis;
+    uint const gp = pc.gaps;
+    return mt * matchScore + ms * misMatchScore + gp * gapPenalty + (n * pn) * gapExtend;
   }
 };
 
@@ -321,9 +302,27 @@ protected:
   void fillScoreTable(MatchScoreValues<T> const&  mScores,
 		      Alignment const&            prev);
 
+  void fillScoreTableAffine(MatchScoreValues<T> const&  mScores,
+			    Alignment const&            prev);
+
+  // Fill cells [j0+1..lseq2] of row i of the three affine tables.
+  void fillScoreRowAffine(MatchScoreValues<T> const& mScores, uint i, uint j0);
+
   // Returns True if linear gap scores, False if affine
   bool fillScores(MatchScoreValues<T> const& mScores);
 
+  // Affine traceback. Which of the three tables (score, iy, ix) the path
+  // goes through at the current cell. 'inGapS1' consumes a nucleotide of s1
+  // against a gap, 'inGapS2' one of s2.
+  enum AffineState { inMatch, inGapS1, inGapS2 };
+
+  AffineState startState(uint iRow, uint jCol, bool freeEndGaps) const;
+
+  // State of the path at the cell preceding 'cur' (row iRow, column jCol),
+  // given the path is in 'state' at 'cur'.
+  AffineState traceState(MatchScoreValues<T> const& scores, AffineState state,
+			 uint cur, uint iRow, uint jCol) const;
+
   uint const  sz;
   T*   const  score;
 
@@ -345,10 +344,12 @@ Alignment<T>::fillScores(MatchScoreValues<T> const& mScores) {
 		     mScores.freeEndGaps ? 0 : mScores.gapExtend);
   }
   
-  if( prev && lin ) {
-    // need to implement fillScoreTableAffine(mScores, *prev)
-
-    fillScoreTable(mScores, *prev);
+  if( prev ) {
+    if( lin ) {
+      fillScoreTable(mScores, *prev);
+    } else {
+      fillScoreTableAffine(mScores, *prev);
+    }
   } else {
     if( lin ) {
       fillScoreTable(mScores);
@@ -531,14 +532,42 @@ Alignment<T>::fillScoreTable(MatchScoreValues<T> const&  mScores,
   }
 }
 
-#if 0
+template<typename T>
+inline void
+Alignment<T>::fillScoreRowAffine(MatchScoreValues<T> const&  mScores,
+				 uint const                  i,
+				 uint const                  j0)
+{
+  uint const o = (i-1)*(lseq2+1) + j0;
+  T* m1m1 = score + o;
+  T* xm1m1 = ix + o;
+  T* ym1m1 = iy + o;
+  
+  byte const s1i = s1[i-1];
+  for(const byte* s2j = s2 + j0; s2j < s2 + lseq2; ++s2j) {
+    T const match = mScores.scoreMatching(s1i, *s2j);
+    T const del = *(m1m1+1) + mScores.gapOpen;
+    T const ins = *(m1m1+1+lseq2) + mScores.gapOpen;
+#if defined(ALLASSERTS)
+    assert ( uint((m1m1+lseq2+2) - score) < ((lseq1+1) * (lseq2+1)) );
+#endif
+      
+    *(ym1m1+lseq2+2) = std::max(del, *(ym1m1+1) + mScores.gapExtend);
+    *(xm1m1+lseq2+2) = std::max(ins, *(xm1m1+1+lseq2) + mScores.gapExtend);
+	
+    *(m1m1+lseq2+2) = match + std::max(std::max(*m1m1, *xm1m1), *ym1m1);
+    ++m1m1; ++xm1m1; ++ym1m1;
+  }
+}
+
 template<typename T>
 void
 Alignment<T>::fillScoreTableAffine(MatchScoreValues<T> const&  mScores,
 				   Alignment const&            prev)
 {
+  // prev filled with linear gaps, nothing to reuse
   if( ! prev.ix ) {
-    fillScoreTable(mScores);
+    fillScoreTableAffine(mScores);
     return;
   }
   
@@ -561,57 +590,72 @@ Alignment<T>::fillScoreTableAffine(MatchScoreValues<T> const&  mScores,
     }
   
     for(int i = 1; i < s1MatchLen+1; ++i) {
-      const T* p = prev.score + i*(prev.lseq2+1) + 1;
-      const T* px = prev.ix + i*(prev.lseq2+1) + 1;
-      const T* py = prev.iy + i*(prev.lseq2+1) + 1;
-
+      uint const poff = i*(prev.lseq2+1) + 1;
       uint const off = i*(lseq2+1) + 1;
-      T* m = score + off;
-      T* mx = ix + off;
-      T* my = iy + off;
       
-      T* end = m + s2MatchLen;
-      for(/**/; m < end; ++m, ++p) {
-	*m = *p;
-	*mx++ = *px++;
-	*my++ = *py++;
-      }
-      if( uint(s2MatchLen) < lseq2 ) {
-	m -= (lseq2+2);
-	byte const s1i = s1[i-1];
-	for(const byte* s2j = s2+s2MatchLen; s2j < s2 + lseq2; ++s2j) {
-	  T const match = *m + mScores.scoreMatching(s1i, *s2j);      
-	  T const del = *(m+1) + mScores.gapPenalty;
-	  T const ins = *(m+1+lseq2) + mScores.gapPenalty;
-#if defined(ALLASSERTS)
-	  assert ( uint((m+lseq2+2) - score) < ((lseq1+1) * (lseq2+1)) );
-#endif
+      std::copy(prev.score + poff, prev.score + poff + s2MatchLen, score + off);
+      std::copy(prev.ix + poff, prev.ix + poff + s2MatchLen, ix + off);
+      std::copy(prev.iy + poff, prev.iy + poff + s2MatchLen, iy + off);
       
-	  *(m+lseq2+2) = std::max(std::max(match, del), ins);
-	  m += 1;
-	}
+      if( uint(s2MatchLen) < lseq2 ) {
+	fillScoreRowAffine(mScores, i, s2MatchLen);
       }
     }
   }
   
-  T* m1m1 = score + s1MatchLen*(lseq2+1);
   for(uint i = s1MatchLen+1; i <= lseq1; ++i) {
-    byte const s1i = s1[i-1];
-    for(const byte* s2j = s2; s2j < s2 + lseq2; ++s2j) {
-      T const match = *m1m1 + mScores.scoreMatching(s1i, *s2j);      
-      T const del = *(m1m1+1) + mScores.gapPenalty;
-      T const ins = *(m1m1+1+lseq2) + mScores.gapPenalty;
-#if defined(ALLASSERTS)
-      assert ( uint((m1m1+lseq2+2) - score) < ((lseq1+1) * (lseq2+1)) );
-#endif
-      
-      *(m1m1+lseq2+2) = std::max(std::max(match, del), ins);
-      m1m1 += 1;
+    fillScoreRowAffine(mScores, i, 0);
+  }
+}
+
+template<typename T>
+inline typename Alignment<T>::AffineState
+Alignment<T>::startState(uint const iRow, uint const jCol, bool const freeEndGaps) const
+{
+  // With free end gaps the path always starts from a match.
+  if( ! freeEndGaps ) {
+    uint const cur = iRow*(lseq2+1) + jCol;
+    if( iy[cur] > score[cur] && iy[cur] >= ix[cur] ) {
+      return inGapS1;
+    }
+    if( ix[cur] > score[cur] ) {
+      return inGapS2;
     }
-    m1m1 += 1;
   }
+  return inMatch;
+}
+
+template<typename T>
+inline typename Alignment<T>::AffineState
+Alignment<T>::traceState(MatchScoreValues<T> const&  scores,
+			 AffineState const           state,
+			 uint const                  cur,
+			 uint const                  iRow,
+			 uint const                  jCol) const
+{
+  // Recompute the exact expressions used in the fill, so equality is exact.
+  switch( state ) {
+    case inMatch: {
+      T const match = scores.scoreMatching(s1[iRow-1], s2[jCol-1]);
+      uint const k = cur - lseq2 - 2;
+      if( score[cur] == match + score[k] ) {
+	return inMatch;
+      }
+      if( score[cur] == match + iy[k] ) {
+	return inGapS1;
+      }
+      assert ( score[cur] == match + ix[k] ) ;
+      return inGapS2;
+    }
+    case inGapS1: {
+      return iy[cur] == score[cur - lseq2 - 1] + scores.gapOpen ? inMatch : inGapS1;
+    }
+    case inGapS2: {
+      return ix[cur] == score[cur - 1] + scores.gapOpen ? inMatch : inGapS2;
+    }
+  }
+  return inMatch;
 }
-#endif
 
 inline void
 fillMatchedGap(const byte* const s, int& i, byte*& al0, byte*& al1)
@@ -693,25 +737,24 @@ Alignment<T>::align(MatchScoreValues<T> const&  scores,
       }
     }
   } else {
+    AffineState state = startState(iRow, jCol, scores.freeEndGaps);
+    
     while( iRow > 0 and jCol > 0 ) {
       uint const cur = iRow*(lseq2+1) + jCol;
-      T const score_current = score[cur];
-      T const match = scores.scoreMatching(s1[iRow-1], s2[jCol-1]);
-    
-      if( score_current ==  match + score[cur - lseq2 - 2] ) {
+      AffineState const step = state;
+      state = traceState(scores, state, cur, iRow, jCol);
+      
+      if( step == inMatch ) {
 	iRow -= 1;
 	jCol -= 1;
 	*al0 = s1[iRow]; 
 	*al1 = s2[jCol];
 	al0 += 1;
 	al1 += 1;
+      } else if( step == inGapS1 ) {
+	fillMatchedGap(s1, iRow, al0, al1);
       } else {
-	if( score_current == match +  iy[cur - lseq2 - 2] ) {
-	  fillMatchedGap(s1, iRow, al0, al1);
-	} else {
-	  assert ( score_current == match + ix[cur - lseq2 - 2] ) ;
-	  fillMatchedGap(s2, jCol, al1, al0);
-	}
+	fillMatchedGap(s2, jCol, al1, al0);
       }
     }
   }
@@ -799,13 +842,14 @@ Alignment<T>::getStats(MatchScoreValues<T> const&  scores,
       }
     }
   } else {
+    AffineState state = startState(iRow, jCol, scores.freeEndGaps);
+    
     while( iRow > 0 and jCol > 0 ) {
       uint const cur = iRow*(lseq2+1) + jCol;
-      T const score_current = score[cur];
-      T const match = scores.scoreMatching(s1[iRow-1], s2[jCol-1]);
-      int const k = cur - lseq2 - 2;
+      AffineState const step = state;
+      state = traceState(scores, state, cur, iRow, jCol);
       
-      if( score_current ==  match + score[k] ) {
+      if( step == inMatch ) {
 	byte const c1 = s1[iRow-1];
 	byte const c2 = s2[jCol-1];
 	
@@ -819,7 +863,7 @@ Alignment<T>::getStats(MatchScoreValues<T> const&  scores,
       } else {
 	gaps += 1;
 	
-	if( score_current == match + iy[k] ) {
+	if( step == inGapS1 ) {
 	  iRow -= 1;
 	} else {
 	  jCol -= 1;
@@ -834,35 +878,95 @@ Alignment<T>::getStats(MatchScoreValues<T> const&  scores,
 }
 
 
-PyObject*
-globAlign(PyObject*, PyObject* args, PyObject* kwds)
+// Number of previous alignments kept for DP table reuse.
+static uint const nCachedAlignments = 4;
+
+static inline uint
+commonPrefix(const byte* const s1, uint const l1, const byte* const s2, uint const l2)
 {
-  static const char* kwlist[] = {"seq0", "seq1", "report" /*, "strip"*/, "scores",
-				 static_cast<const char*>(0)};
-  PyObject* pseq1 = 0;
-  PyObject* pseq2 = 0;
+  uint const mx = std::min(l1, l2);
+  uint k = 0;
+  while( k < mx && s1[k] == s2[k] ) {
+    ++k;
+  }
+  return k;
+}
 
-  ComparisonResult resultType = Default;
-  //PyObject* pStrip = 0;
-  PyObject* mScores = 0;
-  
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|iO", const_cast<char**>(kwlist),
-				    &pseq1,&pseq2,&resultType /*,&pStrip*/,&mScores)) {
-    PyErr_SetString(PyExc_ValueError, "wrong args (1).") ;
-    return 0;
+// A few recently computed alignments. Picks the one sharing the most DP cells
+// with a new pair, for fillScoreTable(mScores, prev). Least recently used
+// ones are dropped.
+
+template<typename T>
+class AlignmentsCache {
+public:
+  AlignmentsCache(uint const _maxSize) :
+    maxSize(_maxSize)
+    {}
+
+  ~AlignmentsCache() {
+    for(auto a : cache) {
+      delete a;
+    }
   }
 
-  if( ! (PySequence_Check(pseq1) && PySequence_Check(pseq2)) ) {
-    PyErr_SetString(PyExc_ValueError, "wrong args: not sequences") ;
+  // Best candidate for reuse when aligning s1 with s2, 0 if none.
+  Alignment<T>*	best(const byte* s1, uint lseq1, const byte* s2, uint lseq2);
+
+  // Takes ownership of al, as most recently used.
+  void		add(Alignment<T>* al);
+  
+private:
+  uint const maxSize;
+  // most recently used first
+  vector<Alignment<T>*> cache;
+};
+
+template<typename T>
+Alignment<T>*
+AlignmentsCache<T>::best(const byte* const  s1,
+			 uint const         lseq1,
+			 const byte* const  s2,
+			 uint const         lseq2)
+{
+  ulong mxCells = 0;
+  uint ibest = 0;
+  for(uint k = 0; k < cache.size(); ++k) {
+    Alignment<T> const& a = *cache[k];
+    uint const p1 = commonPrefix(s1, lseq1, a.s1, a.lseq1);
+    if( p1 > 0 ) {
+      ulong const cells = ulong(p1) * commonPrefix(s2, lseq2, a.s2, a.lseq2);
+      if( cells > mxCells ) {
+	mxCells = cells;
+	ibest = k;
+      }
+    }
+  }
+  if( mxCells == 0 ) {
     return 0;
   }
+  Alignment<T>* const a = cache[ibest];
+  cache.erase(cache.begin() + ibest);
+  cache.insert(cache.begin(), a);
+  return a;
+}
 
-  MatchScoreValues<float> const scores(mScores);
-  if( ! scores.valid() ) {
-    PyErr_SetString(PyExc_ValueError, "wrong args: invalid scores") ;
-    return 0;
+template<typename T>
+void
+AlignmentsCache<T>::add(Alignment<T>* const al)
+{
+  if( cache.size() == maxSize ) {
+    delete cache.back();
+    cache.pop_back();
   }
-  
+  cache.insert(cache.begin(), al);
+}
+
+static PyObject*
+globalAlignment(PyObject*                        pseq1,
+		PyObject*                        pseq2,
+		ComparisonResult const           resultType,
+		MatchScoreValues<float> const&   scores)
+{
   uint lseq1;
   uint lseq2;
   // always strip for alignment
@@ -921,23 +1025,21 @@ globAlign(PyObject*, PyObject* args, PyObject* kwds)
   return ret;
 }
 
-#if 0 
 PyObject*
-globAlignAffine(PyObject*, PyObject* args, PyObject* kwds)
+globAlign(PyObject*, PyObject* args, PyObject* kwds)
 {
-  static const char* kwlist[] = {"seq0", "seq1", "gapExtend", "report", "strip", "scores",
+  static const char* kwlist[] = {"seq0", "seq1", "report" /*, "strip"*/, "scores",
 				 static_cast<const char*>(0)};
   PyObject* pseq1 = 0;
   PyObject* pseq2 = 0;
 
   ComparisonResult resultType = Default;
-  PyObject* pStrip = 0;
+  //PyObject* pStrip = 0;
   PyObject* mScores = 0;
-  float gapExtend = 0;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OOf|iOO", const_cast<char**>(kwlist),
-				    &pseq1,&pseq2,&gapExtend,&resultType,&pStrip,&mScores)) {
-    PyErr_SetString(PyExc_ValueError, "wrong args (2).") ;
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|iO", const_cast<char**>(kwlist),
+				    &pseq1,&pseq2,&resultType /*,&pStrip*/,&mScores)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (1).") ;
     return 0;
   }
 
@@ -951,53 +1053,47 @@ globAlignAffine(PyObject*, PyObject* args, PyObject* kwds)
     PyErr_SetString(PyExc_ValueError, "wrong args: invalid scores") ;
     return 0;
   }
-  
-  uint lseq1;
-  uint lseq2;
-  // always strip for alignment
-  byte* s1 = readSequence(pseq1, lseq1, true);
-  byte* s2 = readSequence(pseq2, lseq2, true);
-  if( ! (s1 && s2 ) ) {
-    return 0;
-  }
 
-  AlignmentAffine<float> al(s1, lseq1, s2, lseq2);
+  return globalAlignment(pseq1, pseq2, resultType, scores);
+}
 
-  uint const ltot = lseq1 + lseq2;
+// Same as globAlign, with the gap extension penalty overriding the one in
+// scores.
 
-  PyObject* ret = 0;
-  
-  if ( 1 ) {
-    byte* const alignment = new byte [2*ltot];
+PyObject*
+globAlignAffine(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char* kwlist[] = {"seq0", "seq1", "gapExtend", "report", "scores",
+				 static_cast<const char*>(0)};
+  PyObject* pseq1 = 0;
+  PyObject* pseq2 = 0;
 
-    uint const alen = al.align(scores, gapExtend, alignment);
-    
-    PyObject* al = PyTuple_New(2);
-    PyObject* ps0 = PyTuple_New(alen);
-    const byte* ps = alignment + alen-1;
-    for(uint i = 0; i < alen; ++i,--ps) {
-      PyTuple_SET_ITEM(ps0, i, PyInt_FromLong(*ps));
-    }
-    PyTuple_SET_ITEM(al, 0, ps0);
+  ComparisonResult resultType = Default;
+  PyObject* mScores = 0;
+  float gapExtend = 0;
   
-    PyObject* ps1 = PyTuple_New(alen);
-    ps = alignment + ltot + alen-1;
-    for(uint i = 0; i < alen; ++i,--ps) {
-      PyTuple_SET_ITEM(ps1, i, PyInt_FromLong(*ps));
-    }
-    PyTuple_SET_ITEM(al, 1, ps1);
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OOf|iO", const_cast<char**>(kwlist),
+				    &pseq1,&pseq2,&gapExtend,&resultType,&mScores)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (2).") ;
+    return 0;
+  }
 
-    delete [] alignment;
+  if( ! (PySequence_Check(pseq1) && PySequence_Check(pseq2)) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not sequences") ;
+    return 0;
+  }
 
-    ret = al;
+  MatchScoreValues<float> const given(mScores);
+  if( ! given.valid() ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: invalid scores") ;
+    return 0;
   }
   
-  delete [] s1;
-  delete [] s2;
-
-  return ret;
+  MatchScoreValues<float> const scores(given.matchScore, given.misMatchScore,
+				       given.gapOpen, &gapExtend, given.freeEndGaps);
+  
+  return globalAlignment(pseq1, pseq2, resultType, scores);
 }
-#endif
 
 #include "seqslist.cc"
 # if 0
@@ -1100,6 +1196,105 @@ readSeqsIn(PyObject* const pseqs, bool const strip)
 }
 #endif
 
+// A C contiguous buffer of float32 or float64 values, such as a numpy array
+// or a numpy memory map. Lets distances pass between python and C++ without
+// creating a python float for each one.
+
+class FloatBuffer {
+public:
+  FloatBuffer(void) :
+    obj(0)
+    {}
+  
+  ~FloatBuffer() {
+    if( obj ) {
+      PyBuffer_Release(&view);
+    }
+  }
+
+  // Acquire the buffer of o. On failure set a python error and return false.
+  bool		acquire(PyObject* o, bool writable);
+  
+  ulong		size(void) const { return view.len / view.itemsize; }
+  bool		isDouble(void) const { return view.itemsize == sizeof(double); }
+  float*	floats(void) const { return static_cast<float*>(view.buf); }
+  double*	doubles(void) const { return static_cast<double*>(view.buf); }
+
+  void set(ulong const k, double const v) {
+    if( isDouble() ) {
+      doubles()[k] = v;
+    } else {
+      floats()[k] = v;
+    }
+  }
+
+  double value(ulong const k) const {
+    return isDouble() ? doubles()[k] : floats()[k];
+  }
+  
+private:
+  PyObject*	obj;
+  Py_buffer	view;
+};
+
+bool
+FloatBuffer::acquire(PyObject* const o, bool const writable)
+{
+  assert( ! obj );
+  
+  int const flags = PyBUF_FORMAT | PyBUF_C_CONTIGUOUS | (writable ? PyBUF_WRITABLE : 0);
+  if( ! PyObject_CheckBuffer(o) || PyObject_GetBuffer(o, &view, flags) != 0 ) {
+    if( ! PyErr_Occurred() ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: not a buffer");
+    }
+    return false;
+  }
+  obj = o;
+
+  // native byte order only
+  const char* f = view.format ? view.format : "B";
+  if( *f == '@' || *f == '=' ) {
+    ++f;
+  }
+#if !defined(WORDS_BIGENDIAN)
+  else if( *f == '<' ) {
+    ++f;
+  }
+#endif
+  
+  if( ! ((strcmp(f, "f") == 0 && view.itemsize == sizeof(float)) ||
+	 (strcmp(f, "d") == 0 && view.itemsize == sizeof(double))) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: expecting a float32 or float64 buffer");
+    return false;
+  }
+  return true;
+}
+
+// Resolve the 'out' and 'dtype' arguments: return (a new reference to) the
+// array to fill, either 'out' itself or a fresh numpy array of 'dtype' with
+// 'shape'. Return 0 if both are missing, or on error (with python error set).
+
+static PyObject*
+outputArray(PyObject* const out, PyObject* const dtype, PyObject* const shape)
+{
+  if( out && out != Py_None ) {
+    Py_INCREF(out);
+    return out;
+  }
+  
+  if( dtype && dtype != Py_None ) {
+    PyObject* const numpy = PyImport_ImportModule("numpy");
+    if( ! numpy ) {
+      return 0;
+    }
+    PyObject* const a = PyObject_CallMethod(numpy, const_cast<char*>("empty"),
+					    const_cast<char*>("(OO)"), shape, dtype);
+    Py_DECREF(numpy);
+    return a;
+  }
+  return 0;
+}
+
 template<typename T>
 PyObject*
 distmat(PyObject*         pseqs,
@@ -1107,7 +1302,9 @@ distmat(PyObject*         pseqs,
 	ComparisonResult  resultType,
 	PyObject*         pReorder,
 	PyObject*         mScores,
-	T*                retSpace)
+	T*                retSpace,
+	uint const        firstRow = 0,
+	PyObject*         progress = 0)
 {
   MatchScoreValues<float> const scores(mScores);
   if( ! scores.valid() ) {
@@ -1126,10 +1323,37 @@ distmat(PyObject*         pseqs,
   uint const nseqs = sq1->nSeqs;
 
   int* order = 0;
-
-  // Allow order to be anything (iterator, say). performance is not an issue here
-  PyObject* rel = 0;
-  if( pReorder ) {
+  // Sequences in processing order, when sorted here (auto reorder)
+  vector<uint> perm;
+  
+  if( pReorder == Py_None ) {
+    pReorder = 0;
+  }
+  
+  if( pReorder == Py_True ) {
+    if( align ) {
+      // Sorted sequences share long prefixes with their neighbours, which
+      // makes prefix reuse of the DP tables effective.
+      perm.resize(nseqs);
+      for(uint n = 0; n < nseqs; ++n) {
+	perm[n] = n;
+      }
+      const byte* const* const sqs = sq1->seqs;
+      const uint* const lens = sq1->seqslen;
+      std::stable_sort(perm.begin(), perm.end(),
+		       [sqs,lens](uint const a, uint const b) {
+			 return std::lexicographical_compare(sqs[a], sqs[a] + lens[a],
+							     sqs[b], sqs[b] + lens[b]);
+		       });
+      order = new int[nseqs];
+      std::copy(perm.begin(), perm.end(), order);
+    }
+    pReorder = 0;
+  }
+  
+  // Allow order to be anything (iterator, say). performance is not an issue here
+  PyObject* rel = 0;
+  if( pReorder ) {
     rel = PySequence_Fast(pReorder, "not a seq");
     if( rel ) {
       pReorder = rel;
@@ -1137,7 +1361,7 @@ distmat(PyObject*         pseqs,
     }
   }
       
-  if( order ) {
+  if( order && pReorder ) {
     uint const sz = PySequence_Size(pReorder);
     if( sz != nseqs ) {
       delete [] order;
@@ -1158,24 +1382,40 @@ distmat(PyObject*         pseqs,
     }
   }
 
-  uint const nResults = (nseqs * (nseqs-1)) / 2;
+  ulong const nResults = (ulong(nseqs) * (nseqs-1)) / 2;
   PyObject* res = !retSpace ? PyTuple_New(nResults) : 0;
-  int nr = 0;
+  ulong nr = 0;
  
   int matches, misMatches, gaps;
 
-  Alignment<float>* prev = 0;
+  AlignmentsCache<float> cache(nCachedAlignments);
+
+  // Resume: rows before firstRow (in processing order) already filled.
+  // Without reordering, rows are consecutive in the output.
+  if( retSpace && ! order ) {
+    retSpace += (ulong(firstRow) * (2*nseqs - 1 - firstRow))/2;
+  }
   
-  for(uint j = 0; j < nseqs-1; ++j) {
+  for(uint j = firstRow; j < nseqs-1; ++j) {
+    uint const sj = perm.empty() ? j : perm[j];
     for(uint i = j+1; i < nseqs; ++i) {
+      uint const si = perm.empty() ? i : perm[i];
       if( align ) {
 	if( order ) {
+	  // Ties make alignment asymmetric. When sorted here, keep the roles the
+	  // pair has without reordering, so that results are the same.
+	  uint const r1 = perm.empty() ? si : std::max(si, sj);
+	  uint const r2 = perm.empty() ? sj : std::min(si, sj);
+	  const byte* const s1 = sq1->seqs[r1];
+	  const byte* const s2 = sq1->seqs[r2];
+	  uint const l1 = sq1->seqslen[r1];
+	  uint const l2 = sq1->seqslen[r2];
+	  
 	  Alignment<float>* al =
-	    new Alignment<float>(sq1->seqs[i], sq1->seqslen[i],
-				 sq1->seqs[j], sq1->seqslen[j], prev);
+	    new Alignment<float>(s1, l1, s2, l2, cache.best(s1, l1, s2, l2));
 	
 	  al->getStats(scores, matches, misMatches, gaps);
-	  delete prev; prev = al;
+	  cache.add(al);
 	} else {
 	  Alignment<float> al(sq1->seqs[i], sq1->seqslen[i],
 			      sq1->seqs[j], sq1->seqslen[j]);
@@ -1218,10 +1458,10 @@ distmat(PyObject*         pseqs,
 	int const o1 = order[i];
 	int const o2 = order[j];
 	
-	int const mij = std::min(o1,o2);
-	int const xij = std::max(o1,o2);
-	uint const pos = mij*(2*nseqs - 1 - mij)/2 + (xij-mij-1);
-	assert( 0 <= pos && pos < nResults );
+	ulong const mij = std::min(o1,o2);
+	ulong const xij = std::max(o1,o2);
+	ulong const pos = mij*(2*nseqs - 1 - mij)/2 + (xij-mij-1);
+	assert( pos < nResults );
 	
 	if( retSpace ) {
 	  retSpace[pos] = dis;
@@ -1238,8 +1478,24 @@ distmat(PyObject*         pseqs,
 	}
       }
     }
+
+    // Report rows done, giving the caller a chance to checkpoint the output.
+    // A false return (or an exception) stops.
+    if( progress ) {
+      PyObject* const r = PyObject_CallFunction(progress, const_cast<char*>("I"), j+1);
+      int const goOn = r ? PyObject_IsTrue(r) : 0;
+      Py_XDECREF(r);
+      if( goOn <= 0 ) {
+	if( ! PyErr_Occurred() ) {
+	  PyErr_SetString(PyExc_RuntimeError, "stopped by progress");
+	}
+	Py_XDECREF(res);
+	res = 0;
+	retSpace = 0;
+	break;
+      }
+    }
   }
-  delete prev;
 
   delete [] order;
   Py_XDECREF(rel);
@@ -1251,15 +1507,21 @@ PyObject*
 distMat(PyObject*, PyObject* args, PyObject* kwds)
 {
   static const char *kwlist[] = {"seqs", "align", "report", "reorder", "scores",
+				 "out", "dtype", "start", "progress",
 				 static_cast<const char*>(0)};
   PyObject* pseqs = 0;
   PyObject* palign = 0;
   PyObject* mScores = 0;
   ComparisonResult resultType = DIVERGENCE;
   PyObject* pReorder = 0;
+  PyObject* pOut = 0;
+  PyObject* pDtype = 0;
+  uint firstRow = 0;
+  PyObject* progress = 0;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|OiOO", const_cast<char**>(kwlist),
-				    &pseqs, &palign, &resultType, &pReorder,&mScores)) {
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|OiOOOOIO", const_cast<char**>(kwlist),
+				    &pseqs, &palign, &resultType, &pReorder,&mScores,
+				    &pOut, &pDtype, &firstRow, &progress)) {
     PyErr_SetString(PyExc_ValueError, "wrong args (3).") ;
     return 0;
   }
@@ -1274,9 +1536,57 @@ distMat(PyObject*, PyObject* args, PyObject* kwds)
     return 0;
   }
     
-  PyObject* res = distmat(pseqs, palign, resultType, pReorder, mScores,
-			  static_cast<float*>(0));
-  return res;
+  ulong const n = PySequence_Size(pseqs);
+  ulong const nResults = (n * (n - (n > 0))) / 2;
+  
+  PyObject* shape = Py_BuildValue("(k)", nResults);
+  PyObject* const out = outputArray(pOut, pDtype, shape);
+  Py_DECREF(shape);
+  
+  if( progress == Py_None ) {
+    progress = 0;
+  }
+  if( progress && ! PyCallable_Check(progress) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: progress not callable");
+    Py_XDECREF(out);
+    return 0;
+  }
+  
+  if( ! out ) {
+    if( PyErr_Occurred() ) {
+      return 0;
+    }
+    if( firstRow > 0 ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: resuming (start) requires 'out'");
+      return 0;
+    }
+    PyObject* res = distmat(pseqs, palign, resultType, pReorder, mScores,
+			    static_cast<float*>(0), 0, progress);
+    return res;
+  }
+
+  PyObject* res = 0;
+  {
+    FloatBuffer buf;
+    if( buf.acquire(out, true) ) {
+      if( buf.size() != nResults ) {
+	PyErr_Format(PyExc_ValueError, "wrong args: output size %lu, expecting %lu",
+		     buf.size(), nResults);
+      } else {
+	res = buf.isDouble() ?
+	  distmat(pseqs, palign, resultType, pReorder, mScores, buf.doubles(),
+		  firstRow, progress) :
+	  distmat(pseqs, palign, resultType, pReorder, mScores, buf.floats(),
+		  firstRow, progress);
+      }
+    }
+  }
+  
+  if( ! res ) {
+    Py_DECREF(out);
+    return 0;
+  }
+  return out;
 }
 
 
@@ -1284,6 +1594,7 @@ PyObject*
 distPairs(PyObject*, PyObject* args, PyObject* kwds)
 {
   static const char *kwlist[] = {"seqs1", "seqs2", "align", "report", "order","scores",
+				 "out", "dtype",
 				 static_cast<const char*>(0)};
   PyObject* pseqs1 = 0;
   PyObject* pseqs2 = 0;
@@ -1291,10 +1602,12 @@ distPairs(PyObject*, PyObject* args, PyObject* kwds)
   ComparisonResult resultType = DIVERGENCE;
   PyObject* mScores = 0;
   PyObject* order = 0;
+  PyObject* pOut = 0;
+  PyObject* pDtype = 0;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|OiOO", const_cast<char**>(kwlist),
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|OiOOOO", const_cast<char**>(kwlist),
 				    &pseqs1, &pseqs2, &palign, &resultType,
-				    &order,&mScores)) {
+				    &order,&mScores,&pOut,&pDtype)) {
     PyErr_SetString(PyExc_ValueError, "wrong args (4).") ;
     return 0;
   }
@@ -1360,16 +1673,38 @@ distPairs(PyObject*, PyObject* args, PyObject* kwds)
   }
   
   bool const returnFlat = isSequence(pseqs1);
+
+  // With 'out' or 'dtype' results go to an array of len(seqs1) rows, or to a
+  // single row if seqs1 is one sequence.
+  ulong const n2 = sq2->nSeqs;
+  PyObject* shape = returnFlat ? Py_BuildValue("(k)", n2) :
+    Py_BuildValue("(kk)", ulong(sq1->nSeqs), n2);
+  PyObject* const out = outputArray(pOut, pDtype, shape);
+  Py_DECREF(shape);
+  
+  FloatBuffer buf;
+  if( out ) {
+    if( ! buf.acquire(out, true) ||
+	buf.size() != (returnFlat ? 1 : sq1->nSeqs) * n2 ) {
+      if( ! PyErr_Occurred() ) {
+	PyErr_SetString(PyExc_ValueError, "wrong args: output size") ;
+      }
+      Py_DECREF(out);
+      return 0;
+    }
+  } else if( PyErr_Occurred() ) {
+    return 0;
+  }
   
-  PyObject* res = PyTuple_New( returnFlat ? sq2->nSeqs : sq1->nSeqs );
+  PyObject* res = out ? out : PyTuple_New( returnFlat ? sq2->nSeqs : sq1->nSeqs );
 
-  Alignment<float>* prev = 0;
+  AlignmentsCache<float> cache(nCachedAlignments);
   
   int matches, misMatches, gaps;
   for(uint j = 0; j < sq1->nSeqs; ++j) {
     uint const rj = orders[0] ? orders[0][j] : j;
     
-    PyObject* resj = returnFlat ?  0 : PyTuple_New( sq2->nSeqs );
+    PyObject* resj = (returnFlat || out) ?  0 : PyTuple_New( sq2->nSeqs );
     if( resj ) {
       PyTuple_SET_ITEM(res, rj, resj);
     }
@@ -1377,11 +1712,13 @@ distPairs(PyObject*, PyObject* args, PyObject* kwds)
     for(uint i = 0; i < sq2->nSeqs; ++i) {
       uint const ri = orders[1] ? orders[1][i] : i;
       if( align ) {
+	const byte* const s1 = sq2->seqs[ri];
+	const byte* const s2 = sq1->seqs[rj];
 	Alignment<float>* al =
-	  new Alignment<float> (sq2->seqs[ri], sq2->seqslen[ri],
-				 sq1->seqs[rj], sq1->seqslen[rj], prev);
+	  new Alignment<float> (s1, sq2->seqslen[ri], s2, sq1->seqslen[rj],
+				cache.best(s1, sq2->seqslen[ri], s2, sq1->seqslen[rj]));
 	al->getStats(scores, matches, misMatches, gaps);
-	delete prev; prev = al;
+	cache.add(al);
       } else {
 	assert(ri == i && rj == j);
 	
@@ -1415,11 +1752,14 @@ distPairs(PyObject*, PyObject* args, PyObject* kwds)
       }
 
       double const dis = stats2distance(matches, misMatches, gaps, resultType);
-      PyTuple_SET_ITEM(returnFlat ? res : resj, ri, PyFloat_FromDouble(dis));
+      if( out ) {
+	buf.set(returnFlat ? ri : rj * n2 + ri, dis);
+      } else {
+	PyTuple_SET_ITEM(returnFlat ? res : resj, ri, PyFloat_FromDouble(dis));
+      }
     }
   }
 
-  delete prev;
   for(int i = 0; i < 2; ++i) {
     delete [] orders[i];
   }
@@ -1462,7 +1802,7 @@ template<typename T>
 static int
 alignToProf(byte*        inseq,
 	    uint const 	 seqLen,
-	    int**        profile,
+	    const int* const* profile,
 	    uint const   ns,
 	    T const  matchScore,
 	    T const  misMatchScore,
@@ -1591,38 +1931,190 @@ alignToProf(byte*        inseq,
   return pos;
 }
 
-bool
-readProfile(PyObject*   pProfile,
-	    uint const  nProfile,
-	    int*        storage,
-	    int**       profile,
-	    uint        pad = 0)
+// Affine gaps version of alignToProf. A run of gaps in the sequence opens
+// with 'gapOpen' and extends with 'gapExtend', each times the number of
+// non-gaps in the profile column. Result reversed.
+
+template<typename T>
+static int
+alignToProfAffine(byte*        inseq,
+		  uint const   seqLen,
+		  const int* const* profile,
+		  uint const   ns,
+		  T const      matchScore,
+		  T const      misMatchScore,
+		  T const      gapOpen,
+		  T const      gapExtend)
+{
+  uint nNucs = 0;
+  byte seq[ns];
+  for(uint k = 0; k < seqLen; ++k) {
+    if( inseq[k] != gap ) {
+      seq[nNucs] = inseq[k];
+      nNucs += 1;
+    }
+  }
+
+  if( nNucs > ns ) {
+    return -1;
+  }
+  
+  uint const sz = (nNucs+1) * (ns+1);
+  // score: site ni holds sequence nucleotide nk. gscore: site ni is a gap.
+  T* const rawscr = new T[2*sz + (ns+1)*7];
+  T** const score = new T* [2*(ns+1)];
+  T** const gscore = score + (ns+1);
+  
+  for(uint i = 0; i <= ns; ++i) {
+    score[i] = rawscr + i * (nNucs+1);
+    gscore[i] = rawscr + sz + i * (nNucs+1);
+  }
+
+  T const lowest = std::numeric_limits<T>::lowest();
+  std::fill(rawscr, rawscr+2*sz, lowest);
+  
+  uint tot = 0;
+  for(uint i = 0; i < 6; ++i) {
+    tot += profile[0][i];
+  }
+
+  T* const gapOpenScores = rawscr + 2*sz;
+  T* const gapExtendScores = gapOpenScores + ns+1;
+  
+  T* siteScores[5];
+  siteScores[0] = gapExtendScores + ns+1;
+  for(uint i = 1; i < 5; ++i) {
+    siteScores[i] = siteScores[i-1] + ns + 1;
+  }
+  
+  for(uint ni = 1; ni <= ns; ++ni) {
+    for(uint i = 0; i < 5; ++i) {
+      siteScores[i][ni] = scoreSite(ni, i, profile, tot, matchScore, misMatchScore, gapOpen);
+    }
+    gapOpenScores[ni] = scoreSiteGap(ni, profile, tot, gapOpen);
+    gapExtendScores[ni] = scoreSiteGap(ni, profile, tot, gapExtend);
+  }
+
+  // leading gaps are free
+  for(uint ni = 0; ni <= ns; ++ni) {
+    score[ni][0] = 0;
+  }
+
+  for(uint nk = 1; nk <= nNucs; ++nk) {
+    const T* const ssnk = siteScores[seq[nk-1]];
+    score[nk][nk] = std::max(score[nk-1][nk-1], gscore[nk-1][nk-1]) + ssnk[nk];
+    
+    for(uint ni = nk+1; ni <= nk + ns - nNucs; ++ni) {
+      score[ni][nk] = std::max(score[ni-1][nk-1], gscore[ni-1][nk-1]) + ssnk[ni];
+      gscore[ni][nk] = std::max(score[ni-1][nk] + gapOpenScores[ni],
+				gscore[ni-1][nk] + gapExtendScores[ni]);
+    }
+  }
+
+  // trailing gaps are free as well
+  uint j = nNucs;
+  for(uint ni = nNucs+1; ni <= ns; ++ni) {
+    if( score[ni][nNucs] > score[j][nNucs] ) {
+      j = ni;
+    }
+  }
+  
+  uint pos = 0;
+  for(/**/; pos < ns - j; ++pos) {
+    inseq[pos] = gap;
+  }
+	
+  uint i = nNucs;
+  bool inGap = false;
+  while( j > i ) {
+    if( inGap ) {
+      inGap = gscore[j][i] != score[j-1][i] + gapOpenScores[j];
+      inseq[pos] = gap;
+      j -= 1;
+    } else if( i > 0 ) {
+      inGap = score[j][i] != score[j-1][i-1] + siteScores[seq[i-1]][j];
+      inseq[pos] = seq[i-1];
+      i -= 1;
+      j -= 1;
+    } else {
+      inseq[pos] = gap;
+      j -= 1;
+    }
+    ++pos;
+  }
+  assert( ! inGap );
+  
+  while( i > 0 ) {
+    inseq[pos++] = seq[i-1];
+    i -= 1;
+  }
+  assert( pos <= ns );
+
+  delete [] rawscr;
+  delete [] score;
+  
+  return pos;
+}
+
+static bool
+readProfile(PyObject*     pProfile,
+	    uint const    nProfile,
+	    vector<int>&  storage,
+	    const int**   profile)
 {
+  PyObject* const p = PySequence_Fast(pProfile, "wrong args: bad profile");
+  if( ! p ) {
+    return false;
+  }
+  
+  storage.resize(6*nProfile);
+  
   for(uint n = 0; n < nProfile; ++n) {
-    PyObject* pn = PySequence_Fast_GET_ITEM(pProfile, n);
+    PyObject* pn = PySequence_Fast_GET_ITEM(p, n);
     if( ! (PySequence_Check(pn) && PySequence_Size(pn) == 6) ) {
-      // Leak
+      Py_DECREF(p);
       PyErr_SetString(PyExc_ValueError, "wrong args: bad profile") ;
       return false;
     }
-    profile[n+pad] = storage + 6*(n+pad);
+    int* const c = &storage[6*n];
     for(uint i = 0; i < 6; ++i) {
-      long const v = PyInt_AsLong(PySequence_Fast_GET_ITEM(pn, i));
-      if( v == -1 ) {
-	// Leak
+      PyObject* const o = PySequence_GetItem(pn, i);
+      long const v = o ? PyInt_AsLong(o) : -1;
+      Py_XDECREF(o);
+      if( v < 0 ) {
+	Py_DECREF(p);
 	PyErr_SetString(PyExc_ValueError, "wrong args: bad profile");
 	return false;
       }
-      profile[n+pad][i] = v;
+      c[i] = v;
     }
   }
+  Py_DECREF(p);
+  
+  // storage does not move from now on
+  for(uint n = 0; n < nProfile; ++n) {
+    profile[n] = &storage[6*n];
+  }
   return true;
 }
 
+// Origin of a column in a profile to profile alignment
+enum ColumnOrigin { fromBoth = 0, fromFirst = 1, fromSecond = 2 };
+
+// Record origin of column when tracing (trace not null)
+static inline void
+traceColumn(byte*& trace, ColumnOrigin const origin)
+{
+  if( trace ) {
+    *trace++ = origin;
+  }
+}
+
 // Copies profile cell p[i-1] to al, adds n gaps, decrementing i and
 // incrementing al.
 inline void
-profileFillMatchedGap(const int* const* p, int& i, int*& al, int const n)
+profileFillMatchedGap(const int* const* p, int& i, int*& al, int const n,
+		      byte*& trace, ColumnOrigin const origin)
 {
   i -= 1;
   const int* pr = p[i];
@@ -1630,6 +2122,133 @@ profileFillMatchedGap(const int* const* p, int& i, int*& al, int const n)
     *al++ = *pr++;
   }
   al[-1] += n;  // assumes gap is last
+  traceColumn(trace, origin);
+}
+
+// Counts of matches/mismatches/gaps between each nucleotide type and the
+// n1 sequences of profile column p1i. Makes scoring of a column pair O(6).
+
+static inline void
+columnTypeCounts(const int* const p1i, int const n1, ProfileCounts* const countPerType)
+{
+  int const an = p1i[anynuc];
+  int const gp  = p1i[gap];
+  int const nonGap = n1 - gp;
+  int const nc = nonGap - an;    assert (  nc == p1i[0]+p1i[1]+p1i[2]+p1i[3] );
+      
+  for(int k = 0; k < 4; ++k) {
+    auto& ck = countPerType[k];
+    ck.matches = p1i[k] + an;
+    ck.mis = nc - p1i[k];
+    ck.gaps = gp;
+  }
+      
+  auto& anc = countPerType[anynuc];
+  anc.matches = nonGap;
+  anc.mis = 0;
+  anc.gaps = gp;
+
+  auto& cgp = countPerType[gap];
+  cgp.matches = cgp.mis = 0;
+  cgp.gaps = nonGap;
+}
+
+// Scores of matching columns of two profiles. The score of column i of the
+// first profile against column j of the second is linear in the counts of
+// column j,
+//   base1[i] + base2[j] + sum_k w[i][k] * counts_j[k],
+// where w[i][k] scores one sequence of type k against column i. The vectors
+// are computed once per column. The second profile counts are stored per
+// type (6 arrays of lp2), so a full DP row of match scores is a few
+// multiply-adds over contiguous arrays, which the compiler vectorizes.
+
+template<typename T>
+class ColumnPairScores {
+public:
+  ColumnPairScores(MatchScoreValues<T> const&  scores,
+		   const int* const*           p1,
+		   uint const                  lp1,
+		   uint const                  n1,
+		   const ProfileCounts* const  rowCounts,
+		   const int* const*           p2,
+		   uint const                  lp2,
+		   const ProfileCounts* const  colCounts);
+
+  // match scores of row (column of first profile) i against all of the second
+  void row(uint const i, T* const sm) const;
+  
+  T operator()(uint const i, uint const j) const {
+    const T* const w = &weights[6*i];
+    T s = base1[i] + base2[j];
+    for(uint k = 0; k < 6; ++k) {
+      s += w[k] * counts2[k*lp2 + j];
+    }
+    return s;
+  }
+  
+private:
+  uint const	lp2;
+  vector<T>	weights;
+  vector<T>	base1;
+  vector<T>	base2;
+  vector<T>	counts2;
+};
+
+template<typename T>
+ColumnPairScores<T>::ColumnPairScores(MatchScoreValues<T> const&  scores,
+				      const int* const*           p1,
+				      uint const                  lp1,
+				      uint const                  n1,
+				      const ProfileCounts* const  rowCounts,
+				      const int* const*           p2,
+				      uint const                  _lp2,
+				      const ProfileCounts* const  colCounts) :
+  lp2(_lp2),
+  weights(6*lp1),
+  base1(lp1),
+  base2(lp2),
+  counts2(6*lp2)
+{
+  // gaps across profiles count as a match. maybe they need another match score?
+  auto const base = [&scores](ProfileCounts const& c) -> T {
+    return scores.matchScore * c.matches + scores.misMatchScore * c.mis
+      + scores.gapPenalty * c.gaps;
+  };
+  
+  for(uint i = 0; i < lp1; ++i) {
+    ProfileCounts perType[6];
+    columnTypeCounts(p1[i], n1, perType);
+    for(uint k = 0; k < 6; ++k) {
+      weights[6*i + k] = scores.matchScore * (perType[k].matches + perType[k].gaps)
+	+ scores.misMatchScore * perType[k].mis;
+    }
+    base1[i] = base(rowCounts[i]);
+  }
+  
+  for(uint j = 0; j < lp2; ++j) {
+    base2[j] = base(colCounts[j]);
+    for(uint k = 0; k < 6; ++k) {
+      counts2[k*lp2 + j] = p2[j][k];
+    }
+  }
+}
+
+template<typename T>
+void
+ColumnPairScores<T>::row(uint const i, T* const sm) const
+{
+  const T* const w = &weights[6*i];
+  T const b = base1[i];
+  for(uint j = 0; j < lp2; ++j) {
+    sm[j] = b + base2[j];
+  }
+  for(uint k = 0; k < 6; ++k) {
+    T const wk = w[k];
+    const T* const c = &counts2[k*lp2];
+    for(uint j = 0; j < lp2; ++j) {
+      sm[j] += wk * c[j];
+    }
+  }
 }
 
 template<typename T>
@@ -1639,7 +2258,8 @@ alignProfToProf(const int* const*          p1,
 		const int* const*          p2,
 		uint const                 lp2,
 		MatchScoreValues<T> const  matchScores,
-		int* const                 alignment)
+		int* const                 alignment,
+		byte*                      trace)
 {
   int* al0 = alignment;
   
@@ -1658,36 +2278,14 @@ alignProfToProf(const int* const*          p1,
     colProfCount[j] = ProfileCounts(p2[j]);
   }
 
-  ProfileCounts countPerType[lp1][6];
-  ProfileCounts rowProfCount[lp1];
-  
+  vector<ProfileCounts> rowProfCount(lp1);
   for(uint i = 0; i < lp1; i += 1) {
-    const int* p1i = p1[i];
-    rowProfCount[i] = ProfileCounts(p1i);
-
-    {
-      int const an = p1i[anynuc];
-      int const gp  = p1i[gap];
-      int const nonGap = n1 - gp;
-      int const nc = nonGap - an;    assert (  nc == p1i[0]+p1i[1]+p1i[2]+p1i[3] );
-      
-      for(int k = 0; k < 4; ++k) {
-	auto& ck = countPerType[i][k];
-	ck.matches = p1i[k] + an;
-	ck.mis = nc - p1i[k];
-	ck.gaps = gp;
-      }
-      
-      auto& anc = countPerType[i][anynuc];
-      anc.matches = nonGap;
-      anc.mis = 0;
-      anc.gaps = gp;
-
-      auto& cgp = countPerType[i][gap];
-      cgp.matches = cgp.mis = 0;
-      cgp.gaps = nonGap;
-    }
+    rowProfCount[i] = ProfileCounts(p1[i]);
   }
+  
+  ColumnPairScores<T> const pairScores(matchScores, p1, lp1, n1, &rowProfCount[0],
+				       p2, lp2, colProfCount);
+  vector<T> rowScores(lp2);
 
   T* const colGapScore = new T [lp2+lp1];    std::unique_ptr<T> rel0(colGapScore);
   T* const rowGapScore = colGapScore + lp2;
@@ -1723,9 +2321,10 @@ alignProfToProf(const int* const*          p1,
 #if defined(ALLASSERTS)
     //                                          assert(rowGapScore[i-1] == matchScores.scoreGap(p1i, n2, n1));
 #endif
+    pairScores.row(i-1, &rowScores[0]);
     for(uint j = 0; j < lp2; j += 1) {
 
-      T const sm = matchScores.scoreMatching(p2[j], rowProfCount[i-1], colProfCount[j], countPerType[i-1]);
+      T const sm = rowScores[j];
 #if defined(ALLASSERTS)
       T const sm1 = matchScores.scoreMatching(p1[i-1], n1, p2[j], n2); assert( sm == sm1 );
 #endif
@@ -1768,12 +2367,12 @@ alignProfToProf(const int* const*          p1,
     if( mxLastCol > mxLastRow ) {
       int const im = (iMaxCol - lp2)/(lp2+1);
       while( iRow > im ) {
-	profileFillMatchedGap(p1, iRow, al0, n2);
+	profileFillMatchedGap(p1, iRow, al0, n2, trace, fromFirst);
       }
     } else {
       int const jm = iMaxRow - (sz-lp2-1);
       while( jCol > jm ) {
-	profileFillMatchedGap(p2, jCol, al0, n1);
+	profileFillMatchedGap(p2, jCol, al0, n1, trace, fromSecond);
       }
     }
   }
@@ -1783,8 +2382,7 @@ alignProfToProf(const int* const*          p1,
     T const score_current = score[cur];
     T const score_diagonal = score[cur - lp2 - 2];
 
-    T const sm = matchScores.scoreMatching(p2[jCol-1], rowProfCount[iRow-1],
-					   colProfCount[jCol-1], countPerType[iRow-1]);
+    T const sm = pairScores(iRow-1, jCol-1);
 #if defined(ALLASSERTS)
     T const sm1 = matchScores.scoreMatching(p1[iRow-1], n1, p2[jCol-1], n2);
     assert ( sm == sm1 );
@@ -1799,28 +2397,29 @@ alignProfToProf(const int* const*          p1,
       iRow -= 1;
       jCol -= 1;
       al0 += 6;
+      traceColumn(trace, fromBoth);
     } else {
       T const score_up = score[cur - lp2 - 1];
 
       if( score_current == score_up + rowGapScore[iRow-1] ) {
-	profileFillMatchedGap(p1, iRow, al0, n2);
+	profileFillMatchedGap(p1, iRow, al0, n2, trace, fromFirst);
       } else {
 #if !defined(NDEBUG)
 	T const score_left = score[cur - 1];
 #endif
 	assert ( score_current == score_left + colGapScore[jCol-1] ) ;
 
-	profileFillMatchedGap(p2, jCol, al0, n1);
+	profileFillMatchedGap(p2, jCol, al0, n1, trace, fromSecond);
       }
     }
   }
   
   while( iRow > 0 ) {
-    profileFillMatchedGap(p1, iRow, al0, n2);
+    profileFillMatchedGap(p1, iRow, al0, n2, trace, fromFirst);
   }
   
   while( jCol > 0 ) {
-    profileFillMatchedGap(p2, jCol, al0, n1);
+    profileFillMatchedGap(p2, jCol, al0, n1, trace, fromSecond);
   }
 
   delete [] score;
@@ -1828,245 +2427,1672 @@ alignProfToProf(const int* const*          p1,
   return (al0 - alignment)/6;
 }
 
-PyObject*
-alignToProfile(PyObject*, PyObject* args, PyObject* kwds)
+// Affine gaps version of alignProfToProf. A run of gap columns inserted into
+// one profile pays the gap open penalty for the new gaps of the first column
+// and the extension penalty for the rest. Result reversed.
+
+template<typename T>
+uint
+alignProfToProfAffine(const int* const*          p1,
+		      uint const                 lp1,
+		      const int* const*          p2,
+		      uint const                 lp2,
+		      MatchScoreValues<T> const  matchScores,
+		      int* const                 alignment,
+		      byte*                      trace)
 {
-  static const char *kwlist[] = {"seq", "profile", "pad", "chop",
-				 "matchScore", "misMatchScore", "gapPenalty",
-				 static_cast<const char*>(0)};
-  PyObject* pSeq = 0;
-  PyObject* pPfofile = 0;
-  float matchScore = 10;
-  float misMatchScore = -5;
-  float gapPenalty = -6;
-  int	pad = 0;
-  PyObject* pChop = 0;
+  int* al0 = alignment;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|iOfff", const_cast<char**>(kwlist),
-				    &pSeq, &pPfofile,&pad,&pChop,
-				    &matchScore, &misMatchScore, &gapPenalty)) {
-    PyErr_SetString(PyExc_ValueError, "wrong args (5).") ;
-    return 0;
+  uint const sz = (lp1+1)*(lp2+1);
+  // score: last columns matched, iy: p1 column against gaps, ix: p2 column
+  // against gaps.
+  T* const score = new T [3*sz];   std::unique_ptr<T[]> rel(score);
+  T* const ix = score + sz;
+  T* const iy = ix + sz;
+  std::fill(score, score+3*sz, std::numeric_limits<T>::lowest());
+  score[0] = 0;
+  
+  int n1 = 0, n2 = 0;
+  for(int i = 0; i < 6; ++i) {
+    n1 += p1[0][i];
+    n2 += p2[0][i];
   }
 
-  uint seqLen;
-  byte* seq = readSequence(pSeq, seqLen, false);
-  if( ! seq ) {
-    return 0;
+  ProfileCounts colProfCount[lp2];
+  for(uint j = 0; j < lp2; j += 1) {
+    colProfCount[j] = ProfileCounts(p2[j]);
   }
 
-  if( ! PySequence_Check(pPfofile) || pad < 0 ) {
-    PyErr_SetString(PyExc_ValueError, "wrong args: bad profile/pad") ;
-    return 0;
+  vector<ProfileCounts> rowProfCount(lp1);
+  for(uint i = 0; i < lp1; i += 1) {
+    rowProfCount[i] = ProfileCounts(p1[i]);
   }
-
-  int const nProfile = PySequence_Size(pPfofile);
-  uint const nSites = nProfile + 2 * pad;
   
-  int*  const allp(new int [6*nSites]);      std::unique_ptr<int> rel(allp);
-  int** const profile(new int* [nSites]);    std::unique_ptr<int*> rel2(profile);
-
-  if( ! readProfile(pPfofile, nProfile, allp, profile, pad) ) {
-    return 0;
-  }
-
-  int nSeqs = 0;
-  for(uint i = 0; i < 6; ++i) {
-    nSeqs += profile[pad][i];
-  }
+  ColumnPairScores<T> const pairScores(matchScores, p1, lp1, n1, &rowProfCount[0],
+				       p2, lp2, colProfCount);
+  vector<T> rowScores(lp2);
+
+  T* const colGapScore = new T [2*(lp2+lp1)];    std::unique_ptr<T[]> rel0(colGapScore);
+  T* const colGapExtScore = colGapScore + lp2;
+  T* const rowGapScore = colGapExtScore + lp2;
+  T* const rowGapExtScore = rowGapScore + lp1;
   
-  for(int n = 0; n < pad; ++n) {
-    profile[n] = allp + 6*n;
-    int const n1 = pad + nProfile + n;
-    profile[n1] = allp + 6*n1;
-    for(uint i = 0; i < gap; ++i) {
-      profile[n][i] = profile[n1][i] = 0;
+  {
+    T* s = score + 1;
+    for(uint jCol = 1; jCol <= lp2; ++jCol, ++s) {
+      colGapScore[jCol-1] = matchScores.scoreGap(colProfCount[jCol-1], n1, n2);
+      colGapExtScore[jCol-1] = matchScores.scoreGapExtend(colProfCount[jCol-1], n1, n2);
+      *s = ix[jCol] = jCol == 1 ? colGapScore[0] : *(s-1) + colGapExtScore[jCol-1];
     }
-    profile[n][gap] = profile[n1][gap] = nSeqs;
   }
-    
-  if( seqLen < nSites ) {
-    byte* s = new byte[nSites];
-    for(uint k = 0; k < seqLen; ++k) {
-      s[k] = seq[k];
+  
+  {
+    T* s = score + (lp2+1);
+    for(uint iRow = 1; iRow <= lp1; ++iRow, s += lp2+1) {
+      rowGapScore[iRow-1] = matchScores.scoreGap(rowProfCount[iRow-1], n2, n1);
+      rowGapExtScore[iRow-1] = matchScores.scoreGapExtend(rowProfCount[iRow-1], n2, n1);
+      *s = iy[s - score] = iRow == 1 ? rowGapScore[0] : *(s-(lp2+1)) + rowGapExtScore[iRow-1];
     }
-    delete seq;
-    seq = s;
   }
-  
-  int const newLen = alignToProf<float>(seq, seqLen, profile, nSites,
-					matchScore, misMatchScore, gapPenalty);
-  
-  PyObject* retSeq = 0;
 
-  bool const chop = (pad > 0 && pChop != 0 && PyObject_IsTrue(pChop));
+  for(uint i = 1; i <= lp1; ++i) {
+    T const gs = rowGapScore[i-1];
+    T const gse = rowGapExtScore[i-1];
+
+    pairScores.row(i-1, &rowScores[0]);
+    for(uint j = 1; j <= lp2; ++j) {
+      uint const cur = i*(lp2+1) + j;
+      uint const k = cur - lp2 - 2;
+      
+      T const sm = rowScores[j-1];
+      
+      iy[cur] = std::max(score[cur - lp2 - 1] + gs, iy[cur - lp2 - 1] + gse);
+      ix[cur] = std::max(score[cur - 1] + colGapScore[j-1], ix[cur - 1] + colGapExtScore[j-1]);
+      score[cur] = sm + std::max(std::max(score[k], ix[k]), iy[k]);
+    }
+  }
   
-  if( newLen < 0 ) {
-    PyErr_SetString(PyExc_ValueError, "short profile.");
+  int iRow = lp1;
+  int jCol = lp2;
+
+  // 0: match, 1: p1 column against gaps (iy), 2: p2 column against gaps (ix)
+  int state = 0;
+  
+  if( matchScores.freeEndGaps ) {
+    uint iMaxRow = sz-lp2-1;
+    T mxLastRow = score[iMaxRow];
+    for(uint l = iMaxRow+1; l < sz; ++l) {
+      if( score[l] >= mxLastRow ) {
+	mxLastRow = score[l];
+	iMaxRow = l;
+      }
+    }
+
+    uint iMaxCol = lp2;
+    T mxLastCol = score[iMaxCol];
+    for(uint l = iMaxCol+lp2+1; l < sz; l += lp2+1) {
+      if( score[l] >= mxLastCol ) {
+	mxLastCol = score[l];
+	iMaxCol = l;
+      }
+    }
+
+    if( mxLastCol > mxLastRow ) {
+      int const im = (iMaxCol - lp2)/(lp2+1);
+      while( iRow > im ) {
+	profileFillMatchedGap(p1, iRow, al0, n2, trace, fromFirst);
+      }
+    } else {
+      int const jm = iMaxRow - (sz-lp2-1);
+      while( jCol > jm ) {
+	profileFillMatchedGap(p2, jCol, al0, n1, trace, fromSecond);
+      }
+    }
   } else {
-    int chopFront = 0;
-    int chopBack = 0;
-    if( pad > 0 ) {
-      if( chop ) {
-	while( seq[newLen - 1 - chopFront] == gap && chopFront < pad ) {
-	  chopFront += 1;
-	}
+    uint const cur = sz - 1;
+    if( iy[cur] > score[cur] && iy[cur] >= ix[cur] ) {
+      state = 1;
+    } else if( ix[cur] > score[cur] ) {
+      state = 2;
+    }
+  }
+  
+  while( iRow > 0 and jCol > 0 ) {
+    uint const cur = iRow*(lp2+1) + jCol;
+
+    if( state == 0 ) {
+      uint const k = cur - lp2 - 2;
+      T const sm = pairScores(iRow-1, jCol-1);
+      state = (score[cur] == sm + score[k]) ? 0 : ((score[cur] == sm + iy[k]) ? 1 : 2);
       
-	while( seq[chopBack] == gap && chopBack < pad ) {
-	  chopBack += 1;
-	}
+      const int* p1r = p1[iRow-1];
+      const int* p2c = p2[jCol-1];
+      for(int i = 0; i < 6; ++i) {
+	al0[i] = p1r[i] + p2c[i];
+      }
+      iRow -= 1;
+      jCol -= 1;
+      al0 += 6;
+      traceColumn(trace, fromBoth);
+    } else if( state == 1 ) {
+      state = (iy[cur] == score[cur - lp2 - 1] + rowGapScore[iRow-1]) ? 0 : 1;
+      profileFillMatchedGap(p1, iRow, al0, n2, trace, fromFirst);
+    } else {
+      state = (ix[cur] == score[cur - 1] + colGapScore[jCol-1]) ? 0 : 2;
+      profileFillMatchedGap(p2, jCol, al0, n1, trace, fromSecond);
+    }
+  }
+  
+  while( iRow > 0 ) {
+    profileFillMatchedGap(p1, iRow, al0, n2, trace, fromFirst);
+  }
+  
+  while( jCol > 0 ) {
+    profileFillMatchedGap(p2, jCol, al0, n1, trace, fromSecond);
+  }
+
+  return (al0 - alignment)/6;
+}
+
+// Alignment of profiles, dispatched on linear/affine gaps. 'alignment' has
+// room for 6*(lp1+lp2) counts. When given, 'trace' (of the same length in
+// columns) gets the ColumnOrigin of each column. Both results reversed.
+
+template<typename T>
+static uint
+profToProf(const int* const*          p1,
+	   uint const                 lp1,
+	   const int* const*          p2,
+	   uint const                 lp2,
+	   MatchScoreValues<T> const& matchScores,
+	   int* const                 alignment,
+	   byte* const                trace = 0)
+{
+  return matchScores.gapOpen == matchScores.gapExtend ?
+    alignProfToProf<T>(p1, lp1, p2, lp2, matchScores, alignment, trace) :
+    alignProfToProfAffine<T>(p1, lp1, p2, lp2, matchScores, alignment, trace);
+}
+
+// Native profile: per column counts of each nucleotide, N and gap, stored
+// contiguously (6 per column). Supports in place updates, so that
+// progressive alignment does not convert profiles to and from python lists
+// at each step.
+
+struct ProfileObject : PyObject {
+  vector<int>*	counts;
+  uint		nSeqs;
+
+  uint nColumns(void) const { return counts->size() / 6; }
+  int* column(uint const i) { return &(*counts)[6*i]; }
+
+  // pointers to columns, as consumed by the alignment routines
+  void columns(vector<const int*>& cols, uint const pad = 0) const {
+    uint const n = nColumns();
+    cols.resize(n + 2*pad);
+    for(uint i = 0; i < n; ++i) {
+      cols[pad + i] = &(*counts)[6*i];
+    }
+  }
+};
+
+extern PyTypeObject ProfileType;
+
+static inline bool
+isProfile(PyObject* const o)
+{
+  return PyObject_TypeCheck(o, &ProfileType);
+}
+
+static ProfileObject*
+newProfile(void)
+{
+  ProfileObject* const p = PyObject_New(ProfileObject, &ProfileType);
+  if( p ) {
+    p->counts = new vector<int>;
+    p->nSeqs = 0;
+  }
+  return p;
+}
+
+// New profile from reversed alignment columns (as returned by profToProf).
+
+static ProfileObject*
+profileFromReversed(const int* const al, uint const alLen, uint const nSeqs)
+{
+  ProfileObject* const p = newProfile();
+  if( p ) {
+    p->counts->resize(6*alLen);
+    for(uint i = 0; i < alLen; ++i) {
+      std::copy(al + 6*(alLen - 1 - i), al + 6*(alLen - i), p->column(i));
+    }
+    p->nSeqs = nSeqs;
+  }
+  return p;
+}
+
+// Add (sign=1) or remove (sign=-1) one aligned sequence. An empty profile
+// takes the length of the first sequence.
+
+static bool
+profileAddSeq(ProfileObject* const self, PyObject* const pSeq, int const sign)
+{
+  uint lseq;
+  const byte* const s = readSequence(pSeq, lseq, false);
+  if( ! s ) {
+    return false;
+  }
+  std::unique_ptr<const byte[]> rel(s);
+
+  if( self->nSeqs == 0 && sign > 0 ) {
+    self->counts->assign(6*lseq, 0);
+  }
+  
+  if( lseq != self->nColumns() ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not aligned to profile");
+    return false;
+  }
+  
+  if( sign < 0 ) {
+    if( self->nSeqs == 0 ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: empty profile");
+      return false;
+    }
+    for(uint i = 0; i < lseq; ++i) {
+      if( self->column(i)[s[i]] == 0 ) {
+	PyErr_SetString(PyExc_ValueError, "wrong args: sequence not in profile");
+	return false;
       }
     }
+  }
 
-    int const totChop = chopBack+chopFront;
-    retSeq = PyTuple_New(newLen - totChop);
-    for(int i = chopFront; i < newLen-chopBack; ++i) {
-      PyTuple_SET_ITEM(retSeq, i-chopFront, PyInt_FromLong(seq[newLen - 1 - i]));
+  int* c = self->column(0);
+  for(uint i = 0; i < lseq; ++i, c += 6) {
+    c[s[i]] += sign;
+  }
+  self->nSeqs += sign;
+  
+  return true;
+}
+
+static void
+Profile_dealloc(ProfileObject* self)
+{
+  delete self->counts;
+  self->ob_type->tp_free((PyObject*)self);
+}
+
+static PyObject*
+Profile_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"counts",
+				 static_cast<const char*>(0)};
+  PyObject* pCounts = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "|O", const_cast<char**>(kwlist),
+				    &pCounts) ) {
+    return 0;
+  }
+
+  ProfileObject* const self = (ProfileObject*)type->tp_alloc(type, 0);
+  if( ! self ) {
+    return 0;
+  }
+  self->counts = new vector<int>;
+  self->nSeqs = 0;
+  
+  if( pCounts ) {
+    // from per column counts, as returned by createProfile
+    if( ! PySequence_Check(pCounts) ) {
+      Py_DECREF(self);
+      PyErr_SetString(PyExc_ValueError, "wrong args: bad profile");
+      return 0;
     }
+    uint const n = PySequence_Size(pCounts);
+    vector<const int*> cols(n);
     
-    if( chop ) {
-      PyObject* t = PyTuple_New(3);
-      PyTuple_SET_ITEM(t, 0, retSeq);
-      PyTuple_SET_ITEM(t, 1, PyInt_FromLong(pad - chopFront));
-      PyTuple_SET_ITEM(t, 2, PyInt_FromLong(pad - chopBack));
-      retSeq = t;
+    if( ! readProfile(pCounts, n, *self->counts, &cols[0]) ) {
+      Py_DECREF(self);
+      return 0;
+    }
+    
+    if( n > 0 ) {
+      const int* const c = self->column(0);
+      self->nSeqs = std::accumulate(c, c + 6, 0);
     }
   }
+  return self;
+}
+
+static Py_ssize_t
+Profile_length(ProfileObject* self)
+{
+  return self->nColumns();
+}
+
+static PyObject*
+Profile_item(ProfileObject* self, Py_ssize_t i)
+{
+  if( ! (0 <= i && i < Py_ssize_t(self->nColumns())) ) {
+    PyErr_SetString(PyExc_IndexError, "profile index out of range");
+    return 0;
+  }
+  const int* const c = self->column(i);
+  PyObject* const t = PyList_New(6);
+  for(uint k = 0; k < 6; ++k) {
+    PyList_SET_ITEM(t, k, PyInt_FromLong(c[k]));
+  }
+  return t;
+}
+
+static PyObject*
+Profile_slice(ProfileObject* self, Py_ssize_t i0, Py_ssize_t i1)
+{
+  Py_ssize_t const n = self->nColumns();
+  i0 = std::max(Py_ssize_t(0), std::min(i0, n));
+  i1 = std::max(i0, std::min(i1, n));
   
-  delete [] seq;
+  ProfileObject* const p = newProfile();
+  if( p ) {
+    p->counts->assign(self->counts->begin() + 6*i0, self->counts->begin() + 6*i1);
+    p->nSeqs = self->nSeqs;
+  }
+  return p;
+}
 
-  return retSeq;
+static PyObject*
+profile_add(ProfileObject* self, PyObject* pSeq)
+{
+  if( ! profileAddSeq(self, pSeq, 1) ) {
+    return 0;
+  }
+  Py_RETURN_NONE;
 }
 
+static PyObject*
+profile_remove(ProfileObject* self, PyObject* pSeq)
+{
+  if( ! profileAddSeq(self, pSeq, -1) ) {
+    return 0;
+  }
+  Py_RETURN_NONE;
+}
 
-PyObject*
-alignProfileToProfile(PyObject*, PyObject* args, PyObject* kwds)
+static PyObject*
+profile_pad(ProfileObject* self, PyObject* args)
 {
-  static const char *kwlist[] = {"p0", "p1", "scores",
+  uint left = 0, right = 0;
+  if( ! PyArg_ParseTuple(args, "I|I", &left, &right) ) {
+    return 0;
+  }
+  
+  int gapColumn[6] = {0,0,0,0,0,int(self->nSeqs)};
+  vector<int> c;
+  c.reserve(self->counts->size() + 6*(left + right));
+  for(uint k = 0; k < left; ++k) {
+    c.insert(c.end(), gapColumn, gapColumn + 6);
+  }
+  c.insert(c.end(), self->counts->begin(), self->counts->end());
+  for(uint k = 0; k < right; ++k) {
+    c.insert(c.end(), gapColumn, gapColumn + 6);
+  }
+  self->counts->swap(c);
+  
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+profile_removeColumns(ProfileObject* self, PyObject* pCols)
+{
+  PyObject* const cols = PySequence_Fast(pCols, "wrong args: columns not a sequence");
+  if( ! cols ) {
+    return 0;
+  }
+  
+  uint const n = self->nColumns();
+  vector<bool> drop(n, false);
+  
+  for(Py_ssize_t k = 0; k < PySequence_Fast_GET_SIZE(cols); ++k) {
+    long const i = PyInt_AsLong(PySequence_Fast_GET_ITEM(cols, k));
+    if( ! (0 <= i && i < long(n)) ) {
+      Py_DECREF(cols);
+      PyErr_SetString(PyExc_ValueError, "wrong args: bad column");
+      return 0;
+    }
+    drop[i] = true;
+  }
+  Py_DECREF(cols);
+
+  vector<int>& c = *self->counts;
+  uint k = 0;
+  for(uint i = 0; i < n; ++i) {
+    if( ! drop[i] ) {
+      std::copy(c.begin() + 6*i, c.begin() + 6*(i+1), c.begin() + 6*k);
+      k += 1;
+    }
+  }
+  c.resize(6*k);
+  
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+profile_merge(ProfileObject* self, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"other", "scores",
 				 static_cast<const char*>(0)};
-  PyObject* pPfofile0 = 0;
-  PyObject* pPfofile1 = 0;
+  PyObject* pOther = 0;
   PyObject* mScores = 0;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|O", const_cast<char**>(kwlist),
-				    &pPfofile0, &pPfofile1, &mScores)) {
-    PyErr_SetString(PyExc_ValueError, "wrong args (6).") ;
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O!|O", const_cast<char**>(kwlist),
+				    &ProfileType, &pOther, &mScores) ) {
     return 0;
   }
 
-  if( ! (PySequence_Check(pPfofile0) && PySequence_Check(pPfofile1)) ) {
-    PyErr_SetString(PyExc_ValueError, "wrong args: bad profiles") ;
+  ProfileObject* const other = static_cast<ProfileObject*>(pOther);
+  if( self->nSeqs == 0 || other->nSeqs == 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: empty profile");
+    return 0;
+  }
+  
+  MatchScoreValues<double> const matchScores(mScores);
+  if( ! matchScores.valid() ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: invalid scores") ;
     return 0;
   }
 
-  int const nProfile0 = PySequence_Size(pPfofile0);
-  int const nProfile1 = PySequence_Size(pPfofile1);
+  if( self->nColumns() == 0 || other->nColumns() == 0 ) {
+    // nothing to align: the columns of one, with the sequences of the other
+    // all gaps
+    vector<int>& c = *self->counts;
+    uint const nGaps = self->nColumns() == 0 ? self->nSeqs : other->nSeqs;
+    if( self->nColumns() == 0 ) {
+      c = *other->counts;
+    }
+    for(uint i = 0; i < c.size(); i += 6) {
+      c[i + 5] += nGaps;
+    }
+    self->nSeqs += other->nSeqs;
+    Py_RETURN_NONE;
+  }
+  
+  vector<const int*> p1, p2;
+  self->columns(p1);
+  other->columns(p2);
+  
+  vector<int> al(6*(p1.size() + p2.size()));
+  uint const alLen = profToProf<double>(&p1[0], p1.size(), &p2[0], p2.size(),
+					matchScores, &al[0]);
+
+  vector<int>& c = *self->counts;
+  c.resize(6*alLen);
+  for(uint i = 0; i < alLen; ++i) {
+    std::copy(&al[6*(alLen - 1 - i)], &al[6*(alLen - i)], &c[6*i]);
+  }
+  self->nSeqs += other->nSeqs;
+  
+  Py_RETURN_NONE;
+}
+
+static PyObject*
+profile_columns(ProfileObject* self)
+{
+  uint const n = self->nColumns();
+  PyObject* const t = PyTuple_New(n);
+  for(uint i = 0; i < n; ++i) {
+    PyTuple_SET_ITEM(t, i, Profile_item(self, i));
+  }
+  return t;
+}
+
+static PyObject*
+Profile_getnSeqs(ProfileObject* self, void*)
+{
+  return PyInt_FromLong(self->nSeqs);
+}
+
+static PyMethodDef profile_methods[] = {
+  {"add", (PyCFunction)profile_add, METH_O,
+   "Add an aligned sequence (of the profile length)."},
+  {"remove", (PyCFunction)profile_remove, METH_O,
+   "Remove an aligned sequence previously added."},
+  {"pad", (PyCFunction)profile_pad, METH_VARARGS,
+   "pad(left, right=0): add all gap columns on both ends."},
+  {"removeColumns", (PyCFunction)profile_removeColumns, METH_O,
+   "Remove columns (given by index)."},
+  {"merge", (PyCFunction)profile_merge, METH_VARARGS|METH_KEYWORDS,
+   "Align another profile to this one and replace this by the merged profile."},
+  {"columns", (PyCFunction)profile_columns, METH_NOARGS,
+   "Per column counts, as returned by createProfile."},
+  {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef profile_getset[] = {
+  {const_cast<char*>("nSeqs"), (getter)Profile_getnSeqs, 0,
+   const_cast<char*>("Number of sequences in profile."), 0},
+  {NULL}  /* Sentinel */
+};
+
+static PySequenceMethods profile_as_sequence = {
+    (lenfunc)Profile_length,       /* sq_length */
+    0,                             /* sq_concat */
+    0,                             /* sq_repeat */
+    (ssizeargfunc)Profile_item,    /* sq_item */
+    (ssizessizeargfunc)Profile_slice, /* sq_slice */
+    0,                             /* sq_ass_item */
+    0,                             /* sq_ass_slice */
+    0,                             /* sq_contains */
+};
+
+PyTypeObject ProfileType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "calign.Profile",          /*tp_name*/
+    sizeof(ProfileObject),     /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)Profile_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &profile_as_sequence,      /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash*/
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Alignment profile. Profile(counts) converts a profile from createProfile.", /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    profile_methods,           /* tp_methods */
+    0,                         /* tp_members */
+    profile_getset,            /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,                         /* tp_init */
+    0,                         /* tp_alloc */
+    (newfunc)Profile_new,      /* tp_new */
+};
+
+// Column pointers of a profile, either a Profile (used in place) or a
+// sequence of per column counts (read into storage). 
+
+static bool
+profileColumns(PyObject* const       pProfile,
+	       vector<const int*>&   cols,
+	       vector<int>&          storage,
+	       uint const            pad = 0)
+{
+  if( isProfile(pProfile) ) {
+    static_cast<ProfileObject*>(pProfile)->columns(cols, pad);
+    return true;
+  }
+  
+  if( ! PySequence_Check(pProfile) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: bad profile") ;
+    return false;
+  }
+  uint const n = PySequence_Size(pProfile);
+  cols.resize(n + 2*pad);
+  return readProfile(pProfile, n, storage, &cols[pad]);
+}
+
+PyObject*
+alignToProfile(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"seq", "profile", "pad", "chop",
+				 "matchScore", "misMatchScore", "gapPenalty", "gapExtend",
+				 static_cast<const char*>(0)};
+  PyObject* pSeq = 0;
+  PyObject* pPfofile = 0;
+  float matchScore = 10;
+  float misMatchScore = -5;
+  float gapPenalty = -6;
+  PyObject* pGapExtend = 0;
+  int	pad = 0;
+  PyObject* pChop = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|iOfffO", const_cast<char**>(kwlist),
+				    &pSeq, &pPfofile,&pad,&pChop,
+				    &matchScore, &misMatchScore, &gapPenalty, &pGapExtend)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (5).") ;
+    return 0;
+  }
+
+  // linear gaps unless given an extension penalty
+  float const gapExtend = getValue<float>(pGapExtend, gapPenalty);
+
+  uint seqLen;
+  byte* seq = readSequence(pSeq, seqLen, false);
+  if( ! seq ) {
+    return 0;
+  }
+
+  if( pad < 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: bad profile/pad") ;
+    return 0;
+  }
+
+  vector<const int*> profile;
+  vector<int> storage;
+  if( ! profileColumns(pPfofile, profile, storage, pad) ) {
+    delete [] seq;
+    return 0;
+  }
+  
+  uint const nSites = profile.size();
+  if( nSites == uint(2*pad) ) {
+    delete [] seq;
+    PyErr_SetString(PyExc_ValueError, "wrong args: empty profile") ;
+    return 0;
+  }
+
+  const int* const p0 = profile[pad];
+  int const nSeqs = std::accumulate(p0, p0 + 6, 0);
+
+  // all padding columns are the same
+  int const padColumn[6] = {0,0,0,0,0,nSeqs};
+  for(int n = 0; n < pad; ++n) {
+    profile[n] = profile[nSites - 1 - n] = padColumn;
+  }
+    
+  if( seqLen < nSites ) {
+    byte* s = new byte[nSites];
+    for(uint k = 0; k < seqLen; ++k) {
+      s[k] = seq[k];
+    }
+    delete seq;
+    seq = s;
+  }
+  
+  int const newLen = gapExtend == gapPenalty ?
+    alignToProf<float>(seq, seqLen, &profile[0], nSites,
+		       matchScore, misMatchScore, gapPenalty) :
+    alignToProfAffine<float>(seq, seqLen, &profile[0], nSites,
+			     matchScore, misMatchScore, gapPenalty, gapExtend);
+  
+  PyObject* retSeq = 0;
+
+  bool const chop = (pad > 0 && pChop != 0 && PyObject_IsTrue(pChop));
+  
+  if( newLen < 0 ) {
+    PyErr_SetString(PyExc_ValueError, "short profile.");
+  } else {
+    int chopFront = 0;
+    int chopBack = 0;
+    if( pad > 0 ) {
+      if( chop ) {
+	while( seq[newLen - 1 - chopFront] == gap && chopFront < pad ) {
+	  chopFront += 1;
+	}
+      
+	while( seq[chopBack] == gap && chopBack < pad ) {
+	  chopBack += 1;
+	}
+      }
+    }
+
+    int const totChop = chopBack+chopFront;
+    retSeq = PyTuple_New(newLen - totChop);
+    for(int i = chopFront; i < newLen-chopBack; ++i) {
+      PyTuple_SET_ITEM(retSeq, i-chopFront, PyInt_FromLong(seq[newLen - 1 - i]));
+    }
+    
+    if( chop ) {
+      PyObject* t = PyTuple_New(3);
+      PyTuple_SET_ITEM(t, 0, retSeq);
+      PyTuple_SET_ITEM(t, 1, PyInt_FromLong(pad - chopFront));
+      PyTuple_SET_ITEM(t, 2, PyInt_FromLong(pad - chopBack));
+      retSeq = t;
+    }
+  }
+  
+  delete [] seq;
+
+  return retSeq;
+}
+
+
+PyObject*
+alignProfileToProfile(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"p0", "p1", "scores",
+				 static_cast<const char*>(0)};
+  PyObject* pPfofile0 = 0;
+  PyObject* pPfofile1 = 0;
+  PyObject* mScores = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|O", const_cast<char**>(kwlist),
+				    &pPfofile0, &pPfofile1, &mScores)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (6).") ;
+    return 0;
+  }
+
+  vector<const int*> profile0, profile1;
+  vector<int> storage0, storage1;
+  
+  if( ! (profileColumns(pPfofile0, profile0, storage0) &&
+	 profileColumns(pPfofile1, profile1, storage1)) ) {
+    return 0;
+  }
+  
+  uint const nProfile0 = profile0.size();
+  uint const nProfile1 = profile1.size();
+  if( nProfile0 == 0 || nProfile1 == 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: empty profile") ;
+    return 0;
+  }
+  
+  MatchScoreValues<double> const matchScores(mScores);
+
+  vector<int> al(6*(nProfile0+nProfile1));
+
+  // Scores in the profile grow large and run down the float accuracy.
+  uint const alLen = profToProf<double>(&profile0[0], nProfile0, &profile1[0], nProfile1,
+					matchScores, &al[0]);
+
+  if( isProfile(pPfofile0) || isProfile(pPfofile1) ) {
+    int const nSeqs = std::accumulate(&al[0], &al[6], 0);
+    return profileFromReversed(&al[0], alLen, nSeqs);
+  }
+  
+  PyObject* retSeq = PyTuple_New(alLen);
+  for(uint i = 0; i < alLen; ++i) {
+    PyObject* t = PyTuple_New(6);
+    const int* const a = &al[6*(alLen - 1 - i)];
+    for(int k = 0; k < 6; ++k) {
+      PyTuple_SET_ITEM(t, k, PyInt_FromLong(a[k]));
+    }
+    PyTuple_SET_ITEM(retSeq, i, t);
+  }
+
+  return retSeq;
+}
+
+PyObject*
+createProfile(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"seqs", "native",
+				 static_cast<const char*>(0)};
+  PyObject* pSeqs = 0;
+  PyObject* pNative = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|O", const_cast<char**>(kwlist),
+				    &pSeqs, &pNative) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (7).") ;
+    return 0;
+  }
+
+  if( ! (PyTuple_Check(pSeqs) || PyList_Check(pSeqs)) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a list of sequences") ;
+    return 0;
+  }
+
+  int const nSeqs = PySequence_Size(pSeqs);
+
+  if( nSeqs == 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: no sequences") ;
+    return 0;
+  }
+  
+  uint seqLen = 0;
+  long* counts = 0;
+  
+  for(int j = 0; j < nSeqs; ++j) {
+    PyObject* seq = PySequence_Fast_GET_ITEM(pSeqs, j);
+
+    uint lseq;
+    const byte* const s = readSequence(seq, lseq, false);
+    if( ! s ) {
+      return 0;
+    }
+    
+    if( j == 0 ) {
+      seqLen = lseq;
+      counts = new long [seqLen*6];
+      for(long* c = counts; c < counts+seqLen*6; ++c) {
+	*c = 0;
+      }
+    } else {
+      if( unsigned(lseq) != seqLen ) {
+	delete [] counts;
+	delete [] s;
+	PyErr_SetString(PyExc_ValueError, "wrong args: not aligned");
+	return 0;
+      }
+    }
+    
+    long* c = counts;
+    for(const byte* seq = s; lseq > 0; --lseq, ++seq) {
+      c[*seq] += 1;
+      c += 6;
+    }
+    delete [] s;
+  }
+  
+  if( pNative && PyObject_IsTrue(pNative) ) {
+    ProfileObject* const p = newProfile();
+    if( p ) {
+      p->counts->assign(counts, counts + 6*seqLen);
+      p->nSeqs = nSeqs;
+    }
+    delete [] counts;
+    return p;
+  }
+  
+  PyObject* retSeq = PyTuple_New(seqLen);
+  const long* c = counts;
+  for(uint i = 0; i < seqLen; ++i, c += 6) {
+    PyObject* t = PyList_New(6);
+    for(uint j = 0; j < 6; ++j) {
+      //PyList_SET_ITEM(t, j, PyLong_FromLong(c[j]));
+      PyList_SET_ITEM(t, j, PyInt_FromLong(c[j]));      
+    } 
+    PyTuple_SET_ITEM(retSeq, i, t);
+  }
+
+  delete [] counts;
+  return retSeq;
+}
+
+// Insert the new gaps of a profile to profile alignment into an aligned
+// sequence of one of the profiles. 'trace' is reversed, as from profToProf,
+// and columns originating only from the 'other' profile are gaps.
+
+static void
+insertTraceGaps(vector<byte>& row, const byte* const trace, uint const alLen,
+		byte const other)
+{
+  vector<byte> r(alLen);
+  const byte* s = &row[0];
+  for(uint i = 0; i < alLen; ++i) {
+    r[i] = trace[alLen - 1 - i] == other ? gap : *s++;
+  }
+  row.swap(r);
+}
+
+// Progressive multiple alignment along a guide tree. The tree is given as
+// joins, in UPGMA output order: join k merges clusters i and j (sequences
+// are clusters 0..n-1) into cluster n+k. Each join aligns the profiles of
+// the two clusters. Joins whose clusters are ready are independent, and run
+// in parallel on a pool of threads taking joins off a shared ready list.
+
+class ProgressiveAligner {
+public:
+  ProgressiveAligner(vector< vector<byte> >&       seqs,
+		     vector<uint> const&           _joins,
+		     MatchScoreValues<double> const& _scores);
+
+  void run(uint nThreads);
+
+  // aligned sequences
+  vector< vector<byte> >	rows;
+
+  // profile of all sequences
+  vector<int> const& profile(void) const { return nodes.back().counts; }
+  
+private:
+  struct Node {
+    // profile of cluster
+    vector<int>		counts;
+    // sequences in cluster
+    vector<uint>	members;
+    uint		parent;
+    // number of children not yet aligned
+    int			pending;
+  };
+
+  void join(uint k);
+  void worker(void);
+  
+  uint const		nSeqs;
+  // children of join k are joins[2k], joins[2k+1]
+  vector<uint> const&	joins;
+  MatchScoreValues<double> const& scores;
+  vector<Node>		nodes;
+
+  std::mutex			lock;
+  std::condition_variable	readyOrDone;
+  vector<uint>			ready;
+  uint				nDone;
+};
+
+ProgressiveAligner::ProgressiveAligner(vector< vector<byte> >&         seqs,
+				       vector<uint> const&             _joins,
+				       MatchScoreValues<double> const& _scores) :
+  nSeqs(seqs.size()),
+  joins(_joins),
+  scores(_scores),
+  nodes(2*seqs.size() - 1),
+  nDone(0)
+{
+  rows.resize(nSeqs);
+  for(uint i = 0; i < nSeqs; ++i) {
+    Node& nd = nodes[i];
+    vector<byte>& s = seqs[i];
+    nd.counts.assign(6*s.size(), 0);
+    for(uint k = 0; k < s.size(); ++k) {
+      nd.counts[6*k + s[k]] = 1;
+    }
+    nd.members.push_back(i);
+    nd.pending = 0;
+    rows[i].swap(s);
+  }
+  
+  for(uint k = 0; k < nSeqs-1; ++k) {
+    Node& nd = nodes[nSeqs + k];
+    nd.pending = 0;
+    for(uint c = 0; c < 2; ++c) {
+      uint const ch = joins[2*k+c];
+      nodes[ch].parent = nSeqs + k;
+      if( ch >= nSeqs ) {
+	nd.pending += 1;
+      }
+    }
+    if( nd.pending == 0 ) {
+      ready.push_back(k);
+    }
+  }
+}
+
+void
+ProgressiveAligner::join(uint const k)
+{
+  Node& nd = nodes[nSeqs + k];
+  Node& n1 = nodes[joins[2*k]];
+  Node& n2 = nodes[joins[2*k+1]];
+
+  uint const l1 = n1.counts.size() / 6;
+  uint const l2 = n2.counts.size() / 6;
+  vector<const int*> p1(l1), p2(l2);
+  for(uint i = 0; i < l1; ++i) {
+    p1[i] = &n1.counts[6*i];
+  }
+  for(uint i = 0; i < l2; ++i) {
+    p2[i] = &n2.counts[6*i];
+  }
+
+  vector<int> al(6*(l1+l2));
+  vector<byte> trace(l1+l2);
+  uint const alLen = profToProf<double>(&p1[0], l1, &p2[0], l2, scores, &al[0], &trace[0]);
+
+  nd.counts.resize(6*alLen);
+  for(uint i = 0; i < alLen; ++i) {
+    std::copy(&al[6*(alLen - 1 - i)], &al[6*(alLen - i)], &nd.counts[6*i]);
+  }
+
+  // insert the new gap columns in the aligned sequences of each side
+  for(uint side = 0; side < 2; ++side) {
+    Node& ns = side == 0 ? n1 : n2;
+    byte const skip = side == 0 ? fromSecond : fromFirst;
+    for(auto const m : ns.members) {
+      insertTraceGaps(rows[m], &trace[0], alLen, skip);
+    }
+    nd.members.insert(nd.members.end(), ns.members.begin(), ns.members.end());
+    vector<uint>().swap(ns.members);
+    vector<int>().swap(ns.counts);
+  }
+}
+
+void
+ProgressiveAligner::worker(void)
+{
+  uint const nJoins = nSeqs - 1;
+  std::unique_lock<std::mutex> l(lock);
+  while( true ) {
+    while( ready.empty() && nDone < nJoins ) {
+      readyOrDone.wait(l);
+    }
+    if( nDone == nJoins ) {
+      break;
+    }
+    uint const k = ready.back();
+    ready.pop_back();
+    
+    l.unlock();
+    join(k);
+    l.lock();
+
+    nDone += 1;
+    if( nDone == nJoins ) {
+      readyOrDone.notify_all();
+    } else {
+      Node& parent = nodes[nodes[nSeqs + k].parent];
+      parent.pending -= 1;
+      if( parent.pending == 0 ) {
+	ready.push_back(nodes[nSeqs + k].parent - nSeqs);
+	readyOrDone.notify_one();
+      }
+    }
+  }
+}
+
+void
+ProgressiveAligner::run(uint const nThreads)
+{
+  if( nThreads <= 1 ) {
+    // joins are ordered so that both children of a join come before it
+    for(uint k = 0; k < nSeqs-1; ++k) {
+      join(k);
+    }
+    return;
+  }
+  
+  vector<std::thread> pool;
+  for(uint t = 0; t < nThreads; ++t) {
+    pool.push_back(std::thread(&ProgressiveAligner::worker, this));
+  }
+  for(auto& t : pool) {
+    t.join();
+  }
+}
+
+// Read n-1 joins of n clusters (as in upgma output), checking that each
+// cluster is joined exactly once, after it was formed.
+
+static bool
+readJoins(PyObject* const pJoins, uint const n, vector<uint>& joins)
+{
+  if( ! (PySequence_Check(pJoins) && uint(PySequence_Size(pJoins)) == n-1) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: expecting n-1 joins for n sequences") ;
+    return false;
+  }
+  
+  joins.resize(2*(n-1));
+  vector<bool> used(2*n-1, false);
+  for(uint k = 0; k < n-1; ++k) {
+    PyObject* const o = PySequence_GetItem(pJoins, k);
+    PyObject* const j = o ? PySequence_Fast(o, "") : 0;
+    Py_XDECREF(o);
+    bool ok = j && PySequence_Fast_GET_SIZE(j) >= 2;
+    for(uint c = 0; ok && c < 2; ++c) {
+      long const x = PyInt_AsLong(PySequence_Fast_GET_ITEM(j, c));
+      ok = 0 <= x && x < long(n + k) && ! used[x];
+      if( ok ) {
+	used[x] = true;
+	joins[2*k+c] = x;
+      }
+    }
+    Py_XDECREF(j);
+    if( ! ok ) {
+      PyErr_Format(PyExc_ValueError, "wrong args: bad join ([%ld])", long(k));
+      return false;
+    }
+  }
+  return true;
+}
+
+static PyObject*
+rowsAsTuple(vector< vector<byte> > const& rows)
+{
+  PyObject* const al = PyTuple_New(rows.size());
+  for(uint i = 0; i < rows.size(); ++i) {
+    vector<byte> const& r = rows[i];
+    PyObject* const t = PyTuple_New(r.size());
+    for(uint k = 0; k < r.size(); ++k) {
+      PyTuple_SET_ITEM(t, k, PyInt_FromLong(r[k]));
+    }
+    PyTuple_SET_ITEM(al, i, t);
+  }
+  return al;
+}
+
+PyObject*
+progressiveAlign(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"seqs", "joins", "scores", "threads",
+				 static_cast<const char*>(0)};
+  PyObject* pSeqs = 0;
+  PyObject* pJoins = 0;
+  PyObject* mScores = 0;
+  uint nThreads = 1;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|OI", const_cast<char**>(kwlist),
+				    &pSeqs, &pJoins, &mScores, &nThreads) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (9).") ;
+    return 0;
+  }
+
+  if( ! (PySequence_Check(pSeqs) && PySequence_Check(pJoins)) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: expecting sequences and joins") ;
+    return 0;
+  }
+  
+  uint const n = PySequence_Size(pSeqs);
+  if( n == 0 || uint(PySequence_Size(pJoins)) != n-1 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: expecting n-1 joins for n sequences") ;
+    return 0;
+  }
+
+  vector< vector<byte> > seqs(n);
+  for(uint i = 0; i < n; ++i) {
+    PyObject* const o = PySequence_GetItem(pSeqs, i);
+    uint l;
+    byte* const s = o ? readSequence(o, l, true) : 0;
+    Py_XDECREF(o);
+    if( ! s ) {
+      return 0;
+    }
+    seqs[i].assign(s, s + l);
+    delete [] s;
+    if( l == 0 ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: empty sequence") ;
+      return 0;
+    }
+  }
+
+  vector<uint> joins;
+  if( ! readJoins(pJoins, n, joins) ) {
+    return 0;
+  }
+  
+  MatchScoreValues<double> const matchScores(mScores);
+  if( ! matchScores.valid() ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: invalid scores") ;
+    return 0;
+  }
+
+  ProgressiveAligner pa(seqs, joins, matchScores);
+  
+  Py_BEGIN_ALLOW_THREADS
+  pa.run(std::min(nThreads, n-1));
+  Py_END_ALLOW_THREADS
+
+  PyObject* const al = rowsAsTuple(pa.rows);
+
+  ProfileObject* const p = newProfile();
+  if( p ) {
+    p->counts->assign(pa.profile().begin(), pa.profile().end());
+    p->nSeqs = n;
+  }
+  
+  PyObject* const ret = PyTuple_New(2);
+  PyTuple_SET_ITEM(ret, 0, al);
+  PyTuple_SET_ITEM(ret, 1, p);
+  return ret;
+}
+
+// Iterative refinement of a multiple alignment, maximizing the sum of pairs
+// score (gap against gap scores 0). The column counts are kept up to date,
+// so taking out a sequence and putting it back is O(L). With affine gaps the
+// sum of pairs counts gap opens in each pair, and is computed from the rows.
+//
+// Each round
+//  (1) realigns every sequence in turn to the profile of all the others,
+//  (2) when given a guide tree (as joins), splits the alignment at every
+//      tree edge, realigns the two profiles and keeps the best split.
+//      Splits are tried in parallel.
+// A change is kept only when it improves the score. Stops at a round with no
+// improvement.
+
+class AlignmentRefiner {
+public:
+  AlignmentRefiner(vector< vector<byte> >&          _rows,
+		   MatchScoreValues<double> const&  _scores) :
+    rows(_rows),
+    scores(_scores),
+    affine(_scores.gapOpen != _scores.gapExtend)
+    {
+      setCounts();
+    }
+
+  // Number of sequences whose alignment changed
+  uint leaveOneOut(void);
+
+  // True if a split improved the alignment
+  bool bestSplit(vector<uint> const& joins, uint nThreads);
+  
+  double score(void) const { return affine ? spScore(rows) : spScore(counts); }
+  
+  vector< vector<byte> >&		rows;
+  
+private:
+  void setCounts(void);
+  void removeGapColumns(void);
+  
+  double spScore(vector<int> const& c) const;
+  double spScore(vector< vector<byte> > const& r) const;
+
+  // Affine score of the pairwise alignment of a and b (gap against gap
+  // columns dropped)
+  double pairScore(const byte* a, const byte* b, uint len) const;
+  
+  // Score of aligned sequence s against all sequences in 'counts' (all rows
+  // but row 'skip' when affine)
+  double rowScore(const byte* s, uint skip) const;
+
+  // Realign parts 'inA' and the rest, returning the score and new rows. When
+  // affine, 'pairs' holds the current score of each pair of rows.
+  double split(vector<bool> const& inA, vector< vector<byte> >& newRows,
+	       vector<double> const& pairs) const;
+  
+  MatchScoreValues<double> const&	scores;
+  bool const				affine;
+  vector<int>				counts;
+};
+
+void
+AlignmentRefiner::setCounts(void)
+{
+  uint const len = rows[0].size();
+  counts.assign(6*len, 0);
+  for(auto const& r : rows) {
+    for(uint i = 0; i < len; ++i) {
+      counts[6*i + r[i]] += 1;
+    }
+  }
+}
+
+void
+AlignmentRefiner::removeGapColumns(void)
+{
+  uint const nSeqs = rows.size();
+  uint const len = rows[0].size();
+  vector<bool> keep(len);
+  bool any = false;
+  for(uint i = 0; i < len; ++i) {
+    keep[i] = counts[6*i + gap] < int(nSeqs);
+    any = any || ! keep[i];
+  }
+  if( any ) {
+    for(auto& r : rows) {
+      uint k = 0;
+      for(uint i = 0; i < len; ++i) {
+	if( keep[i] ) {
+	  r[k++] = r[i];
+	}
+      }
+      r.resize(k);
+    }
+    setCounts();
+  }
+}
+
+double
+AlignmentRefiner::spScore(vector<int> const& c) const
+{
+  double s = 0;
+  for(uint i = 0; i < c.size(); i += 6) {
+    ProfileCounts const pc(&c[i]);
+    s += scores.matchScore * pc.matches + scores.misMatchScore * pc.mis +
+      scores.gapPenalty * pc.gaps;
+  }
+  return s;
+}
+
+double
+AlignmentRefiner::pairScore(const byte* const a, const byte* const b, uint const len) const
+{
+  // pair is in a gap of a (1), of b (2) or not in a gap (0)
+  int inGap = 0;
+  double s = 0;
+  for(uint i = 0; i < len; ++i) {
+    bool const ga = a[i] == gap, gb = b[i] == gap;
+    if( ga && gb ) {
+      continue;
+    }
+    if( ga || gb ) {
+      int const g = ga ? 1 : 2;
+      s += inGap == g ? scores.gapExtend : scores.gapOpen;
+      inGap = g;
+    } else {
+      s += scores.scoreMatching(a[i], b[i]);
+      inGap = 0;
+    }
+  }
+  return s;
+}
+
+double
+AlignmentRefiner::spScore(vector< vector<byte> > const& r) const
+{
+  uint const len = r[0].size();
+  double s = 0;
+  for(uint i = 0; i < r.size(); ++i) {
+    for(uint j = i+1; j < r.size(); ++j) {
+      s += pairScore(&r[i][0], &r[j][0], len);
+    }
+  }
+  return s;
+}
+
+double
+AlignmentRefiner::rowScore(const byte* const s, uint const skip) const
+{
+  if( affine ) {
+    uint const len = rows[0].size();
+    double sc = 0;
+    for(uint i = 0; i < rows.size(); ++i) {
+      if( i != skip ) {
+	sc += pairScore(s, &rows[i][0], len);
+      }
+    }
+    return sc;
+  }
+  
+  long mt = 0, ms = 0, gp = 0;
+  for(uint i = 0; i < counts.size(); i += 6) {
+    const int* const c = &counts[i];
+    int const nonGap = c[0] + c[1] + c[2] + c[3] + c[anynuc];
+    byte const x = s[i/6];
+    if( x == gap ) {
+      gp += nonGap;
+    } else {
+      gp += c[gap];
+      if( x == anynuc ) {
+	mt += nonGap;
+      } else {
+	mt += c[x] + c[anynuc];
+	ms += nonGap - c[x] - c[anynuc];
+      }
+    }
+  }
+  return scores.matchScore * mt + scores.misMatchScore * ms + scores.gapPenalty * gp;
+}
+
+uint
+AlignmentRefiner::leaveOneOut(void)
+{
+  uint const len = rows[0].size();
+  vector<const int*> profile(len);
+  vector<byte> buf(len);
+
+  uint nChanged = 0;
+  for(uint k = 0; k < rows.size(); ++k) {
+    vector<byte>& r = rows[k];
+    for(uint i = 0; i < len; ++i) {
+      counts[6*i + r[i]] -= 1;
+      profile[i] = &counts[6*i];
+    }
+
+    uint nNucs = 0;
+    for(uint i = 0; i < len; ++i) {
+      if( r[i] != gap ) {
+	buf[nNucs++] = r[i];
+      }
+    }
+    
+    int const newLen = scores.gapOpen == scores.gapExtend ?
+      alignToProf<float>(&buf[0], nNucs, &profile[0], len,
+			 scores.matchScore, scores.misMatchScore, scores.gapPenalty) :
+      alignToProfAffine<float>(&buf[0], nNucs, &profile[0], len,
+			       scores.matchScore, scores.misMatchScore,
+			       scores.gapOpen, scores.gapExtend);
+    assert( newLen == int(len) );
+    std::reverse(buf.begin(), buf.begin() + newLen);
+    
+    if( rowScore(&buf[0], k) > rowScore(&r[0], k) ) {
+      std::copy(buf.begin(), buf.end(), r.begin());
+      nChanged += 1;
+    }
+    
+    for(uint i = 0; i < len; ++i) {
+      counts[6*i + r[i]] += 1;
+    }
+  }
+  
+  removeGapColumns();
+  return nChanged;
+}
+
+double
+AlignmentRefiner::split(vector<bool> const& inA, vector< vector<byte> >& newRows,
+			vector<double> const& pairs) const
+{
+  uint const len = rows[0].size();
+  vector<int> c[2];
+  vector<uint> members[2];
+  for(uint k = 0; k < 2; ++k) {
+    c[k].assign(6*len, 0);
+  }
+  for(uint m = 0; m < rows.size(); ++m) {
+    uint const k = inA[m] ? 0 : 1;
+    members[k].push_back(m);
+    const byte* const r = &rows[m][0];
+    for(uint i = 0; i < len; ++i) {
+      c[k][6*i + r[i]] += 1;
+    }
+  }
+
+  newRows.resize(rows.size());
   
-  int*  const allp(new int [12*(nProfile0+nProfile1)]);   std::unique_ptr<int> rel0(allp);
-  int** const profile0(new int* [nProfile0]);             std::unique_ptr<int*> rel1(profile0);
-  int** const profile1(new int* [nProfile1]);             std::unique_ptr<int*> rel2(profile1);
-
-  if( ! readProfile(pPfofile0, nProfile0, allp, profile0) ) {
-    return 0;
+  // profiles without their all gap columns
+  vector<const int*> p[2];
+  vector<bool> keep[2];
+  for(uint k = 0; k < 2; ++k) {
+    keep[k].resize(len);
+    for(uint i = 0; i < len; ++i) {
+      keep[k][i] = c[k][6*i + gap] < int(members[k].size());
+      if( keep[k][i] ) {
+	p[k].push_back(&c[k][6*i]);
+      }
+    }
+    for(auto const m : members[k]) {
+      vector<byte>& r = newRows[m];
+      r.clear();
+      for(uint i = 0; i < len; ++i) {
+	if( keep[k][i] ) {
+	  r.push_back(rows[m][i]);
+	}
+      }
+    }
   }
   
-  if( ! readProfile(pPfofile1, nProfile1, allp + 6*nProfile0, profile1) ) {
-    return 0;
+  uint const l0 = p[0].size(), l1 = p[1].size();
+  if( l0 == 0 || l1 == 0 ) {
+    return -std::numeric_limits<double>::infinity();
   }
+  vector<int> al(6*(l0+l1));
+  vector<byte> trace(l0+l1);
+  uint const alLen = profToProf<double>(&p[0][0], l0, &p[1][0], l1, scores, &al[0], &trace[0]);
   
-  MatchScoreValues<double> const matchScores(mScores);
+  for(uint k = 0; k < 2; ++k) {
+    for(auto const m : members[k]) {
+      insertTraceGaps(newRows[m], &trace[0], alLen, k == 0 ? fromSecond : fromFirst);
+    }
+  }
+  
+  if( affine ) {
+    // Within a part only columns where both of a pair are gaps are added or
+    // removed, which leaves the pair score as is. Only pairs across the split
+    // are scored again.
+    uint const nSeqs = rows.size();
+    double sc = 0;
+    for(uint i = 0; i < nSeqs; ++i) {
+      for(uint j = i+1; j < nSeqs; ++j) {
+	if( inA[i] == inA[j] ) {
+	  sc += pairs[i*nSeqs + j];
+	}
+      }
+    }
+    for(auto const a : members[0]) {
+      for(auto const b : members[1]) {
+	sc += pairScore(&newRows[a][0], &newRows[b][0], alLen);
+      }
+    }
+    return sc;
+  }
+  al.resize(6*alLen);
+  return spScore(al);
+}
 
-  int* const al = allp + 6*(nProfile0+nProfile1); //  std::unique_ptr<int> rel3(al);
+bool
+AlignmentRefiner::bestSplit(vector<uint> const& joins, uint const nThreads)
+{
+  uint const nSeqs = rows.size();
+  uint const nJoins = nSeqs - 1;
+
+  // sequences of cluster of each join
+  vector< vector<bool> > inCluster(nJoins, vector<bool>(nSeqs, false));
+  for(uint k = 0; k < nJoins; ++k) {
+    for(uint c = 0; c < 2; ++c) {
+      uint const x = joins[2*k + c];
+      if( x < nSeqs ) {
+	inCluster[k][x] = true;
+      } else {
+	vector<bool> const& sub = inCluster[x - nSeqs];
+	for(uint m = 0; m < nSeqs; ++m) {
+	  if( sub[m] ) {
+	    inCluster[k][m] = true;
+	  }
+	}
+      }
+    }
+  }
 
-  // Scores in the profile grow large and run down the float accuracy.
-  int const alLen = alignProfToProf<double>(profile0, nProfile0, profile1, nProfile1, matchScores, al);
+  struct Best {
+    double			score;
+    // join of split, nJoins when none
+    uint			join;
+    vector< vector<byte> >	rows;
+  };
   
-  PyObject* retSeq = PyTuple_New(alLen);
-  for(int i = 0; i < alLen; ++i) {
-    PyObject* t = PyTuple_New(6);
-    const int* const a = al + 6*(alLen - 1 - i);
-    for(int k = 0; k < 6; ++k) {
-      PyTuple_SET_ITEM(t, k, PyInt_FromLong(a[k]));
+  // score of each pair of rows, for updating the affine score of a split
+  vector<double> pairs;
+  if( affine ) {
+    uint const len = rows[0].size();
+    pairs.assign(nSeqs*nSeqs, 0);
+    for(uint i = 0; i < nSeqs; ++i) {
+      for(uint j = i+1; j < nSeqs; ++j) {
+	pairs[i*nSeqs + j] = pairScore(&rows[i][0], &rows[j][0], len);
+      }
     }
-    PyTuple_SET_ITEM(retSeq, i, t);
   }
+  
+  double const current = score();
+  vector<Best> best(std::max(nThreads, 1U));
+  std::atomic<uint> next(0);
+  
+  auto const work = [&](uint const t) {
+    Best& b = best[t];
+    b.score = current;
+    b.join = nJoins;
+    vector< vector<byte> > r;
+    // last join is the root, not a split. Joins come in increasing order, so
+    // the first of equal scores is kept.
+    for(uint k = next++; k + 1 < nJoins; k = next++) {
+      double const s = split(inCluster[k], r, pairs);
+      if( s > b.score ) {
+	b.score = s;
+	b.join = k;
+	b.rows.swap(r);
+      }
+    }
+  };
 
-  return retSeq;
+  if( nThreads <= 1 ) {
+    work(0);
+  } else {
+    vector<std::thread> pool;
+    for(uint t = 0; t < nThreads; ++t) {
+      pool.push_back(std::thread(work, t));
+    }
+    for(auto& t : pool) {
+      t.join();
+    }
+  }
+
+  // equal scores go to the lowest join, whatever the number of threads
+  Best* b = &best[0];
+  for(auto& x : best) {
+    if( x.score > b->score || (x.score == b->score && x.join < b->join) ) {
+      b = &x;
+    }
+  }
+  if( b->score > current ) {
+    rows.swap(b->rows);
+    setCounts();
+    removeGapColumns();
+    return true;
+  }
+  return false;
 }
 
 PyObject*
-createProfile(PyObject*, PyObject* args, PyObject* kwds)
+refineAlignment(PyObject*, PyObject* args, PyObject* kwds)
 {
-  static const char *kwlist[] = {"seqs",
+  static const char *kwlist[] = {"alignment", "scores", "joins", "rounds", "threads",
 				 static_cast<const char*>(0)};
-  PyObject* pSeqs = 0;
+  PyObject* pAlignment = 0;
+  PyObject* mScores = 0;
+  PyObject* pJoins = 0;
+  uint nRounds = 10;
+  uint nThreads = 1;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O", const_cast<char**>(kwlist),
-				    &pSeqs) ) {
-    PyErr_SetString(PyExc_ValueError, "wrong args (7).") ;
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|OOII", const_cast<char**>(kwlist),
+				    &pAlignment, &mScores, &pJoins, &nRounds, &nThreads) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (10).") ;
     return 0;
   }
 
-  if( ! (PyTuple_Check(pSeqs) || PyList_Check(pSeqs)) ) {
-    PyErr_SetString(PyExc_ValueError, "wrong args: not a list of sequences") ;
+  if( ! PySequence_Check(pAlignment) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: expecting an alignment") ;
     return 0;
   }
-
-  int const nSeqs = PySequence_Size(pSeqs);
-
-  if( nSeqs == 0 ) {
-    PyErr_SetString(PyExc_ValueError, "wrong args: no sequences") ;
+  
+  uint const n = PySequence_Size(pAlignment);
+  if( n < 2 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: need at least 2 sequences") ;
     return 0;
   }
-  
-  uint seqLen = 0;
-  long* counts = 0;
-  
-  for(int j = 0; j < nSeqs; ++j) {
-    PyObject* seq = PySequence_Fast_GET_ITEM(pSeqs, j);
 
-    uint lseq;
-    const byte* const s = readSequence(seq, lseq, false);
+  vector< vector<byte> > rows(n);
+  for(uint i = 0; i < n; ++i) {
+    PyObject* const o = PySequence_GetItem(pAlignment, i);
+    uint l;
+    byte* const s = o ? readSequence(o, l, false) : 0;
+    Py_XDECREF(o);
     if( ! s ) {
       return 0;
     }
-    
-    if( j == 0 ) {
-      seqLen = lseq;
-      counts = new long [seqLen*6];
-      for(long* c = counts; c < counts+seqLen*6; ++c) {
-	*c = 0;
-      }
-    } else {
-      if( unsigned(lseq) != seqLen ) {
-	delete [] counts;
-	delete [] s;
-	PyErr_SetString(PyExc_ValueError, "wrong args: not aligned");
-	return 0;
-      }
+    rows[i].assign(s, s + l);
+    delete [] s;
+    if( l == 0 || l != rows[0].size() ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: not aligned") ;
+      return 0;
     }
-    
-    long* c = counts;
-    for(const byte* seq = s; lseq > 0; --lseq, ++seq) {
-      c[*seq] += 1;
-      c += 6;
+  }
+
+  vector<uint> joins;
+  if( pJoins && pJoins != Py_None ) {
+    if( ! readJoins(pJoins, n, joins) ) {
+      return 0;
     }
-    delete [] s;
   }
   
-  PyObject* retSeq = PyTuple_New(seqLen);
-  const long* c = counts;
-  for(uint i = 0; i < seqLen; ++i, c += 6) {
-    PyObject* t = PyList_New(6);
-    for(uint j = 0; j < 6; ++j) {
-      //PyList_SET_ITEM(t, j, PyLong_FromLong(c[j]));
-      PyList_SET_ITEM(t, j, PyInt_FromLong(c[j]));      
-    } 
-    PyTuple_SET_ITEM(retSeq, i, t);
+  MatchScoreValues<double> const matchScores(mScores);
+  if( ! matchScores.valid() ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: invalid scores") ;
+    return 0;
   }
 
-  delete [] counts;
-  return retSeq;
+  AlignmentRefiner refiner(rows, matchScores);
+  
+  Py_BEGIN_ALLOW_THREADS
+  for(uint r = 0; r < nRounds; ++r) {
+    bool const improved = refiner.leaveOneOut() > 0;
+    bool const split = joins.size() > 0 && refiner.bestSplit(joins, nThreads);
+    if( ! (improved || split) ) {
+      break;
+    }
+  }
+  Py_END_ALLOW_THREADS
+
+  PyObject* const ret = PyTuple_New(2);
+  PyTuple_SET_ITEM(ret, 0, rowsAsTuple(rows));
+  PyTuple_SET_ITEM(ret, 1, PyFloat_FromDouble(refiner.score()));
+  return ret;
 }
 
 template<typename T>
@@ -2093,7 +4119,7 @@ upgma(T* const ds, uint const n, const int* const weights)
   }
 
   {
-    int o = 0;
+    ulong o = 0;
     for(int k = n-1; k > 0; k -= 1) {
       di[n - 1 - k]= ds + o;
       o += k;
@@ -2121,12 +4147,17 @@ upgma(T* const ds, uint const n, const int* const weights)
   // minimum of column. Global minimum is the minimum of those.
   // We try to keep the column minimum current as much as possible
   // during the update.
+  // Scan by rows, sequential in memory. Matters when ds is a memory mapped
+  // file much larger than memory. Only this scan and the row updates of a
+  // merge are sequential; the column updates and rescans of stale column
+  // minima read one cell per row.
   vector< ColumnMin<T> > colMins(n-1);
-  for(uint mj = 0; mj < n-1; ++mj) {
-    ColumnMin<T>& c = colMins[mj];
-    for(uint mi = 0; mi < mj+1; ++mi) {
-      if( di[mi][mj-mi] < c.value ) {
-	c.value = di[mi][mj-mi];
+  for(uint mi = 0; mi < n-1; ++mi) {
+    const T* const d = di[mi];
+    for(uint mj = mi; mj < n-1; ++mj) {
+      ColumnMin<T>& c = colMins[mj];
+      if( d[mj-mi] < c.value ) {
+	c.value = d[mj-mi];
 	c.index = mi;
       }
     }
@@ -2274,11 +4305,255 @@ upgma(T* const ds, uint const n, const int* const weights)
   return ret;
 }
 
+// Read (optional) positive weights of n items. On error set a python error
+// and return false.
+
+static bool
+readWeights(PyObject* const pWeights, uint const n, vector<int>& weights)
+{
+  if( pWeights and pWeights != Py_None ) {
+    if( ! (PySequence_Check(pWeights) && uint(PySequence_Size(pWeights)) == n) ) {
+      PyErr_SetString(PyExc_ValueError, "Error with weights");
+      return false;
+    }
+    weights.resize(n);
+      
+    for(uint i = 0; i < n; ++i) {
+      PyObject* o = PySequence_Fast_GET_ITEM(pWeights, i);
+      weights[i] = PyInt_AsLong(o);
+	
+      if( weights[i] <= 0 ) {
+	PyErr_SetString(PyExc_ValueError, "Error with weights (should be positive)");
+	return false;
+      }
+    }
+  }
+  return true;
+}
+
+// UPGMA from a sparse set of distances, all those below a cutoff (as from
+// k-mer filtering). Missing distances count as 'cutoff'. Memory is linear in
+// the number of pairs, not in n^2.
+//
+// For clusters A and C, keep the (weighted) sum of their known distances and
+// the number of pairs in the sum. Their distance is the average with the
+// unknown pairs at the cutoff, which is exact when all pairs are known. The
+// merge order is driven by a heap with lazy deletion, entries mentioning a
+// merged cluster are simply skipped.
+//
+// Clusters still apart when no pairs remain are joined at the cutoff.
+
+class SparseUPGMA {
+public:
+  SparseUPGMA(uint const n, double const _cutoff, const int* const weights) :
+    nItems(n),
+    cutoff(_cutoff),
+    w(2*n-1, 1),
+    alive(2*n-1, true),
+    links(2*n-1)
+    {
+      if( weights ) {
+	std::copy(weights, weights+n, w.begin());
+      }
+    }
+
+  // Add distance between items i and j. False if a duplicate.
+  bool add(uint i, uint j, double d);
+
+  PyObject* cluster(void);
+  
+private:
+  struct Link {
+    // sum of known distances (times weights) and number of (weighted) pairs
+    double	sum;
+    double	nPairs;
+  };
+
+  struct Candidate {
+    double	d;
+    uint	a;
+    uint	b;
+    
+    bool operator <(Candidate const& c) const {
+      // reversed for a min heap, ties by lower indices first
+      return d > c.d || (d == c.d && (a > c.a || (a == c.a && b > c.b)));
+    }
+  };
+
+  double distance(uint const a, uint const b, Link const& l) const {
+    double const tot = double(w[a]) * w[b];
+    return (l.sum + (tot - l.nPairs) * cutoff) / tot;
+  }
+  
+  void merge(uint a, uint b, uint ab);
+  
+  uint const		nItems;
+  double const		cutoff;
+  
+  vector<long>		w;
+  vector<bool>		alive;
+  vector< std::unordered_map<uint, Link> > links;
+
+  std::priority_queue<Candidate>	candidates;
+};
+
+bool
+SparseUPGMA::add(uint const i, uint const j, double const d)
+{
+  if( d >= cutoff ) {
+    return true;
+  }
+  
+  double const np = double(w[i]) * w[j];
+  Link const l = {d * np, np};
+  if( ! links[i].insert(std::make_pair(j, l)).second ) {
+    return false;
+  }
+  links[j][i] = l;
+  
+  Candidate const c = {d, std::min(i,j), std::max(i,j)};
+  candidates.push(c);
+  return true;
+}
+
+void
+SparseUPGMA::merge(uint const a, uint const b, uint const ab)
+{
+  alive[a] = alive[b] = false;
+  w[ab] = w[a] + w[b];
+
+  auto& lab = links[ab];
+  for(uint const x : {a, b}) {
+    for(auto const& e : links[x]) {
+      uint const c = e.first;
+      if( c == a || c == b ) {
+	continue;
+      }
+      Link& l = lab[c];
+      l.sum += e.second.sum;
+      l.nPairs += e.second.nPairs;
+      links[c].erase(x);
+    }
+    // release memory
+    std::unordered_map<uint, Link>().swap(links[x]);
+  }
+  
+  for(auto const& e : lab) {
+    uint const c = e.first;
+    links[c][ab] = e.second;
+    Candidate const cd = {distance(ab, c, e.second), std::min(ab,c), std::max(ab,c)};
+    candidates.push(cd);
+  }
+}
+
+PyObject*
+SparseUPGMA::cluster(void)
+{
+  uint const n = nItems;
+  PyObject* ret = PyTuple_New(n-1);
+
+  uint ic = 0;
+  
+  while( ! candidates.empty() ) {
+    Candidate const c = candidates.top();
+    candidates.pop();
+    
+    if( ! (alive[c.a] && alive[c.b]) ) {
+      continue;
+    }
+    
+    PyObject* r = PyTuple_New(4);
+    PyTuple_SET_ITEM(r, 0, PyInt_FromLong(c.a));
+    PyTuple_SET_ITEM(r, 1, PyInt_FromLong(c.b));
+    PyTuple_SET_ITEM(r, 2, PyFloat_FromDouble(c.d));
+    PyTuple_SET_ITEM(r, 3, PyInt_FromLong(w[c.a] + w[c.b]));
+    PyTuple_SET_ITEM(ret, ic, r);
+
+    merge(c.a, c.b, n + ic);
+    ic += 1;
+  }
+
+  // Disconnected clusters, all at distance 'cutoff' from each other
+  int last = -1;
+  uint const nClusters = n + ic;
+  for(uint x = 0; x < nClusters; ++x) {
+    if( ! alive[x] ) {
+      continue;
+    }
+    if( last >= 0 ) {
+      PyObject* r = PyTuple_New(4);
+      PyTuple_SET_ITEM(r, 0, PyInt_FromLong(std::min(uint(last), x)));
+      PyTuple_SET_ITEM(r, 1, PyInt_FromLong(std::max(uint(last), x)));
+      PyTuple_SET_ITEM(r, 2, PyFloat_FromDouble(cutoff));
+      PyTuple_SET_ITEM(r, 3, PyInt_FromLong(w[last] + w[x]));
+      PyTuple_SET_ITEM(ret, ic, r);
+      
+      alive[last] = alive[x] = false;
+      uint const nw = n + ic;
+      w[nw] = w[last] + w[x];
+      alive[nw] = true;
+      ic += 1;
+      last = nw;
+    } else {
+      last = x;
+    }
+  }
+  assert( ic == n-1 );
+  
+  return ret;
+}
+
+// pairs: sequence of (i,j,distance) triples. 
+
+static PyObject*
+sparseUpgma(PyObject* const pPairs, uint const n, double const cutoff,
+	    PyObject* const pWeights)
+{
+  if( n < 2 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: need at least 2 items");
+    return 0;
+  }
+  
+  vector<int> weights;
+  if( ! readWeights(pWeights, n, weights) ) {
+    return 0;
+  }
+  
+  PyObject* const pairs = PySequence_Fast(pPairs, "wrong args: pairs not a sequence");
+  if( ! pairs ) {
+    return 0;
+  }
+  
+  SparseUPGMA up(n, cutoff, weights.empty() ? 0 : &weights[0]);
+  
+  Py_ssize_t const np = PySequence_Fast_GET_SIZE(pairs);
+  for(Py_ssize_t k = 0; k < np; ++k) {
+    PyObject* const p = PySequence_Fast_GET_ITEM(pairs, k);
+    long i, j;
+    double d;
+    if( ! (PyTuple_Check(p) && PyArg_ParseTuple(p, "lld", &i, &j, &d)) ||
+	! (0 <= i && i < long(n) && 0 <= j && j < long(n) && i != j && d >= 0) ) {
+      PyErr_Format(PyExc_ValueError, "wrong args: bad pair ([%ld])", long(k));
+      Py_DECREF(pairs);
+      return 0;
+    }
+    if( ! up.add(i, j, d) ) {
+      PyErr_Format(PyExc_ValueError, "wrong args: duplicate pair (%ld,%ld)", i, j);
+      Py_DECREF(pairs);
+      return 0;
+    }
+  }
+  Py_DECREF(pairs);
+
+  return up.cluster();
+}
+
 PyObject*
 UPGMA(PyObject*, PyObject* args, PyObject* kwds)
 {
   static const char *kwlist[] = {"distances", "seqs", "align", "report",
-				 "saveto", "reorder", "scores", "weights",
+				 "saveto", "reorder", "scores", "weights", "overwrite",
+				 "pairs", "n", "cutoff",
 				 static_cast<const char*>(0)};
   PyObject* dists = 0;
   PyObject* pseqs = 0;
@@ -2288,15 +4563,32 @@ UPGMA(PyObject*, PyObject* args, PyObject* kwds)
   PyObject* pReorder = 0;
   PyObject* mScores = 0;
   PyObject* pWeights = 0;
+  PyObject* pOverwrite = 0;
+  PyObject* pPairs = 0;
+  uint nItems = 0;
+  double cutoff = std::numeric_limits<double>::infinity();
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "|OOOiOOOO", const_cast<char**>(kwlist),
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "|OOOiOOOOOOId", const_cast<char**>(kwlist),
 				    &dists, &pseqs, &palign,
 				    &resultType, &saveDistancesTo, &pReorder, &mScores,
-				    &pWeights)) {
+				    &pWeights, &pOverwrite, &pPairs, &nItems, &cutoff)) {
     PyErr_SetString(PyExc_ValueError, "wrong args (8).") ;
     return 0;
   }
 
+  if( pPairs ) {
+    if( dists || pseqs ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: expecting either distances, sequences"
+		      " or pairs");
+      return 0;
+    }
+    if( ! (cutoff < std::numeric_limits<double>::infinity()) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: pairs require a cutoff");
+      return 0;
+    }
+    return sparseUpgma(pPairs, nItems, cutoff, pWeights);
+  }
+
   if( (!dists) == (!pseqs) ) {
     PyErr_SetString(PyExc_ValueError, "wrong args: expecting either distances or sequences");
     return 0;
@@ -2305,7 +4597,13 @@ UPGMA(PyObject*, PyObject* args, PyObject* kwds)
   float* ds = 0;
   uint n;
 
-  std::unique_ptr<float> dsReleaser;
+  std::unique_ptr<float[]> dsReleaser;
+
+  // float64 distances, clustered in double precision (in place with
+  // 'overwrite', else in a copy)
+  double* dsd = 0;
+  std::unique_ptr<double[]> dsdReleaser;
+  FloatBuffer buf;
   
   if( pseqs ) {
     if( ! (PyTuple_Check(pseqs) || PyList_Check(pseqs)) ) {
@@ -2360,7 +4658,43 @@ UPGMA(PyObject*, PyObject* args, PyObject* kwds)
 	Py_DECREF(ap);
       }
     }
+  } else if( ! (PyTuple_Check(dists) || PyList_Check(dists)) && PyObject_CheckBuffer(dists)
+	     && buf.acquire(dists, getValue<bool>(pOverwrite, false)) ) {
+    // float32/float64 array. Clustering overwrites the distances, so copy
+    // unless allowed to use the array itself.
+    ulong const nDists = buf.size();
+    n = static_cast<uint>(.5 + (sqrt(1+8*double(nDists))+1)/2);
+
+    if( nDists == 0 || ((ulong(n)*(n-1))/2 != nDists) ) {
+      PyErr_Format(PyExc_ValueError, "wrong args: incorrect dists (%u %lu %lu)",
+		   n, nDists, (ulong(n)*(n-1))/2);
+      return 0;
+    }
+
+    for(ulong i = 0; i < nDists; ++i) {
+      if( buf.value(i) < 0 ) {
+	PyErr_Format(PyExc_ValueError, "wrong args: some negative diststances ([%lu])", i) ;
+	return 0;
+      }
+    }
+    
+    if( getValue<bool>(pOverwrite, false) ) {
+      if( buf.isDouble() ) {
+	dsd = buf.doubles();
+      } else {
+	ds = buf.floats();
+      }
+    } else if( buf.isDouble() ) {
+      dsd = new double [nDists];           dsdReleaser.reset(dsd);
+      std::copy(buf.doubles(), buf.doubles() + nDists, dsd);
+    } else {
+      ds = new float [nDists];             dsReleaser.reset(ds);
+      std::copy(buf.floats(), buf.floats() + nDists, ds);
+    }
   } else {
+    // not a float array after all, read as a sequence
+    PyErr_Clear();
+    
     if( ! PySequence_Check(dists) ) {
       PyErr_SetString(PyExc_ValueError, "wrong args: not a list of distances ") ;
       return 0;
@@ -2402,30 +4736,14 @@ UPGMA(PyObject*, PyObject* args, PyObject* kwds)
     Py_XDECREF(rel);
   }
  
-  int* weights = 0;
-  if( pWeights and pWeights != Py_None ) {
-    if( ! (PySequence_Check(pWeights) && uint(PySequence_Size(pWeights)) == n) ) {
-      PyErr_SetString(PyExc_ValueError, "Error with weights");
-      return 0;
-    }
-    weights = new int[n];
-      
-    for(uint i = 0; i < n; ++i) {
-      PyObject* o = PySequence_Fast_GET_ITEM(pWeights, i);
-      weights[i] = PyInt_AsLong(o);
-	
-      if( weights[i] <= 0 ) {
-	PyErr_SetString(PyExc_ValueError, "Error with weights (should be positive)");
-	delete [] weights;
-	return 0;
-      }
-    }
+  vector<int> weights;
+  if( ! readWeights(pWeights, n, weights) ) {
+    return 0;
   }
+  const int* const w = weights.empty() ? 0 : &weights[0];
 
-  PyObject* ret = upgma<float>(ds, n, weights);
+  PyObject* ret = dsd ? upgma<double>(dsd, n, w) : upgma<float>(ds, n, w);
 
-  delete [] weights;
-  
   return ret;
 }
 
@@ -2434,26 +4752,50 @@ PyDoc_STRVAR(calign__doc__,
 
 PyDoc_STRVAR(upgma__doc__,
 	     "UPGMA tree from distances or sequences. Return a scipy compatible list." 
-	     " 'saveto' can be either an open file or an object supporting an append.");
+	     " 'saveto' can be either an open file or an object supporting an append."
+	     " Distances may be a float32/float64 array, which is used as working space"
+	     " (and destroyed) when 'overwrite' is true. Alternatively, for large n, give"
+	     " 'pairs', a sequence of (i,j,distance) of 'n' items, with all distances below"
+	     " 'cutoff'. Missing distances count as 'cutoff', and clusters which are"
+	     " not linked by any pair are joined at 'cutoff'.");
 
 static PyMethodDef calignMethods[] = {
   {"globalAlign",	(PyCFunction)globAlign, METH_VARARGS|METH_KEYWORDS,
    "Global alignment of two DNA sequences. Full Needleman-Wunch with a free flanking gaps option."},
   
-  // {"globalAffineAlign",	(PyCFunction)globAlignAffine, METH_VARARGS|METH_KEYWORDS,
-  //  ""},
+  {"globalAffineAlign",	(PyCFunction)globAlignAffine, METH_VARARGS|METH_KEYWORDS,
+   "Global alignment with affine gaps. 'gapExtend' overrides the extension penalty in 'scores'."},
   
   {"profileAlign",	(PyCFunction)alignToProfile, METH_VARARGS|METH_KEYWORDS,
-   ""},
+   "Align a sequence to a profile (per column counts or a Profile)."},
   {"prof2profAlign",	(PyCFunction)alignProfileToProfile, METH_VARARGS|METH_KEYWORDS,
-   ""},
+   "Align two profiles and return the merged profile, a Profile if either one is."},
+  {"progressiveAlign",	(PyCFunction)progressiveAlign, METH_VARARGS|METH_KEYWORDS,
+   "Multiple alignment of 'seqs' along a guide tree. 'joins' are pairs of clusters, as in"
+   " upgma output (sequences are clusters 0..n-1, join k creates cluster n+k). Independent"
+   " subtrees are aligned in parallel with 'threads'. Returns the aligned sequences and"
+   " their Profile."},
+  {"refineAlignment",	(PyCFunction)refineAlignment, METH_VARARGS|METH_KEYWORDS,
+   "Iteratively refine a multiple alignment, maximizing the sum of pairs score. Each round"
+   " realigns every sequence to the profile of the rest, and with guide tree 'joins' (as in"
+   " progressiveAlign) tries to realign the two parts of each tree split (using 'threads')."
+   " Stops after 'rounds' or when a round does not improve the score. Returns the refined"
+   " alignment and its score."},
   {"createProfile",	(PyCFunction)createProfile, METH_VARARGS|METH_KEYWORDS,
-   "Profile from alignment."},
+   "Profile from alignment. With 'native', return a Profile object instead of per"
+   " column lists of counts."},
   
   {"distances",		(PyCFunction)distMat, METH_VARARGS|METH_KEYWORDS,
-   "Distances for all 'n choose 2' pairs (via alignment)."},
+   "Distances for all 'n choose 2' pairs (via alignment). 'reorder' is either a"
+   " permutation (sequence k of seqs is number reorder[k]) or True, to order the"
+   " sequences internally so that alignments can reuse work done for earlier pairs."
+   " With 'out' (a float32/float64 array, possibly memory mapped) or 'dtype' (a new numpy"
+   " array) return an array instead of a tuple. 'progress' is called with the number of"
+   " rows done after each row, and stops the computation by returning False. 'start'"
+   " resumes filling 'out' from that row."},
   {"allpairs",		(PyCFunction)distPairs, METH_VARARGS|METH_KEYWORDS,
-   "Distances for all NxM pairs (via alignment)."},
+   "Distances for all NxM pairs (via alignment). With 'out' (a float32/float64 array) or"
+   " 'dtype' (a new numpy array) return an array instead of nested tuples."},
   
   {"upgma",		(PyCFunction)UPGMA, METH_VARARGS|METH_KEYWORDS,upgma__doc__},  
   {NULL, NULL, 0, NULL}        /* Sentinel */
@@ -2471,8 +4813,16 @@ setInt(PyObject* m, const char* const attr, int v)
 PyMODINIT_FUNC
 initcalign(void)
 {
+  if( PyType_Ready(&ProfileType) < 0 ) {
+    return;
+  }
+  
   PyObject* const m = Py_InitModule3("calign", calignMethods, calign__doc__);
 
+  PyObject* const profileType = reinterpret_cast<PyObject*>(&ProfileType);
+  Py_INCREF(profileType);
+  PyModule_AddObject(m, "Profile", profileType);
+
   setInt(m, "GAP", gap);
   setInt(m, "N", anynuc);
   setInt(m, "A", 0);
@@ -10,7 +10,12 @@
 #include <cassert>
 
 #include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
 #include <memory>
+#include <thread>
+#include <atomic>
 #include <unordered_map>
 using std::unordered_map;
 
@@ -113,7 +118,523 @@ popQelement(PyObject*, PyObject* args, PyObject* kwds)
   return popElement(q);
 }
 
-typedef unordered_map<ulong, vector<int> > mm;
+#include "readseq.h"
+
+// k-mer index of sequences. Nucleotides are packed 2 bits each (k <= 31),
+// and k-mers with an ambiguous base are skipped. All (k-mer, sequence) pairs
+// are kept in one postings array, sorted by k-mer and by sequence within a
+// k-mer. A dense directory on the leading nucleotides of the k-mer locates
+// the range of distinct k-mers to binary search; for small k the directory
+// covers the whole k-mer and there is nothing to search.
+
+static uint const maxKmer = 31;
+
+// Call f(key, run) for each unambiguous base of s (code <= 3), where key
+// packs the last k bases and run is the number of unambiguous bases ending
+// at the current one. As in the python lookup, the last k-mer of the
+// sequence is not included.
+
+template<typename F>
+static inline void
+forEachBase(const byte* const s, uint const len, uint const k, F const& f)
+{
+  ulong const mask = (1UL << 2*k) - 1;
+  ulong key = 0;
+  uint run = 0;
+  for(uint i = 0; i + 1 < len; ++i) {
+    byte const c = s[i];
+    if( c > 3 ) {
+      run = 0;
+      continue;
+    }
+    key = ((key << 2) | c) & mask;
+    run += 1;
+    f(key, run);
+  }
+}
+
+// Call f(key) for each k-mer of s without an ambiguous base.
+
+template<typename F>
+static inline void
+forEachKmer(const byte* const s, uint const len, uint const k, F const& f)
+{
+  forEachBase(s, len, k, [k, &f](ulong const key, uint const run) {
+      if( run >= k ) {
+	f(key);
+      }
+    });
+}
+
+// Order of k-mers when sampling, so that low complexity k-mers (say
+// poly-A) are not systematically picked.
+
+static inline ulong
+kmerHash(ulong x)
+{
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+  return x ^ (x >> 31);
+}
+
+// Minimum over a sliding window. On ties the leftmost element wins.
+
+class WindowMin {
+public:
+  struct Entry {
+    ulong	hash;
+    ulong	key;
+    uint	pos;
+  };
+
+  void clear(void) {
+    q.clear();
+  }
+
+  void push(ulong const hash, ulong const key, uint const pos) {
+    while( ! q.empty() && q.back().hash > hash ) {
+      q.pop_back();
+    }
+    Entry const e = {hash, key, pos};
+    q.push_back(e);
+  }
+
+  // drop entries before pos
+  void expire(uint const pos) {
+    while( q.front().pos < pos ) {
+      q.pop_front();
+    }
+  }
+
+  Entry const& front(void) const {
+    return q.front();
+  }
+  
+private:
+  std::deque<Entry>	q;
+};
+
+// Run f(t) for t = 0..nThreads-1, in parallel when more than one.
+
+template<typename F>
+static void
+runThreads(F const& f, uint const nThreads)
+{
+  if( nThreads <= 1 ) {
+    f(0);
+    return;
+  }
+  vector<std::thread> pool;
+  for(uint t = 0; t < nThreads; ++t) {
+    pool.push_back(std::thread(f, t));
+  }
+  for(auto& t : pool) {
+    t.join();
+  }
+}
+
+// Either all k-mers are indexed, or a sample taking about one k-mer in
+// 'window'. Minimizers pick the smallest k-mer in each window of consecutive
+// k-mers. Open syncmers pick a k-mer when its smallest s-mer is the first
+// one, with s = k - window + 1. Sequences are matched on the same sample,
+// and both schemes pick the same k-mers in shared stretches.
+
+enum Sampling {allKmers, minimizers, syncmers};
+
+// Sequences can be added and removed after the build. Removed sequences
+// are marked, and their postings skipped until the next compaction; postings
+// of added sequences are kept in a hash table on the side. Once either
+// grows past a quarter of the index, the two are merged into the sorted
+// postings. Sequence indices stay fixed, added sequences taking new ones.
+
+class KmerIndex {
+public:
+  KmerIndex(uint const _k, Sampling const _sampling = allKmers, uint const _window = 1) :
+    k(_k),
+    sampling(_window > 1 ? _sampling : allKmers),
+    window(_window),
+    nSeqs(0),
+    prefixLen(0),
+    nAdded(0),
+    nStale(0)
+    {}
+  
+  void build(vector< vector<byte> > const& seqs, bool removeSingles, uint nThreads);
+
+  // Add seqs, returns the index of the first.
+  uint add(vector< vector<byte> > const& seqs);
+
+  // Remove sequence i. false if not in index.
+  bool remove(uint i);
+  
+  // Call f(i) for each sequence i containing key (with repeats, once per
+  // occurrence).
+  template<typename F>
+  inline void forEachMatch(ulong key, F const& f) const;
+
+  // Call f(key) for each k-mer of s in the sample.
+  template<typename F>
+  void forEachKey(const byte* s, uint len, F const& f) const;
+  
+  uint const		k;
+  Sampling const	sampling;
+  uint const		window;
+  // number of indexed sequences, including removed ones
+  uint			nSeqs;
+
+private:
+  struct Pair {
+    ulong	key;
+    int		seq;
+  };
+
+  // Sequences containing key in the sorted postings, or 0.
+  inline const int* find(ulong key, uint& n) const;
+
+  void choosePrefix(ulong nKmers);
+  
+  // Fill index from pairs sorted by key.
+  void assemble(vector<Pair> const& pairs, bool removeSingles);
+
+  void compact(void);
+  
+  // number of leading nucleotides in directory
+  uint		prefixLen;
+  // distinct k-mers in range [directory[p], directory[p+1]) have prefix p
+  vector<uint>	directory;
+  vector<ulong>	keys;
+  // postings of keys[i] are in [offsets[i], offsets[i+1])
+  vector<uint>	offsets;
+  vector<int>	postings;
+
+  // removed[i] when sequence i was removed
+  vector<bool>	removed;
+  // postings of sequences added since last compaction
+  unordered_map<ulong, vector<int> >	added;
+  ulong		nAdded;
+  // sequences removed since last compaction
+  uint		nStale;
+};
+
+template<typename F>
+void
+KmerIndex::forEachKey(const byte* const s, uint const len, F const& f) const
+{
+  switch( sampling ) {
+    case allKmers:
+    {
+      forEachKmer(s, len, k, f);
+      break;
+    }
+    case minimizers:
+    {
+      // Windows are within stretches of unambiguous bases. The windows at the
+      // start of a stretch are partial, so short stretches are not skipped.
+      WindowMin m;
+      uint last = 0;
+      forEachBase(s, len, k, [&](ulong const key, uint const run) {
+	  if( run < k ) {
+	    if( run == 1 ) {
+	      m.clear();
+	    }
+	    return;
+	  }
+	  m.push(kmerHash(key), key, run);
+	  if( run >= k + window ) {
+	    m.expire(run - window + 1);
+	  }
+	  WindowMin::Entry const& e = m.front();
+	  if( run == k || e.pos != last ) {
+	    last = e.pos;
+	    f(e.key);
+	  }
+	});
+      break;
+    }
+    case syncmers:
+    {
+      uint const ls = k - window + 1;
+      ulong const smask = (1UL << 2*ls) - 1;
+      WindowMin m;
+      forEachBase(s, len, k, [&](ulong const key, uint const run) {
+	  if( run == 1 ) {
+	    m.clear();
+	  }
+	  if( run < ls ) {
+	    return;
+	  }
+	  m.push(kmerHash(key & smask), 0, run);
+	  if( run < k ) {
+	    return;
+	  }
+	  // the window s-mers of the k-mer end at run-window+1 ... run
+	  m.expire(run - window + 1);
+	  if( m.front().pos == run - window + 1 ) {
+	    f(key);
+	  }
+	});
+      break;
+    }
+  }
+}
+
+inline const int*
+KmerIndex::find(ulong const key, uint& n) const
+{
+  ulong const p = key >> 2*(k - prefixLen);
+  const ulong* const b = &keys[0] + directory[p];
+  const ulong* const e = &keys[0] + directory[p+1];
+  const ulong* const i = (prefixLen == k) ? b : std::lower_bound(b, e, key);
+  if( i == e || *i != key ) {
+    return 0;
+  }
+  uint const j = i - &keys[0];
+  n = offsets[j+1] - offsets[j];
+  return &postings[offsets[j]];
+}
+
+template<typename F>
+inline void
+KmerIndex::forEachMatch(ulong const key, F const& f) const
+{
+  uint n;
+  if( const int* m = find(key, n) ) {
+    for(const int* const e = m + n; m < e; ++m) {
+      if( ! removed[*m] ) {
+	f(*m);
+      }
+    }
+  }
+  if( nAdded ) {
+    auto const a = added.find(key);
+    if( a != added.end() ) {
+      for(auto const i : a->second) {
+	if( ! removed[i] ) {
+	  f(i);
+	}
+      }
+    }
+  }
+}
+
+// directory of about one entry per 4 k-mers, at most 4^12
+
+void
+KmerIndex::choosePrefix(ulong const nKmers)
+{
+  prefixLen = 1;
+  while( prefixLen < std::min(k, 12U) && (1UL << 2*(prefixLen+1)) <= nKmers/4 ) {
+    prefixLen += 1;
+  }
+  prefixLen = std::min(prefixLen, k);
+}
+
+void
+KmerIndex::assemble(vector<Pair> const& pairs, bool const removeSingles)
+{
+  uint const nBuckets = 1U << 2*prefixLen;
+  uint const shift = 2*(k - prefixLen);
+  
+  directory.assign(nBuckets+1, 0);
+  keys.clear();
+  offsets.clear();
+  postings.clear();
+  postings.reserve(pairs.size());
+
+  // next directory entry to set
+  uint p = 0;
+  for(ulong i = 0; i < pairs.size(); /**/) {
+    ulong j = i + 1;
+    while( j < pairs.size() && pairs[j].key == pairs[i].key ) {
+      ++j;
+    }
+    if( ! (removeSingles && j == i + 1) ) {
+      for(ulong const b = pairs[i].key >> shift; p <= b; ++p) {
+	directory[p] = keys.size();
+      }
+      keys.push_back(pairs[i].key);
+      offsets.push_back(postings.size());
+      for(ulong l = i; l < j; ++l) {
+	postings.push_back(pairs[l].seq);
+      }
+    }
+    i = j;
+  }
+  for(/**/; p <= nBuckets; ++p) {
+    directory[p] = keys.size();
+  }
+  offsets.push_back(postings.size());
+  
+  // keep find() away from an empty vector
+  keys.push_back(0);
+  postings.shrink_to_fit();
+}
+
+void
+KmerIndex::build(vector< vector<byte> > const& seqs, bool const removeSingles,
+		 uint const nThreads)
+{
+  nSeqs = seqs.size();
+  removed.assign(nSeqs, false);
+  added.clear();
+  nAdded = nStale = 0;
+  
+  ulong nKmers = 0;
+  for(auto const& s : seqs) {
+    nKmers += s.size();
+  }
+  nKmers /= window;
+
+  choosePrefix(nKmers);
+  uint const nBuckets = 1U << 2*prefixLen;
+  uint const shift = 2*(k - prefixLen);
+  
+  uint const nt = std::max(1U, std::min(nThreads, nSeqs));
+  
+  // Partition pairs by prefix, each thread taking a range of sequences.
+  // Thread t fills its part of each bucket, so that sequences stay in order.
+  vector< vector<ulong> > counts(nt, vector<ulong>(nBuckets+1, 0));
+  ulong const n = nSeqs;
+  auto const seqRange = [n, nt](uint const t) {
+    return std::make_pair((n * t) / nt, (n * (t+1)) / nt);
+  };
+  
+  auto const count = [&](uint const t) {
+    vector<ulong>& c = counts[t];
+    auto const r = seqRange(t);
+    for(uint ns = r.first; ns < r.second; ++ns) {
+      vector<byte> const& s = seqs[ns];
+      forEachKey(&s[0], s.size(), [&c, shift](ulong key) { c[key >> shift] += 1; });
+    }
+  };
+  runThreads(count, nt);
+
+  vector<ulong> bucketStart(nBuckets+1, 0);
+  {
+    ulong tot = 0;
+    for(uint p = 0; p < nBuckets; ++p) {
+      bucketStart[p] = tot;
+      for(uint t = 0; t < nt; ++t) {
+	ulong const c = counts[t][p];
+	counts[t][p] = tot;
+	tot += c;
+      }
+    }
+    bucketStart[nBuckets] = tot;
+  }
+  
+  vector<Pair> pairs(bucketStart[nBuckets]);
+  
+  auto const scatter = [&](uint const t) {
+    vector<ulong>& pos = counts[t];
+    auto const r = seqRange(t);
+    for(uint ns = r.first; ns < r.second; ++ns) {
+      vector<byte> const& s = seqs[ns];
+      forEachKey(&s[0], s.size(), [&pos, &pairs, shift, ns](ulong key) {
+	  Pair& x = pairs[pos[key >> shift]++];
+	  x.key = key;
+	  x.seq = ns;
+	});
+    }
+  };
+  runThreads(scatter, nt);
+  counts.clear();
+
+  // sort each bucket, stable to keep sequences in order
+  if( prefixLen < k ) {
+    std::atomic<uint> next(0);
+    auto const sortBuckets = [&](uint) {
+      for(uint p = next++; p < nBuckets; p = next++) {
+	std::stable_sort(pairs.begin() + bucketStart[p], pairs.begin() + bucketStart[p+1],
+			 [](Pair const& a, Pair const& b) { return a.key < b.key; });
+      }
+    };
+    runThreads(sortBuckets, nt);
+  }
+
+  assemble(pairs, removeSingles);
+}
+
+uint
+KmerIndex::add(vector< vector<byte> > const& seqs)
+{
+  uint const first = nSeqs;
+  for(auto const& s : seqs) {
+    int const i = nSeqs;
+    forEachKey(&s[0], s.size(), [this, i](ulong const key) {
+	added[key].push_back(i);
+	nAdded += 1;
+      });
+    nSeqs += 1;
+  }
+  removed.resize(nSeqs, false);
+  
+  if( 4 * nAdded > postings.size() ) {
+    compact();
+  }
+  return first;
+}
+
+bool
+KmerIndex::remove(uint const i)
+{
+  if( i >= nSeqs || removed[i] ) {
+    return false;
+  }
+  removed[i] = true;
+  nStale += 1;
+  if( 4 * ulong(nStale) > nSeqs ) {
+    compact();
+  }
+  return true;
+}
+
+// Merge added postings into the sorted ones, dropping removed sequences.
+// Added sequences have higher indices than all sequences in the sorted part,
+// so their postings go after those of the same key.
+
+void
+KmerIndex::compact(void)
+{
+  vector<Pair> extra;
+  extra.reserve(nAdded);
+  for(auto const& a : added) {
+    for(auto const i : a.second) {
+      if( ! removed[i] ) {
+	Pair const x = {a.first, i};
+	extra.push_back(x);
+      }
+    }
+  }
+  std::sort(extra.begin(), extra.end(), [](Pair const& a, Pair const& b) {
+      return a.key < b.key || (a.key == b.key && a.seq < b.seq);
+    });
+  added.clear();
+  nAdded = nStale = 0;
+  
+  vector<Pair> pairs;
+  pairs.reserve(postings.size() + extra.size());
+  auto x = extra.begin();
+  uint const nKeys = keys.size() - 1;
+  for(uint j = 0; j < nKeys; ++j) {
+    ulong const key = keys[j];
+    for(/**/; x != extra.end() && x->key < key; ++x) {
+      pairs.push_back(*x);
+    }
+    for(uint l = offsets[j]; l < offsets[j+1]; ++l) {
+      if( ! removed[postings[l]] ) {
+	Pair const y = {key, postings[l]};
+	pairs.push_back(y);
+      }
+    }
+  }
+  pairs.insert(pairs.end(), x, extra.end());
+  
+  choosePrefix(pairs.size());
+  // singles were removed at build (if asked), new ones are kept
+  assemble(pairs, false);
+}
+
 static const char* const capName = "MATCHTABLE";
 
 static inline int
@@ -135,23 +656,6 @@ ntoi(char c) {
   return 4;
 }
 
-static inline const vector<int>*
-findFragment(mm const& matches, char* s, uint const fragmentSize)
-{
-  ulong key = ntoi(s[0]);
-  for(uint l = 1; l < fragmentSize; ++l) {
-    key *= 5;
-    key += ntoi(s[l]);
-  }
-  auto const& m = matches.find(key);
-  if( m == matches.end() ) {
-    return 0;
-  } else {
-    return &m->second;
-  }
-}
-
-
 /**
      cans = [0]*len(seqs)
      for i in range(len(seq)-11) :
@@ -203,26 +707,36 @@ getCounts(PyObject*, PyObject* args, PyObject* kwds)
     }
   }
 
-  const mm* const pmatches = isNative ?
-    reinterpret_cast<mm*>(PyCapsule_GetPointer(matches, capName)) : 0;
+  const KmerIndex* const index = isNative ?
+    reinterpret_cast<KmerIndex*>(PyCapsule_GetPointer(matches, capName)) : 0;
+
+  if( index && size < int(index->nSeqs) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: result shorter than the table");
+    return 0;
+  }
   
   long* const cans = new long[size];
   std::fill(cans, cans+size, 0L);
 
-  uint const nFragment = fragmentSize;
+  if( isNative ) {
+    vector<byte> codes(lseq);
+    for(int i = 0; i < lseq; ++i) {
+      codes[i] = ntoi(seq[i]);
+    }
+    index->forEachKey(&codes[0], lseq, [index, cans, size](ulong const key) {
+	index->forEachMatch(key, [cans, size](int const m) {
+	    assert ( 0 <= m && m < size );
+	    cans[m] += 1;
+	  });
+      });
+  } else {
+    uint const nFragment = fragmentSize;
 
-  for(char* s = seq; s < seq+lseq-nFragment; ++s) {
-    // dirty, write EOS in string (temporarily)
-    char const c = s[nFragment];
-    s[nFragment] = 0;
+    for(char* s = seq; s < seq+lseq-nFragment; ++s) {
+      // dirty, write EOS in string (temporarily)
+      char const c = s[nFragment];
+      s[nFragment] = 0;
     
-    if( isNative ) {
-      if( const vector<int>* i = findFragment(*pmatches, s, nFragment) ) {
-	for(auto m = i->begin(); m != i->end(); ++m) {
-	  cans[*m] += 1;
-	}
-      }
-    } else {
       if( PyObject* const ms = PyDict_GetItemString(matches, s) ) {
 	// in large sizes there is a penalty for using more abstract types
 	// use explicit code for a list or tuple (instead of sequence),
@@ -253,8 +767,8 @@ getCounts(PyObject*, PyObject* args, PyObject* kwds)
 	  Py_DECREF(msf);
 	}
       }
+      s[nFragment] = c;
     }
-    s[nFragment] = c;
   }
 
   if( lseqs ) {
@@ -288,7 +802,170 @@ getCounts(PyObject*, PyObject* args, PyObject* kwds)
   return r;
 }
 
-#include "readseq.h"
+// Candidates sharing k-mers with each of many queries. Queries are split
+// among threads, each with its own counts buffer, cleared after each query
+// by going over the touched entries only. The top K candidates are picked by
+// partial selection. Sequences with an index below 'first' are ignored.
+
+struct Candidate {
+  int		index;
+  double	score;
+
+  // best first: higher score, then lower index
+  bool operator <(Candidate const& c) const {
+    return score > c.score || (score == c.score && index < c.index);
+  }
+};
+
+static void
+topCandidates(KmerIndex const&		index,
+	      vector<byte> const&	query,
+	      int const			exclude,
+	      int const			first,
+	      const int* const		lengths,
+	      uint const		topK,
+	      vector<uint>&		cans,
+	      vector<int>&		touched,
+	      vector<Candidate>&	top)
+{
+  index.forEachKey(&query[0], query.size(), [&](ulong const key) {
+      index.forEachMatch(key, [&](int const m) {
+	  if( cans[m]++ == 0 ) {
+	    touched.push_back(m);
+	  }
+	});
+    });
+
+  top.clear();
+  top.reserve(touched.size());
+  int const lq = query.size();
+  for(auto const i : touched) {
+    if( i != exclude && i >= first ) {
+      Candidate const c = {i, lengths ?
+			   double(cans[i]) / std::min(lengths[i], lq) : double(cans[i])};
+      top.push_back(c);
+    }
+    cans[i] = 0;
+  }
+  touched.clear();
+  
+  if( top.size() > topK ) {
+    std::nth_element(top.begin(), top.begin() + topK, top.end());
+    top.resize(topK);
+  }
+  std::sort(top.begin(), top.end());
+}
+
+PyObject*
+countsMany(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"queries", "matches", "topK", "seqslens", "exclude",
+				 "threads",
+				 static_cast<const char*>(0)};
+  PyObject* pQueries = 0;
+  PyObject* matches = 0;
+  uint topK = 10;
+  PyObject* lseqs = 0;
+  PyObject* pExclude = 0;
+  uint nThreads = 1;
+
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO|IOOI", const_cast<char**>(kwlist),
+				    &pQueries, &matches, &topK, &lseqs, &pExclude,
+				    &nThreads)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( ! (PySequence_Check(pQueries) && PyCapsule_IsValid(matches, capName)) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args type (expecting a native lookup table)");
+    return 0;
+  }
+  
+  KmerIndex const& index = *reinterpret_cast<KmerIndex*>(PyCapsule_GetPointer(matches, capName));
+  uint const size = index.nSeqs;
+  uint const nQueries = PySequence_Size(pQueries);
+
+  vector<int> lengths;
+  if( lseqs && lseqs != Py_None ) {
+    if( ! (PySequence_Check(lseqs) && uint(PySequence_Size(lseqs)) == size) ) {
+      PyErr_SetString(PyExc_ValueError, "incompatible args");
+      return 0;
+    }
+    lengths.resize(size);
+    for(uint k = 0; k < size; ++k) {
+      PyObject* const o = PySequence_GetItem(lseqs, k);
+      lengths[k] = PyInt_AsLong(o);
+      Py_DECREF(o);
+      if( lengths[k] <= 0 ) {
+	PyErr_SetString(PyExc_ValueError, "wrong args: bad lengths");
+	return 0;
+      }
+    }
+  }
+  
+  vector<int> exclude(nQueries, -1);
+  if( pExclude && pExclude != Py_None ) {
+    if( ! (PySequence_Check(pExclude) && uint(PySequence_Size(pExclude)) == nQueries) ) {
+      PyErr_SetString(PyExc_ValueError, "incompatible args");
+      return 0;
+    }
+    for(uint q = 0; q < nQueries; ++q) {
+      PyObject* const o = PySequence_GetItem(pExclude, q);
+      exclude[q] = PyInt_AsLong(o);
+      Py_DECREF(o);
+    }
+  }
+  
+  vector< vector<byte> > queries(nQueries);
+  for(uint q = 0; q < nQueries; ++q) {
+    PyObject* const o = PySequence_GetItem(pQueries, q);
+    char* s;
+    Py_ssize_t ls;
+    if( ! (o && PyString_Check(o)) ) {
+      Py_XDECREF(o);
+      PyErr_SetString(PyExc_ValueError, "wrong args: queries should be strings");
+      return 0;
+    }
+    PyString_AsStringAndSize(o, &s, &ls);
+    queries[q].resize(ls);
+    for(Py_ssize_t i = 0; i < ls; ++i) {
+      queries[q][i] = ntoi(s[i]);
+    }
+    Py_DECREF(o);
+  }
+
+  vector< vector<Candidate> > results(nQueries);
+  uint const nt = std::max(1U, std::min(nThreads, nQueries));
+  std::atomic<uint> next(0);
+  const int* const pl = lengths.empty() ? 0 : &lengths[0];
+  
+  auto const work = [&](uint) {
+    vector<uint> cans(size, 0);
+    vector<int> touched;
+    for(uint q = next++; q < nQueries; q = next++) {
+      topCandidates(index, queries[q], exclude[q], 0, pl, topK, cans, touched, results[q]);
+    }
+  };
+  
+  Py_BEGIN_ALLOW_THREADS
+  runThreads(work, nt);
+  Py_END_ALLOW_THREADS
+  
+  PyObject* const r = PyList_New(nQueries);
+  for(uint q = 0; q < nQueries; ++q) {
+    vector<Candidate> const& c = results[q];
+    PyObject* const l = PyList_New(c.size());
+    for(uint i = 0; i < c.size(); ++i) {
+      PyObject* t = PyTuple_New(2);
+      PyTuple_SET_ITEM(t, 0, PyInt_FromLong(c[i].index));
+      PyTuple_SET_ITEM(t, 1, lengths.empty() ? PyInt_FromLong(long(c[i].score)) :
+		       PyFloat_FromDouble(c[i].score));
+      PyList_SET_ITEM(l, i, t);
+    }
+    PyList_SET_ITEM(r, q, l);
+  }
+  return r;
+}
 
 /**
 def _buildLookup(seqs, asSet=False) :
@@ -315,42 +992,104 @@ matchesTableDestructor(PyObject* const o)
 {
   if( PyCapsule_IsValid(o, capName) ) {
     void* c = PyCapsule_GetPointer(o, capName);
-    delete reinterpret_cast<mm*>(c);
+    delete reinterpret_cast<KmerIndex*>(c);
   }
 }
 
 
 
+// Codes of each sequence in pSeqs. Sets a python error when false.
+
+static bool
+readSequences(PyObject* const pSeqs, vector< vector<byte> >& seqs)
+{
+  uint const nSeqs = PySequence_Size(pSeqs);
+  PyObject* const sqs = PySequence_Fast(pSeqs, "error");
+  seqs.resize(nSeqs);
+    
+  for(uint ns = 0; ns < nSeqs; ++ns) {
+    uint lseq = 0;
+    byte* s = readSequence(PySequence_Fast_GET_ITEM(sqs, ns), lseq, true);
+    if( ! s ) {
+      PyErr_SetString(PyExc_ValueError, "wrong sequences");
+      Py_DECREF(sqs);
+      return false;
+    }
+    seqs[ns].assign(s, s + lseq);
+    delete [] s;
+  }
+  Py_DECREF(sqs);
+  return true;
+}
+
 PyObject*
 buildLookup(PyObject*, PyObject* args, PyObject* kwds)
 {
   static const char *kwlist[] = {"seqs", "fragmentSize", "removeSingles", "native",
+				 "threads", "sampling", "window",
 				 static_cast<const char*>(0)};
   PyObject* pSeqs = 0;
   int fragmentSize = 11;
   PyObject* pRemoveSingles = 0;
   PyObject* pNative = 0;
+  uint nThreads = 1;
+  const char* pSampling = 0;
+  uint window = 10;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|iOO", const_cast<char**>(kwlist),
-				    &pSeqs, &fragmentSize, &pRemoveSingles, &pNative)) {
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|iOOIzI", const_cast<char**>(kwlist),
+				    &pSeqs, &fragmentSize, &pRemoveSingles, &pNative,
+				    &nThreads, &pSampling, &window)) {
     PyErr_SetString(PyExc_ValueError, "wrong args (1).") ;
     return 0;
   }
 
-  if( ! (PySequence_Check(pSeqs) && fragmentSize > 0 && fragmentSize <= 21) ) {
+  bool const removeSingles = (pRemoveSingles == 0 || PyObject_IsTrue(pRemoveSingles));
+  bool const native = (pNative != 0 && PyObject_IsTrue(pNative));
+
+  Sampling sampling = allKmers;
+  if( pSampling ) {
+    if( strcmp(pSampling, "minimizer") == 0 ) {
+      sampling = minimizers;
+    } else if( strcmp(pSampling, "syncmer") == 0 ) {
+      sampling = syncmers;
+    } else {
+      PyErr_SetString(PyExc_ValueError, "wrong args: sampling is one of minimizer/syncmer");
+      return 0;
+    }
+    if( ! native ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: sampling requires a native table");
+      return 0;
+    }
+    if( window < 1 || (sampling == syncmers && window > uint(fragmentSize)) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: bad window");
+      return 0;
+    }
+  }
+
+  int const maxSize = native ? maxKmer : 21;
+  if( ! (PySequence_Check(pSeqs) && fragmentSize > 0 && fragmentSize <= maxSize) ) {
     PyErr_SetString(PyExc_ValueError, "wrong args (2)");
     return 0;
   }
 
-  bool const removeSingles = (pRemoveSingles == 0 || PyObject_IsTrue(pRemoveSingles));
-  bool const native = (pNative != 0 && PyObject_IsTrue(pNative));
-
-  PyObject* d = !native ? PyDict_New() : 0;
+  if( native ) {
+    vector< vector<byte> > seqs;
+    if( ! readSequences(pSeqs, seqs) ) {
+      return 0;
+    }
+
+    KmerIndex* const index = new KmerIndex(fragmentSize, sampling, window);
+    Py_BEGIN_ALLOW_THREADS
+    index->build(seqs, removeSingles, nThreads);
+    Py_END_ALLOW_THREADS
+    
+    return PyCapsule_New(index, capName, matchesTableDestructor);
+  }
+  
+  PyObject* d = PyDict_New();
 
   // code duplication unless I figure how to be clever with a template
   if( fragmentSize > 13 ) {
-    assert( ! native ) ; // (FIXME)
-    
     typedef unsigned long long keytype;
 
     typedef unordered_map<keytype, vector<int> > mm;
@@ -436,8 +1175,8 @@ buildLookup(PyObject*, PyObject* args, PyObject* kwds)
   } else {
     assert(fragmentSize <= 13);
 
-    std::unique_ptr<mm> pmatches(new mm);
-    mm& matches = *pmatches.get();
+    typedef unordered_map<ulong, vector<int> > mm;
+    mm matches;
 
     typedef mm::value_type valtype;
   
@@ -457,9 +1196,7 @@ buildLookup(PyObject*, PyObject* args, PyObject* kwds)
       byte* s = readSequence(ps, lseq, true);
       if( ! s ) {
 	PyErr_SetString(PyExc_ValueError, "wrong sequences");
-	if( !native ) {
-	  Py_DECREF(d);
-	}
+	Py_DECREF(d);
 	return 0;
       }
       ulong key = s[0];
@@ -484,63 +1221,840 @@ buildLookup(PyObject*, PyObject* args, PyObject* kwds)
     }
     Py_DECREF(sqs);
 
-    if( native ) {
-      if( removeSingles ) {
-	for(auto i = matches.begin(); i != matches.end(); /** **/) {
-	  if( i->second.size() == 1 ) {
-	    i = matches.erase(i);
-	  } else {
-	    ++i;
-	  }
+    char key[fragmentSize+1];
+    key[fragmentSize] = 0;
+
+    for(auto i = matches.begin(); i != matches.end(); i = matches.erase(i) /** ++i **/) {
+      vector<int>& v = i->second;
+      if( removeSingles && v.size() == 1 ) {
+	continue;
+      }
+
+      PyObject* const ls = PyList_New(v.size());
+      if( ! ls ) {
+	return PyErr_NoMemory();
+      }
+      
+      for(uint k = 0; k < v.size(); ++k) {
+	PyList_SET_ITEM(ls, k, PyInt_FromLong(v[k]));
+      }
+      v.clear();
+      {
+	ulong k = i->first;
+	for(int l = fragmentSize-1; l >= 0; --l) {
+	  ulong const r = k / 5;
+	  key[l] = "AGCTN"[k - r*5];
+	  k = r;
 	}
       }
-      d = PyCapsule_New(pmatches.release(), capName, matchesTableDestructor);
+      PyDict_SetItemString(d, key, ls);
+      Py_DECREF(ls);  // gets me every time. new ref passed again are
+      // not borrowed and should be released
+      // matches.erase(i);
+    }
+  }
+  
+  return d;
+}
+
+
+PyObject*
+addSequences(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"matches", "seqs",
+				 static_cast<const char*>(0)};
+  PyObject* matches = 0;
+  PyObject* pSeqs = 0;
+
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO", const_cast<char**>(kwlist),
+				    &matches, &pSeqs)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+  
+  if( ! (PyCapsule_IsValid(matches, capName) && PySequence_Check(pSeqs)) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args type (expecting a native lookup table)");
+    return 0;
+  }
+  
+  vector< vector<byte> > seqs;
+  if( ! readSequences(pSeqs, seqs) ) {
+    return 0;
+  }
+  KmerIndex& index = *reinterpret_cast<KmerIndex*>(PyCapsule_GetPointer(matches, capName));
+  uint const first = index.add(seqs);
+
+  PyObject* const r = PyList_New(seqs.size());
+  for(uint i = 0; i < seqs.size(); ++i) {
+    PyList_SET_ITEM(r, i, PyInt_FromLong(first + i));
+  }
+  return r;
+}
+
+PyObject*
+removeSequences(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"matches", "indices",
+				 static_cast<const char*>(0)};
+  PyObject* matches = 0;
+  PyObject* pIndices = 0;
+
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO", const_cast<char**>(kwlist),
+				    &matches, &pIndices)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+  
+  if( ! (PyCapsule_IsValid(matches, capName) && PySequence_Check(pIndices)) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args type (expecting a native lookup table)");
+    return 0;
+  }
+  
+  KmerIndex& index = *reinterpret_cast<KmerIndex*>(PyCapsule_GetPointer(matches, capName));
+  uint const n = PySequence_Size(pIndices);
+  for(uint k = 0; k < n; ++k) {
+    PyObject* const o = PySequence_GetItem(pIndices, k);
+    long const i = PyInt_AsLong(o);
+    Py_DECREF(o);
+    if( ! (0 <= i && index.remove(i)) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: not a sequence in table");
+      return 0;
+    }
+  }
+  
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+// Global alignment of two sequences restricted to a band of diagonals, for
+// the distance between close sequences. Scores and tie breaking follow
+// calign.globalAlign with linear gaps, and so does the distance when the
+// optimal alignment is inside the band.
+
+struct AlignScores {
+  float	match;
+  float	misMatch;
+  float	gap;
+  bool	freeEndGaps;
+
+  inline float scoreMatching(byte const n1, byte const n2) const {
+    return ((n1 == n2 || n1 == anynuc || n2 == anynuc) ? match : misMatch);
+  }
+};
+
+class BandedAligner {
+public:
+  BandedAligner(AlignScores const& _scores) :
+    scores(_scores)
+    {}
+
+  // Distance (divergence, or with JC correction) between s1 and s2, using
+  // diagonals within w of those between the two ends.
+  double distance(vector<byte> const& s1, vector<byte> const& s2, uint w, bool correction);
+  
+private:
+  AlignScores const	scores;
+  // rows of band width, reused between calls
+  vector<float>		score;
+};
+
+double
+BandedAligner::distance(vector<byte> const& s1, vector<byte> const& s2, uint const w,
+			bool const correction)
+{
+  int const l1 = s1.size();
+  int const l2 = s2.size();
+  // diagonal (j - i) range
+  int const dlo = std::min(0, l2 - l1) - int(w);
+  int const dhi = std::max(0, l2 - l1) + int(w);
+  int const width = dhi - dlo + 1;
+  float const none = -std::numeric_limits<float>::infinity();
+  
+  score.assign(ulong(l1 + 1) * width, none);
+  // cell (i,j) at i*width + (j - i - dlo)
+  auto const at = [this, width, dlo](int const i, int const j) -> float& {
+    return score[ulong(i) * width + (j - i - dlo)];
+  };
+  auto const inBand = [dlo, dhi, l2](int const i, int const j) {
+    return 0 <= j && j <= l2 && dlo <= j - i && j - i <= dhi;
+  };
+  
+  float const g = scores.gap;
+  // free end gaps are free at both ends
+  float const g0 = scores.freeEndGaps ? 0 : g;
+  for(int j = 0; j <= std::min(l2, dhi); ++j) {
+    at(0, j) = j * g0;
+  }
+  for(int i = 1; i <= l1; ++i) {
+    int const jlo = std::max(0, i + dlo);
+    int const jhi = std::min(l2, i + dhi);
+    if( jlo == 0 ) {
+      at(i, 0) = i * g0;
+    }
+    byte const s1i = s1[i-1];
+    for(int j = std::max(1, jlo); j <= jhi; ++j) {
+      float const match = at(i-1, j-1) + scores.scoreMatching(s1i, s2[j-1]);
+      float const del = (j - i + 1 <= dhi) ? at(i-1, j) + g : none;
+      float const ins = (j - 1 - i >= dlo) ? at(i, j-1) + g : none;
+      at(i, j) = std::max(std::max(match, del), ins);
+    }
+  }
+
+  int iRow = l1;
+  int jCol = l2;
+  if( scores.freeEndGaps ) {
+    int jm = std::max(0, l1 + dlo);
+    float mxLastRow = at(l1, jm);
+    for(int j = jm + 1; j <= std::min(l2, l1 + dhi); ++j) {
+      if( at(l1, j) >= mxLastRow ) {
+	mxLastRow = at(l1, j);
+	jm = j;
+      }
+    }
+    int im = std::max(0, l2 - dhi);
+    float mxLastCol = at(im, l2);
+    for(int i = im + 1; i <= std::min(l1, l2 - dlo); ++i) {
+      if( at(i, l2) >= mxLastCol ) {
+	mxLastCol = at(i, l2);
+	im = i;
+      }
+    }
+    if( mxLastCol > mxLastRow ) {
+      iRow = im;
     } else {
-      char key[fragmentSize+1];
-      key[fragmentSize] = 0;
+      jCol = jm;
+    }
+  }
+  
+  int matches = 0, misMatches = 0, gaps = 0;
+  while( iRow > 0 && jCol > 0 ) {
+    float const cur = at(iRow, jCol);
+    byte const c1 = s1[iRow-1];
+    byte const c2 = s2[jCol-1];
+    
+    if( cur == at(iRow-1, jCol-1) + scores.scoreMatching(c1, c2) ) {
+      if( c1 == c2 || c1 == anynuc || c2 == anynuc ) {
+	matches += 1;
+      } else {
+	misMatches += 1;
+      }
+      iRow -= 1;
+      jCol -= 1;
+    } else {
+      gaps += 1;
+      if( inBand(iRow, jCol-1) && cur == at(iRow, jCol-1) + g ) {
+	jCol -= 1;
+      } else {
+	assert( inBand(iRow-1, jCol) && cur == at(iRow-1, jCol) + g );
+	iRow -= 1;
+      }
+    }
+  }
+  if( ! scores.freeEndGaps ) {
+    gaps += iRow + jCol;
+  }
 
-      for(auto i = matches.begin(); i != matches.end(); i = matches.erase(i) /** ++i **/) {
-	vector<int>& v = i->second;
-	if( removeSingles && v.size() == 1 ) {
-	  continue;
-	}
+  // as calign stats2distance
+  int const alLen = matches + misMatches + gaps;
+  double seqIdent = matches == 0 ? 0.0 : double(matches) / alLen;
+  if( ! correction ) {
+    return 1 - seqIdent;
+  }
+  if( seqIdent <= 1/4. ) {
+    if( alLen == 0 ) {
+      return 10;
+    }
+    seqIdent = (int(1+alLen/4.)/float(alLen) + .25)/2;
+  }
+  return fabs(-3./4 * log((seqIdent * 4 - 1)/3));
+}
 
-	PyObject* const ls = PyList_New(v.size());
-	if( ! ls ) {
-	  return PyErr_NoMemory();
-	}
-      
-	for(uint k = 0; k < v.size(); ++k) {
-	  PyList_SET_ITEM(ls, k, PyInt_FromLong(v[k]));
+// Greedy centroid clustering. Sequences are taken by decreasing abundance
+// (then length), and each joins the first centroid within the threshold,
+// else starts a new cluster. Centroids are tried in decreasing order of
+// shared k-mers, giving up after 'maxRejects' failed alignments.
+//
+// Sequences are processed in fixed size batches. The queries in a batch are
+// compared in parallel with the centroids from previous batches, then in
+// order with those from the batch itself. The outcome does not depend on the
+// number of threads.
+
+class GreedyClusters {
+public:
+  GreedyClusters(vector< vector<byte> > const&	_seqs,
+		 double const			_th,
+		 bool const			_correction,
+		 AlignScores const&		_scores,
+		 uint const			_maxRejects,
+		 uint const			fragmentSize) :
+    seqs(_seqs),
+    th(_th),
+    correction(_correction),
+    scores(_scores),
+    maxRejects(_maxRejects),
+    index(fragmentSize),
+    centroidOf(seqs.size(), -1),
+    distances(seqs.size(), 0.0)
+    {
+      index.build(vector< vector<byte> >(), false, 1);
+    }
+
+  void run(vector<uint> const& order, uint nThreads);
+
+  vector< vector<byte> > const&	seqs;
+  double const			th;
+  bool const			correction;
+  AlignScores const		scores;
+  uint const			maxRejects;
+
+private:
+  // per thread buffers
+  struct Workspace {
+    Workspace(AlignScores const& scores) :
+      aligner(scores)
+      {}
+    
+    vector<uint>	cans;
+    vector<int>		touched;
+    vector<Candidate>	top;
+    BandedAligner	aligner;
+  };
+  
+  // Centroid (index in centroids) for sequence, among centroids from
+  // 'first' on, or -1.
+  int search(uint seq, int first, Workspace& ws, double& d) const;
+
+  // index of centroids
+  KmerIndex		index;
+
+public:
+  // sequence of each centroid
+  vector<uint>		centroids;
+  // centroid sequence of each sequence
+  vector<int>		centroidOf;
+  vector<double>	distances;
+
+private:
+  vector<int>		cLengths;
+};
+
+int
+GreedyClusters::search(uint const seq, int const first, Workspace& ws, double& d) const
+{
+  vector<byte> const& s = seqs[seq];
+  ws.cans.resize(index.nSeqs, 0);
+  topCandidates(index, s, -1, first, &cLengths[0], maxRejects, ws.cans, ws.touched,
+		ws.top);
+  
+  uint const ls = s.size();
+  for(auto const& c : ws.top) {
+    vector<byte> const& cs = seqs[centroids[c.index]];
+    uint const w = uint(ceil(th * std::max(ls, uint(cs.size())))) + 1;
+    d = ws.aligner.distance(s, cs, w, correction);
+    if( d <= th ) {
+      return c.index;
+    }
+  }
+  return -1;
+}
+
+static uint const greedyBatchSize = 256;
+
+void
+GreedyClusters::run(vector<uint> const& order, uint const nThreads)
+{
+  vector<Workspace> ws(std::max(nThreads, 1U), Workspace(scores));
+  vector<int> found(greedyBatchSize);
+  vector<double> fdist(greedyBatchSize);
+  
+  for(uint b = 0; b < order.size(); b += greedyBatchSize) {
+    uint const e = std::min(uint(order.size()), b + greedyBatchSize);
+    int const nOld = centroids.size();
+    
+    if( nOld > 0 ) {
+      std::atomic<uint> next(b);
+      auto const work = [&](uint const t) {
+	for(uint q = next++; q < e; q = next++) {
+	  found[q - b] = search(order[q], 0, ws[t], fdist[q - b]);
 	}
-	v.clear();
-	{
-	  ulong k = i->first;
-	  for(int l = fragmentSize-1; l >= 0; --l) {
-	    ulong const r = k / 5;
-	    key[l] = "AGCTN"[k - r*5];
-	    k = r;
-	  }
+      };
+      runThreads(work, std::min(uint(ws.size()), e - b));
+    } else {
+      std::fill(found.begin(), found.end(), -1);
+    }
+
+    for(uint q = b; q < e; ++q) {
+      uint const seq = order[q];
+      int c = found[q - b];
+      double d = fdist[q - b];
+      if( c < 0 && int(centroids.size()) > nOld ) {
+	c = search(seq, nOld, ws[0], d);
+      }
+      if( c >= 0 ) {
+	centroidOf[seq] = centroids[c];
+	distances[seq] = d;
+      } else {
+	centroidOf[seq] = seq;
+	centroids.push_back(seq);
+	cLengths.push_back(seqs[seq].size());
+	index.add(vector< vector<byte> >(1, seqs[seq]));
+      }
+    }
+  }
+}
+
+PyObject*
+greedyCluster(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"seqs", "th", "correction", "scores", "threads",
+				 "abundances", "maxRejects", "fragmentSize",
+				 static_cast<const char*>(0)};
+  PyObject* pSeqs = 0;
+  double th = 0;
+  PyObject* pCorrection = 0;
+  PyObject* pScores = 0;
+  uint nThreads = 1;
+  PyObject* pAbundances = 0;
+  uint maxRejects = 20;
+  int fragmentSize = 11;
+
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "Od|OOIOIi", const_cast<char**>(kwlist),
+				    &pSeqs, &th, &pCorrection, &pScores, &nThreads,
+				    &pAbundances, &maxRejects, &fragmentSize)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( ! (PySequence_Check(pSeqs) && th >= 0 && 0 < fragmentSize
+	 && fragmentSize <= int(maxKmer) && maxRejects > 0) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args");
+    return 0;
+  }
+  bool const correction = pCorrection && PyObject_IsTrue(pCorrection);
+  
+  // match mismatch gap gape freeEnds, as align.MatchScores
+  AlignScores scores = {10, -5, -6, true};
+  if( pScores && pScores != Py_None ) {
+    if( ! (PySequence_Check(pScores) && PySequence_Size(pScores) == 5) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: invalid scores");
+      return 0;
+    }
+    PyObject* const sc = PySequence_Fast(pScores, "error");
+    PyObject* const* const v = PySequence_Fast_ITEMS(sc);
+    scores.match = PyFloat_AsDouble(v[0]);
+    scores.misMatch = PyFloat_AsDouble(v[1]);
+    scores.gap = PyFloat_AsDouble(v[2]);
+    bool const linear = (v[3] == Py_None || PyFloat_AsDouble(v[3]) == scores.gap);
+    scores.freeEndGaps = PyObject_IsTrue(v[4]);
+    Py_DECREF(sc);
+    if( PyErr_Occurred() ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: invalid scores");
+      return 0;
+    }
+    if( ! linear ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: only linear gap scores supported");
+      return 0;
+    }
+  }
+  
+  vector< vector<byte> > seqs;
+  if( ! readSequences(pSeqs, seqs) ) {
+    return 0;
+  }
+  uint const nSeqs = seqs.size();
+  
+  vector<double> abundances(nSeqs, 1);
+  if( pAbundances && pAbundances != Py_None ) {
+    if( ! (PySequence_Check(pAbundances) && uint(PySequence_Size(pAbundances)) == nSeqs) ) {
+      PyErr_SetString(PyExc_ValueError, "incompatible args");
+      return 0;
+    }
+    for(uint k = 0; k < nSeqs; ++k) {
+      PyObject* const o = PySequence_GetItem(pAbundances, k);
+      abundances[k] = PyFloat_AsDouble(o);
+      Py_DECREF(o);
+    }
+    if( PyErr_Occurred() ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: invalid abundances");
+      return 0;
+    }
+  }
+
+  vector<uint> order(nSeqs);
+  for(uint k = 0; k < nSeqs; ++k) {
+    order[k] = k;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](uint const i, uint const j) {
+      return abundances[i] > abundances[j] ||
+	(abundances[i] == abundances[j] && seqs[i].size() > seqs[j].size());
+    });
+  
+  GreedyClusters clusters(seqs, th, correction, scores, maxRejects, fragmentSize);
+  Py_BEGIN_ALLOW_THREADS
+  clusters.run(order, nThreads);
+  Py_END_ALLOW_THREADS
+
+  PyObject* const pc = PyList_New(nSeqs);
+  PyObject* const pd = PyList_New(nSeqs);
+  for(uint k = 0; k < nSeqs; ++k) {
+    PyList_SET_ITEM(pc, k, PyInt_FromLong(clusters.centroidOf[k]));
+    PyList_SET_ITEM(pd, k, PyFloat_FromDouble(clusters.distances[k]));
+  }
+  PyObject* const r = PyTuple_New(2);
+  PyTuple_SET_ITEM(r, 0, pc);
+  PyTuple_SET_ITEM(r, 1, pd);
+  return r;
+}
+
+// Dereplication. Identical sequences are found by sorting on (length, hash
+// of the 2-bit packed sequence). Then, among the distinct sequences, those
+// that are a prefix (or suffix) of another are merged into the most
+// abundant group extending them. In lexicographic order the sequences
+// starting with s directly follow s, so the prefix relation forms a forest
+// found with one pass and a stack; suffixes are done the same way on the
+// reversed sequences. A merged group is represented by its most abundant
+// member, not necessarily by the sequence containing the others.
+
+static ulong
+packedHash(vector<byte> const& s)
+{
+  ulong h = s.size();
+  ulong word = 0;
+  for(uint i = 0; i < s.size(); ++i) {
+    byte const c = s[i];
+    word = (word << 2) | (c & 3);
+    if( c > 3 ) {
+      // ambiguous, not representable in 2 bits
+      h ^= kmerHash(~ulong(i));
+    }
+    if( (i & 31) == 31 ) {
+      h = kmerHash(h ^ word);
+      word = 0;
+    }
+  }
+  return kmerHash(h ^ word);
+}
+
+class Dereplicator {
+public:
+  Dereplicator(vector< vector<byte> > const& _seqs, vector<double> const& abundances);
+
+  // Merge sequences contained as prefix (or as suffix) into others.
+  void mergeContained(bool suffix);
+  
+  // Groups of sequences, representative first, in decreasing abundance.
+  void groups(vector< vector<uint> >& grps, vector<double>& abundance) const;
+  
+private:
+  vector< vector<byte> > const&		seqs;
+  
+  // distinct sequences: first occurrence, abundance (own and with all merged
+  // into it), number of ambiguous bases and the one it was merged into
+  // (itself if none)
+  vector<uint>		first;
+  vector<double>	own;
+  vector<double>	total;
+  vector<uint>		nAmbiguous;
+  vector<uint>		parent;
+  // distinct sequence of each sequence
+  vector<uint>		uniqueOf;
+
+  uint root(uint u) const {
+    while( parent[u] != u ) {
+      u = parent[u];
+    }
+    return u;
+  }
+
+  // u better than v as the sequence to merge into
+  bool better(uint const u, uint const v) const {
+    return total[u] > total[v] || (total[u] == total[v] && first[u] < first[v]);
+  }
+
+  // u better than v as the representative of their group: more abundant,
+  // then less ambiguous
+  bool betterRep(uint const u, uint const v) const {
+    return own[u] > own[v] ||
+      (own[u] == own[v] && (nAmbiguous[u] < nAmbiguous[v] ||
+			    (nAmbiguous[u] == nAmbiguous[v] && first[u] < first[v])));
+  }
+};
+
+Dereplicator::Dereplicator(vector< vector<byte> > const&	_seqs,
+			   vector<double> const&		abundances) :
+  seqs(_seqs),
+  uniqueOf(seqs.size())
+{
+  uint const n = seqs.size();
+  struct Key {
+    ulong	hash;
+    uint	len;
+    uint	i;
+
+    bool operator <(Key const& k) const {
+      return len < k.len || (len == k.len && (hash < k.hash || (hash == k.hash && i < k.i)));
+    }
+    bool same(Key const& k) const {
+      return len == k.len && hash == k.hash;
+    }
+  };
+  vector<Key> order(n);
+  for(uint i = 0; i < n; ++i) {
+    Key const k = {packedHash(seqs[i]), uint(seqs[i].size()), i};
+    order[i] = k;
+  }
+  std::sort(order.begin(), order.end());
+
+  for(uint b = 0; b < n; /**/) {
+    uint e = b + 1;
+    while( e < n && order[e].same(order[b]) ) {
+      ++e;
+    }
+    // distinct sequences among a run of equal hashes (almost always one)
+    uint const u0 = first.size();
+    for(uint k = b; k < e; ++k) {
+      uint const i = order[k].i;
+      uint u = u0;
+      for(/**/; u < first.size(); ++u) {
+	if( seqs[first[u]] == seqs[i] ) {
+	  break;
 	}
-	PyDict_SetItemString(d, key, ls);
-	Py_DECREF(ls);  // gets me every time. new ref passed again are
-	// not borrowed and should be released
-	// matches.erase(i);
       }
+      if( u == first.size() ) {
+	first.push_back(i);
+	total.push_back(0);
+	nAmbiguous.push_back(std::count_if(seqs[i].begin(), seqs[i].end(),
+					   [](byte const c) { return c > 3; }));
+	parent.push_back(u);
+      }
+      uniqueOf[i] = u;
+      total[u] += abundances[i];
+    }
+    b = e;
+  }
+  own = total;
+}
+
+void
+Dereplicator::mergeContained(bool const suffix)
+{
+  // current roots
+  vector<uint> roots;
+  for(uint u = 0; u < first.size(); ++u) {
+    if( parent[u] == u ) {
+      roots.push_back(u);
     }
   }
   
-  return d;
+  vector< vector<byte> > rev;
+  if( suffix ) {
+    rev.resize(first.size());
+    for(auto const u : roots) {
+      vector<byte> const& s = seqs[first[u]];
+      rev[u].assign(s.rbegin(), s.rend());
+    }
+  }
+  auto const str = [&](uint const u) -> vector<byte> const& {
+    return suffix ? rev[u] : seqs[first[u]];
+  };
+  
+  std::sort(roots.begin(), roots.end(), [&](uint const u, uint const v) {
+      return str(u) < str(v);
+    });
+
+  // Stack of open prefixes, each with the best sequence extending it (so far).
+  // Nodes close children first, and a node merged into a leaf adds its total
+  // to it at once, so candidates are compared by the totals of their groups,
+  // including the (internal) sequences already merged into them.
+  struct Open {
+    uint	u;
+    int		best;
+  };
+  vector<Open> stack;
+  
+  auto const close = [&](void) {
+    Open const o = stack.back();
+    stack.pop_back();
+    if( o.best >= 0 ) {
+      // contained in a longer sequence
+      parent[o.u] = o.best;
+      total[o.best] += total[o.u];
+    }
+    if( ! stack.empty() ) {
+      // a leaf is its own best, otherwise pass up the best below
+      int const b = o.best >= 0 ? o.best : o.u;
+      int& pb = stack.back().best;
+      if( pb < 0 || better(b, pb) ) {
+	pb = b;
+      }
+    }
+  };
+  
+  for(auto const u : roots) {
+    vector<byte> const& s = str(u);
+    while( ! stack.empty() ) {
+      vector<byte> const& p = str(stack.back().u);
+      if( p.size() < s.size() && std::equal(p.begin(), p.end(), s.begin()) ) {
+	break;
+      }
+      close();
+    }
+    Open const o = {u, -1};
+    stack.push_back(o);
+  }
+  while( ! stack.empty() ) {
+    close();
+  }
+}
+
+void
+Dereplicator::groups(vector< vector<uint> >& grps, vector<double>& abundance) const
+{
+  uint const nu = first.size();
+  vector<int> grpOf(nu, -1);
+  // roots, and the representative of each
+  vector<uint> roots;
+  vector<uint> repOf(nu);
+  for(uint u = 0; u < nu; ++u) {
+    if( parent[u] == u ) {
+      roots.push_back(u);
+      repOf[u] = u;
+    }
+  }
+  for(uint u = 0; u < nu; ++u) {
+    uint const r = root(u);
+    if( betterRep(u, repOf[r]) ) {
+      repOf[r] = u;
+    }
+  }
+  std::sort(roots.begin(), roots.end(), [&](uint const u, uint const v) {
+      return total[u] > total[v] ||
+	(total[u] == total[v] && first[repOf[u]] < first[repOf[v]]);
+    });
+  
+  grps.assign(roots.size(), vector<uint>());
+  abundance.resize(roots.size());
+  for(uint g = 0; g < roots.size(); ++g) {
+    grpOf[roots[g]] = g;
+    abundance[g] = total[roots[g]];
+    grps[g].push_back(first[repOf[roots[g]]]);
+  }
+  for(uint i = 0; i < seqs.size(); ++i) {
+    uint const u = uniqueOf[i];
+    uint const r = root(u);
+    if( i != first[repOf[r]] ) {
+      grps[grpOf[r]].push_back(i);
+    }
+  }
 }
 
+PyObject*
+dereplicate(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"seqs", "containment", "abundances",
+				 static_cast<const char*>(0)};
+  PyObject* pSeqs = 0;
+  PyObject* pContainment = 0;
+  PyObject* pAbundances = 0;
+
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|OO", const_cast<char**>(kwlist),
+				    &pSeqs, &pContainment, &pAbundances)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( ! PySequence_Check(pSeqs) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args");
+    return 0;
+  }
+  bool const containment = pContainment == 0 || PyObject_IsTrue(pContainment);
+  
+  vector< vector<byte> > seqs;
+  if( ! readSequences(pSeqs, seqs) ) {
+    return 0;
+  }
+  uint const nSeqs = seqs.size();
+  
+  vector<double> abundances(nSeqs, 1);
+  if( pAbundances && pAbundances != Py_None ) {
+    if( ! (PySequence_Check(pAbundances) && uint(PySequence_Size(pAbundances)) == nSeqs) ) {
+      PyErr_SetString(PyExc_ValueError, "incompatible args");
+      return 0;
+    }
+    for(uint k = 0; k < nSeqs; ++k) {
+      PyObject* const o = PySequence_GetItem(pAbundances, k);
+      abundances[k] = PyFloat_AsDouble(o);
+      Py_DECREF(o);
+    }
+    if( PyErr_Occurred() ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: invalid abundances");
+      return 0;
+    }
+  }
+
+  vector< vector<uint> > grps;
+  vector<double> abundance;
+  Py_BEGIN_ALLOW_THREADS
+  Dereplicator d(seqs, abundances);
+  if( containment ) {
+    d.mergeContained(false);
+    d.mergeContained(true);
+  }
+  d.groups(grps, abundance);
+  Py_END_ALLOW_THREADS
+  
+  PyObject* const r = PyList_New(grps.size());
+  for(uint g = 0; g < grps.size(); ++g) {
+    PyObject* const m = PyList_New(grps[g].size());
+    for(uint k = 0; k < grps[g].size(); ++k) {
+      PyList_SET_ITEM(m, k, PyInt_FromLong(grps[g][k]));
+    }
+    PyObject* const t = PyTuple_New(2);
+    PyTuple_SET_ITEM(t, 0, m);
+    PyTuple_SET_ITEM(t, 1, PyFloat_FromDouble(abundance[g]));
+    PyList_SET_ITEM(r, g, t);
+  }
+  return r;
+}
 
 static PyMethodDef clustMethods[] = {
   {"popq",		(PyCFunction)popQelement, METH_VARARGS|METH_KEYWORDS,
    "Pop top element from the (encapsulated) priority queue returned from 'counts'."},
   {"counts",		(PyCFunction)getCounts, METH_VARARGS|METH_KEYWORDS,
-   ""},
+   "Count the k-mers 'seq' shares with each sequence in 'matches'. 'result' is a list"
+   " with an entry per table sequence (or their number, for a queue). A native table"
+   " grows with addSequences, and 'result' (and 'seqslens') must grow with it."},
+  {"countsMany",	(PyCFunction)countsMany, METH_VARARGS|METH_KEYWORDS,
+   "For each query, the 'topK' sequences of a native lookup table sharing the most k-mers"
+   " with it, as a list of (index, count) pairs, best first. With 'seqslens' the count is"
+   " relative to the shorter of the two lengths. 'exclude' gives one index to ignore per"
+   " query (-1 for none). Queries are processed in parallel with 'threads'."},
   {"lookupTable",	(PyCFunction)buildLookup, METH_VARARGS|METH_KEYWORDS,
-   ""},
+   "Table of sequences containing each k-mer ('fragmentSize'). A dictionary, or with"
+   " 'native' an opaque index for 'counts' (k up to 31, k-mers with ambiguous bases"
+   " skipped, built with 'threads'). A native index may keep only a sample of about one"
+   " k-mer in 'window', by 'sampling' either 'minimizer' or 'syncmer'; queries are then"
+   " matched on their own sample."},
+  {"addSequences",	(PyCFunction)addSequences, METH_VARARGS|METH_KEYWORDS,
+   "Add 'seqs' to a native lookup table, returns their indices (following the existing"
+   " ones)."},
+  {"dereplicate",	(PyCFunction)dereplicate, METH_VARARGS|METH_KEYWORDS,
+   "Groups of identical sequences in 'seqs'. With 'containment' (the default), a"
+   " sequence which is a prefix or a suffix of others joins the most abundant group"
+   " (total abundance) among those containing it. Returns a list of (members, abundance), by decreasing abundance,"
+   " the representative (the most abundant member, the least ambiguous on ties) first in"
+   " members. 'abundances' gives the count of each sequence"
+   " (default 1)."},
+  {"greedyCluster",	(PyCFunction)greedyCluster, METH_VARARGS|METH_KEYWORDS,
+   "Greedy centroid clustering of 'seqs' at distance 'th' (divergence, or JC distance"
+   " with 'correction'), with alignment 'scores' (linear gaps only). Sequences are taken by"
+   " decreasing 'abundances' and length. Each joins the first centroid within 'th' out of"
+   " those sharing the most k-mers ('fragmentSize'), giving up after 'maxRejects' failures."
+   " Returns the centroid of each sequence and the distance to it. Alignments are banded"
+   " and run in parallel with 'threads'; the result does not depend on their number."},
+  {"removeSequences",	(PyCFunction)removeSequences, METH_VARARGS|METH_KEYWORDS,
+   "Remove sequences ('indices') from a native lookup table. Other indices are unchanged."
+   " Note that k-mers dropped as singles when building the table are not restored."},
   {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
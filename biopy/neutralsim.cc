@@ -9,66 +9,98 @@
 #undef NDEBUG
 #include <cassert>
 
+#include <cmath>
+#include <cstdint>
 #include <random>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include <vector>
+#include <unordered_map>
+using std::vector;
 
 struct PatchTrace {
-  PatchTrace(double t, uint pl, uint pt, uint s, PatchTrace* prev);
+  // Traces are referred to by their index in a TracePool
+  typedef uint Index;
+  static Index const none = ~0U;
   
   double pTime;
   uint  fromPlot : 16;
   uint  fromPatch : 16;
   uint	speciesIndex;
-  PatchTrace*	prev;
-  int	refCount;
-  PyObject* asp;
-  
-  PyObject* asPyObject(void);
+  Index	prev;
 };
 
+PatchTrace::Index const PatchTrace::none;
 
-PatchTrace::PatchTrace(double t, uint pl, uint pt, uint s, PatchTrace* _prev) :
-  pTime(t),
-  fromPlot(pl),
-  fromPatch(pt),
-  speciesIndex(s),
-  prev(_prev),
-  refCount(1),
-  asp(0)
-{}
+// Storage of traces. Traces are only added, and a trace is always added after
+// its ancestor. Traces not reachable from the current ones are dropped by
+// compact(), which keeps the order (a generational compaction).
 
-PyObject*
-PatchTrace::asPyObject(void)
-{
-  if( asp ) {
-    Py_INCREF(asp);
-    return asp;
-  }
-  asp = PyTuple_New(4);
-  PyTuple_SET_ITEM(asp, 0, PyFloat_FromDouble(pTime));
-  PyObject* u2 = PyTuple_New(2);
-  PyTuple_SET_ITEM(u2, 0, PyInt_FromLong(fromPlot));
-  PyTuple_SET_ITEM(u2, 1, PyInt_FromLong(fromPatch));
-  PyTuple_SET_ITEM(asp, 1, u2);
-  PyTuple_SET_ITEM(asp, 2, PyInt_FromLong(speciesIndex));
-  PyObject* p;
-  if( prev ) {
-    p = prev->asPyObject();
-  } else {
-    Py_INCREF(Py_None);
-    p = Py_None;
+class TracePool {
+public:
+  typedef PatchTrace::Index Index;
+  
+  Index add(double t, uint pl, uint pt, uint s, Index prev) {
+    PatchTrace const x = {t, pl, pt, s, prev};
+    nodes.push_back(x);
+    return nodes.size() - 1;
   }
-  PyTuple_SET_ITEM(asp, 3, p);
-  return asp;
-}
 
-struct Patch {
-  uint	speciesIndex;
+  PatchTrace& operator[](Index const i) { return nodes[i]; }
+  PatchTrace const& operator[](Index const i) const { return nodes[i]; }
+
+  uint size(void) const { return nodes.size(); }
+  
+  // Keep the first trace and those reachable from 'roots', which are updated
+  // to the new indices.
+  void compact(vector<Index>& roots);
+
+private:
+  vector<PatchTrace> nodes;
+  vector<Index>	newIndex;
 };
+
+void
+TracePool::compact(vector<Index>& roots)
+{
+  newIndex.assign(nodes.size(), PatchTrace::none);
+  newIndex[0] = 0;
+  for(auto const r : roots) {
+    for(Index i = r; i != PatchTrace::none && newIndex[i] == PatchTrace::none;
+	i = nodes[i].prev) {
+      newIndex[i] = 0;
+    }
+  }
+
+  // ancestors come first, so are already moved
+  Index n = 0;
+  for(Index i = 0; i < nodes.size(); ++i) {
+    if( newIndex[i] != PatchTrace::none ) {
+      PatchTrace& x = nodes[i];
+      if( x.prev != PatchTrace::none ) {
+	x.prev = newIndex[x.prev];
+      }
+      newIndex[i] = n;
+      nodes[n] = x;
+      n += 1;
+    }
+  }
+  nodes.resize(n);
   
+  for(auto& r : roots) {
+    r = newIndex[r];
+  }
+}
+
+// Species of all individuals, plot after plot, in one array. Species
+// abundances in each plot are kept up to date as species are set.
+
 class MetaCommunity {
 public:
   MetaCommunity(uint nPlots, uint plotSize, double timeStamp = 0);
-  ~MetaCommunity();
+  ~MetaCommunity() {}
 
   uint const nPlots;
   uint const plotSize;
@@ -77,17 +109,33 @@ public:
   void setTime(double t) { timeStamp = t; }
   unsigned long nIndividuals(void) const { return nPlots * plotSize; }
 
-  Patch& get(uint np, uint ni) { return community[np][ni]; }
-  Patch const& get(uint np, uint ni) const { return community[np][ni]; }
+  uint species(uint np, uint ni) const { return community[np * plotSize + ni]; }
 
+  // nIndividuals() species, plot after plot
+  const uint* speciesArray(void) const { return &community[0]; }
+
+  // species -> number of individuals in plot np
+  typedef std::unordered_map<uint,uint> Abundances;
+  Abundances const& abundances(uint np) const { return abundance[np]; }
+  
   PyObject* asPyObject(void) const;
 
   void setSpecies(uint np, uint ni, uint s);
 
+  // Set individuals 'nis' of plot np to 'species', updating the abundances
+  // once for each species with a net change.
+  void setSpecies(uint np, vector<uint> const& nis, vector<uint> const& species);
+
+  // Largest species id ever used. New species take ids above it, so ids of
+  // extinct species are never reused.
   uint getLastSpecies(void) const { return lastSpecies; }
+  void setLastSpecies(uint s) { lastSpecies = std::max(s, lastSpecies); }
   
 private:
-  Patch** community;
+  vector<uint>	community;
+  vector<Abundances> abundance;
+  // (species, +-1) work space of setSpecies
+  vector< std::pair<uint,int> > deltas;
   double  timeStamp;
   uint    lastSpecies;
 };
@@ -95,36 +143,72 @@ private:
 MetaCommunity::MetaCommunity(uint _nPlots, uint _plotSize, double _timeStamp) :
   nPlots(_nPlots),
   plotSize(_plotSize),
+  community(_nPlots * _plotSize, 0),
+  abundance(_nPlots),
   timeStamp(_timeStamp),
   lastSpecies(0)
 {
-  community = new Patch* [nPlots];
-  for(uint np = 0; np < nPlots; ++np) {
-    community[np] = new Patch [plotSize];
-    for(uint ni = 0; ni < plotSize; ++ni) {
-      Patch& p = community[np][ni];
-      p.speciesIndex = 0;
-    }
+  for(auto& a : abundance) {
+    a[0] = plotSize;
   }
 }
 
-MetaCommunity::~MetaCommunity()
-{
-   for(uint np = 0; np < nPlots; ++np) {
-     delete [] community[np];
-   }
-   delete [] community;
-}
-
 inline void
 MetaCommunity::setSpecies(uint np, uint ni, uint s)
 {
-  get(np,ni).speciesIndex = s;
+  uint& x = community[np * plotSize + ni];
+  if( x != s ) {
+    Abundances& a = abundance[np];
+    auto const i = a.find(x);
+    if( --(i->second) == 0 ) {
+      a.erase(i);
+    }
+    a[s] += 1;
+    x = s;
+  }
   if( s > lastSpecies ) {
     lastSpecies = s;
   }
 }
 
+void
+MetaCommunity::setSpecies(uint const np, vector<uint> const& nis, vector<uint> const& species)
+{
+  deltas.clear();
+  uint* const plot = &community[np * plotSize];
+  for(uint i = 0; i < nis.size(); ++i) {
+    uint& x = plot[nis[i]];
+    uint const s = species[i];
+    if( x != s ) {
+      deltas.push_back(std::make_pair(x, -1));
+      deltas.push_back(std::make_pair(s, 1));
+      x = s;
+      if( s > lastSpecies ) {
+	lastSpecies = s;
+      }
+    }
+  }
+  std::sort(deltas.begin(), deltas.end());
+  
+  Abundances& a = abundance[np];
+  for(uint i = 0; i < deltas.size(); /**/) {
+    uint const s = deltas[i].first;
+    int d = 0;
+    for(/**/; i < deltas.size() && deltas[i].first == s; ++i) {
+      d += deltas[i].second;
+    }
+    if( d > 0 ) {
+      a[s] += d;
+    } else if( d < 0 ) {
+      auto const j = a.find(s);
+      j->second += d;
+      if( j->second == 0 ) {
+	a.erase(j);
+      }
+    }
+  }
+}
+
 PyObject*
 MetaCommunity::asPyObject(void) const
 {
@@ -132,7 +216,7 @@ MetaCommunity::asPyObject(void) const
   for(uint np = 0; np < nPlots; ++np) {
     PyObject* p = PyTuple_New(plotSize);
     for(uint ni = 0; ni < plotSize; ++ni) {
-      PyTuple_SET_ITEM(p, ni, PyInt_FromLong(get(np,ni).speciesIndex));
+      PyTuple_SET_ITEM(p, ni, PyInt_FromLong(species(np,ni)));
     }
     PyTuple_SET_ITEM(o, np, p);
   }
@@ -141,8 +225,10 @@ MetaCommunity::asPyObject(void) const
 
 class TracedMetaCommunity : public MetaCommunity {
 public:
+  typedef PatchTrace::Index Index;
+  
   TracedMetaCommunity(uint nPlots, uint plotSize, double timeStamp = 0);
-  ~TracedMetaCommunity();
+  ~TracedMetaCommunity() {}
   
   void replace(uint np, uint nt, uint np1, uint nt1, double t, uint sx);
 
@@ -157,220 +243,145 @@ public:
   void 	optTraces(void);
   
 private:
-  PatchTrace*** trace;
-  mutable PatchTrace founder;
-
-  PatchTrace*		ca(void) const;
-  const PatchTrace*	ca(uint n) const;
+  TracePool	pool;
+  // trace of individual ni in plot np at [np * plotSize + ni]
+  vector<Index>	trace;
+  // pool size which triggers the next compaction
+  uint		compactAt;
+
+  // first in pool
+  static Index const founder = 0;
+  
+  Index		ca(void) const;
+  Index		ca(uint n) const;
+  Index		commonAnc(Index x, Index y) const;
+  
+  void		compact(void);
 };
 
+TracedMetaCommunity::Index const TracedMetaCommunity::founder;
+
 TracedMetaCommunity::TracedMetaCommunity(uint nPlots, uint plotSize, double timeStamp) :
   MetaCommunity(nPlots, plotSize, timeStamp),
-  founder(-1, -1, -1, -1, 0)
+  trace(nPlots * plotSize)
 {
-  trace = new PatchTrace** [nPlots];
+  pool.add(-1, -1, -1, -1, PatchTrace::none);
   for(uint np = 0; np < nPlots; ++np) {
-    trace[np] = new PatchTrace* [plotSize];
     for(uint ni = 0; ni < plotSize; ++ni) {
-      PatchTrace* pt = new PatchTrace(timeStamp, np, ni, 0, &founder);
-      ++founder.refCount;
-      trace[np][ni] = pt;
+      trace[np * plotSize + ni] = pool.add(timeStamp, np, ni, 0, founder);
     }
   }
-}
-
-TracedMetaCommunity::~TracedMetaCommunity()
-{
-  for(uint np = 0; np < nPlots; ++np) {
-    for(uint ni = 0; ni < plotSize; ++ni) {
-      PatchTrace* p = trace[np][ni];
-      PatchTrace* pp = p->prev;
-      while( pp && pp != &founder ) {
-	if( pp->refCount > 1 ) {
-	  -- pp->refCount;
-	  break;
-	}
-	PatchTrace* px = pp->prev;
-	delete pp;
-	pp = px;
-      }
-      delete p;
-    }
-    delete [] trace[np];
-  }
-  delete [] trace;
+  compactAt = 2 * pool.size();
 }
 
 void
 TracedMetaCommunity::setSpecies(uint np, uint ni, uint s)
 {
   MetaCommunity::setSpecies(np, ni, s);
-  trace[np][ni]->speciesIndex = s;
+  pool[trace[np * plotSize + ni]].speciesIndex = s;
 }
 
-void
-TracedMetaCommunity::replace(uint np, uint nt, uint np1, uint nt1, double t, uint sx)
+inline void
+TracedMetaCommunity::compact(void)
 {
-  Patch& p = get(np, nt);
-  p.speciesIndex = sx;
-  PatchTrace* const prev = trace[np1][nt1];
-  ++ prev->refCount;
-  
-  PatchTrace*& cur = trace[np][nt];
-  -- cur->refCount;
-  {
-    PatchTrace* p = cur;
-    while( p->refCount == 0 ) {
-      PatchTrace* p1 = p->prev;
-      delete p;
-      p = p1;
-      assert( p && p->refCount > 0 );
-      --p->refCount;
-      if( p == &founder ) {
-	break;
-      }
-      // if( ! p || p == &founder ) {
-      // 	// founder
-      // 	break;
-      // }
-      // assert( p->refCount > 0 );
-      // --p->refCount;
-    }
-  }
-    
-  PatchTrace* n = new PatchTrace(t, np1, nt1, sx, prev);
-
-  cur = n;
+  pool.compact(trace);
+  compactAt = 2 * pool.size();
 }
 
-#if 0 
-
-static const PatchTrace*
-commonAnc(const PatchTrace* x, const PatchTrace* y)
+void
+TracedMetaCommunity::replace(uint np, uint nt, uint np1, uint nt1, double t, uint sx)
 {
-  while( !(x->pTime == y->pTime &&
-	   x->fromPlot == y->fromPlot &&
-	   x->fromPatch == y->fromPatch) )  {
-    if( x->pTime > y->pTime ) {
-      x = x->prev;
-    } else {
-      y = y->prev;
-    }
+  MetaCommunity::setSpecies(np, nt, sx);
+  
+  Index const prev = trace[np1 * plotSize + nt1];
+  trace[np * plotSize + nt] = pool.add(t, np1, nt1, sx, prev);
+
+  // the replaced trace, and whatever only it kept alive, are dropped here
+  if( pool.size() >= compactAt ) {
+    compact();
   }
-  assert( x == y ) ;
-  return x;
 }
 
-#else
-
-static const PatchTrace*
-commonAnc(const PatchTrace* x, const PatchTrace* y)
+inline TracedMetaCommunity::Index
+TracedMetaCommunity::commonAnc(Index x, Index y) const
 {
   while( x != y ) {
-    assert( x && y && !(x->pTime == y->pTime &&
-			x->fromPlot == y->fromPlot &&
-			x->fromPatch == y->fromPatch) );
-    if( x->pTime > y->pTime ) {
-      x = x->prev;
+    PatchTrace const& tx = pool[x];
+    PatchTrace const& ty = pool[y];
+    assert( !(tx.pTime == ty.pTime &&
+	      tx.fromPlot == ty.fromPlot &&
+	      tx.fromPatch == ty.fromPatch) );
+    if( tx.pTime > ty.pTime ) {
+      x = tx.prev;
     } else {
-      y = y->prev;
+      y = ty.prev;
     }
+    assert( x != PatchTrace::none && y != PatchTrace::none );
   }
   return x;
 }
 
-#endif
-
-
-const PatchTrace*
+TracedMetaCommunity::Index
 TracedMetaCommunity::ca(uint n) const
 {
-  PatchTrace** pn = trace[n];
-  const PatchTrace* x = pn[0];
+  const Index* const pn = &trace[n * plotSize];
+  Index x = pn[0];
   for(uint k = 1; k < plotSize; ++k) {
     x = commonAnc(x, pn[k]);
   }
   return x;
 }
 
-PatchTrace*
+TracedMetaCommunity::Index
 TracedMetaCommunity::ca(void) const
 {
-  const PatchTrace* x = ca(0);
+  Index x = ca(0);
   for(uint n = 1; n < nPlots; ++n) {
-    if( x == &founder ) {
+    if( x == founder ) {
       break;
     }
     x = commonAnc(x, ca(n));
   }
-  return const_cast<PatchTrace*>(x);
+  return x;
 }
 
 const PatchTrace*
 TracedMetaCommunity::ca(uint p0, uint i0, uint p1, uint i1) const
 {
-  return commonAnc(trace[p0][i0], trace[p1][i1]);
+  return &pool[commonAnc(trace[p0 * plotSize + i0], trace[p1 * plotSize + i1])];
 }
 
-#if !defined(NDEBUG)
-static bool
-onPath(const PatchTrace* p, const PatchTrace* c)
-{
-  while( p != c && p->prev ) {
-    p = p->prev;
-  }
-  return p == c;
-}
-#endif
-
 const PatchTrace*
 TracedMetaCommunity::cleanUp(void)
 {
-  PatchTrace* const can = ca();
-#if !defined(NDEBUG)
-  {
-    for(uint np = 0; np < nPlots; ++np) {
-      for(uint ni = 0; ni < plotSize; ++ni) {
-	assert( onPath(trace[np][ni], can) );
-      }
-    }
-  }
-#endif
-  
-  {
-    PatchTrace* p = can->prev;
-    while( p && p->prev ) {
-      assert(p->refCount == 1);
-      p = p->prev;
-    }
-  }
-  
-  PatchTrace* p = can->prev;
-  can->prev = 0;
-  while( p && p->prev ) {
-    assert(p->refCount == 1);
-    PatchTrace* c = p->prev;
-    delete p;
-    p = c;
-  }
-  return can;
-}
+  Index const can = ca();
 
+  // history before the common ancestor is not needed, and dropped on the
+  // next compaction
+  pool[can].prev = PatchTrace::none;
+  return &pool[can];
+}
 
 PyObject*
 TracedMetaCommunity::asPyObject(void)
 {
-  const PatchTrace* const ca = cleanUp();
-  if( ca == &founder ) {
-    founder.asp = PyTuple_New(4);
-    PyTuple_SET_ITEM(founder.asp, 0, PyFloat_FromDouble(-1));
+  Index const can = cleanUp() - &pool[0];
+  
+  // python object of each trace, created once
+  vector<PyObject*> asp(pool.size(), 0);
+  vector<Index> path;
+  
+  if( can == founder ) {
+    PyObject* const f = PyTuple_New(4);
+    PyTuple_SET_ITEM(f, 0, PyFloat_FromDouble(-1));
     PyObject* u2 = PyTuple_New(2);
     PyTuple_SET_ITEM(u2, 0, PyInt_FromLong(-1));
     PyTuple_SET_ITEM(u2, 1, PyInt_FromLong(-1));
-    PyTuple_SET_ITEM(founder.asp, 1, u2);
-    PyTuple_SET_ITEM(founder.asp, 2, PyInt_FromLong(-1));
+    PyTuple_SET_ITEM(f, 1, u2);
+    PyTuple_SET_ITEM(f, 2, PyInt_FromLong(-1));
     Py_INCREF(Py_None);
-    PyTuple_SET_ITEM(founder.asp, 3, Py_None);
+    PyTuple_SET_ITEM(f, 3, Py_None);
+    asp[founder] = f;
   }
   
   PyObject* p2 = PyTuple_New(2);
@@ -380,28 +391,40 @@ TracedMetaCommunity::asPyObject(void)
   for(uint np = 0; np < nPlots; ++np) {
     PyObject* p = PyTuple_New(plotSize);
     for(uint ni = 0; ni < plotSize; ++ni) {
-      PatchTrace* t = trace[np][ni];
-      PyObject* x = t->asPyObject();
-      PyTuple_SET_ITEM(p, ni, x);
+      Index const t = trace[np * plotSize + ni];
+      
+      // create the missing objects from the oldest
+      for(Index i = t; i != PatchTrace::none && ! asp[i]; i = pool[i].prev) {
+	path.push_back(i);
+      }
+      while( ! path.empty() ) {
+	Index const i = path.back();
+	path.pop_back();
+	PatchTrace const& x = pool[i];
+	PyObject* const a = PyTuple_New(4);
+	PyTuple_SET_ITEM(a, 0, PyFloat_FromDouble(x.pTime));
+	PyObject* u2 = PyTuple_New(2);
+	PyTuple_SET_ITEM(u2, 0, PyInt_FromLong(x.fromPlot));
+	PyTuple_SET_ITEM(u2, 1, PyInt_FromLong(x.fromPatch));
+	PyTuple_SET_ITEM(a, 1, u2);
+	PyTuple_SET_ITEM(a, 2, PyInt_FromLong(x.speciesIndex));
+	PyObject* const prev = x.prev != PatchTrace::none ? asp[x.prev] : Py_None;
+	Py_INCREF(prev);
+	PyTuple_SET_ITEM(a, 3, prev);
+	asp[i] = a;
+      }
+      
+      Py_INCREF(asp[t]);
+      PyTuple_SET_ITEM(p, ni, asp[t]);
     }
     PyTuple_SET_ITEM(o, np, p);
   }
   
   PyTuple_SET_ITEM(p2, 1, o);
 
-  const_cast<PatchTrace*>(ca)->asp = 0;
-  
-  for(uint np = 0; np < nPlots; ++np) {
-    for(uint ni = 0; ni < plotSize; ++ni) {
-      PatchTrace* t = trace[np][ni];
-      while( t->asp ) {
-	t->asp = 0;
-	t = t->prev;
-	assert( t ) ;
-      }
-    }
+  for(auto const a : asp) {
+    Py_XDECREF(a);
   }
-  assert( founder.asp == 0 ) ;
   
   return p2;
 }
@@ -409,45 +432,82 @@ TracedMetaCommunity::asPyObject(void)
 void
 TracedMetaCommunity::optTraces(void)
 {
-  for(uint np = 0; np < nPlots; ++np) {
-    for(uint ni = 0; ni < plotSize; ++ni) {
-      PatchTrace* p = trace[np][ni];
-      while( p != &founder && p->prev ) {
-	if( p->prev != &founder && p->prev->refCount == 1 &&
-	    p->prev->prev != &founder &&  p->prev->prev->refCount == 1 ) {
-	  PatchTrace* x = p->prev;
-	  p->prev = x->prev;
-	  delete x;
-	} else {
-	  p = p->prev;
-	}
+  compact();
+
+  // references to each trace, from traces and individuals
+  vector<uint> refCount(pool.size(), 0);
+  for(Index i = 0; i < pool.size(); ++i) {
+    if( pool[i].prev != PatchTrace::none ) {
+      refCount[pool[i].prev] += 1;
+    }
+  }
+  for(auto const t : trace) {
+    refCount[t] += 1;
+  }
+
+  // skip traces on a single line of descent. Once a visited trace is reached
+  // the rest of the path is done.
+  vector<bool> visited(pool.size(), false);
+  for(auto const t : trace) {
+    Index p = t;
+    while( p != founder && pool[p].prev != PatchTrace::none && ! visited[p] ) {
+      Index const x = pool[p].prev;
+      if( x != founder && refCount[x] == 1 &&
+	  pool[x].prev != founder && pool[x].prev != PatchTrace::none &&
+	  refCount[pool[x].prev] == 1 ) {
+	pool[p].prev = pool[x].prev;
+      } else {
+	visited[p] = true;
+	p = x;
       }
     }
   }
+  compact();
 }
 
+static std::mt19937 randomizer;
+
 class MetaSimulator {
 public:
-  MetaSimulator(double mu, double lam, double rho);
+  // Random numbers from 'rng', the module's generator unless given
+  MetaSimulator(double mu, double lam, double rho, std::mt19937& rng = randomizer);
   ~MetaSimulator() {}
 
   double advance(double targetTime, MetaCommunity& com);
 
+  // Approximate: advance in steps of 'tau'. Each plot draws the number of
+  // individuals replaced during a step, how many of them by local, immigrant
+  // and new species, and the parents, from the community as it was at the
+  // start of the step. The error grows with mu*tau: parents are not updated
+  // within a step, so a lineage grows by at most one generation in it.
+  double advance(double targetTime, MetaCommunity& com, double tau);
+
   double advance(double targetTime, TracedMetaCommunity& com, double minCAtime, double cleanEvery);
   
 private:
   double mu;
   double lam;
   double rho;
+  std::mt19937& rng;
   
   double pLocal;
   double pLocalOrImi;
 };
 
-MetaSimulator::MetaSimulator(double _mu, double _lam, double _rho) :
+// Replacements are local, immigrant or new species with probabilities
+// 1-(lam+rho)/mu, rho/mu and lam/mu.
+
+static bool
+validRates(double const mu, double const lam, double const rho)
+{
+  return mu > 0 && lam >= 0 && rho >= 0 && lam + rho <= mu;
+}
+
+MetaSimulator::MetaSimulator(double _mu, double _lam, double _rho, std::mt19937& _rng) :
   mu(_mu),
   lam(_lam),
-  rho(_rho)
+  rho(_rho),
+  rng(_rng)
 {
   double p3[3];
   p3[0] = 1-(lam+rho)/mu;
@@ -457,18 +517,7 @@ MetaSimulator::MetaSimulator(double _mu, double _lam, double _rho) :
   pLocal = p3[0];
   pLocalOrImi = p3[0]+p3[1];
 }
-  
-static std::mt19937 randomizer;
 
-uint maxSpecies(MetaCommunity const& com) {
-  uint s = 0;
-  for(uint np = 0; np < com.nPlots; ++np) {
-    for(uint ni = 0; ni < com.plotSize; ++ni) {
-      s = std::max(com.get(np,ni).speciesIndex, s);
-    }
-  }
-  return s;
-}
 
 double
 MetaSimulator::advance(double targetTime, MetaCommunity& com)
@@ -479,7 +528,7 @@ MetaSimulator::advance(double targetTime, MetaCommunity& com)
   uint const plotSize = com.plotSize;
   uint const nIndividuals = com.nIndividuals();
 
-  uint lastSpecies = maxSpecies(com);
+  uint lastSpecies = com.getLastSpecies();
   
   double const dr = nIndividuals * mu;
   std::exponential_distribution<double> timeToNextDeath(dr);
@@ -490,26 +539,26 @@ MetaSimulator::advance(double targetTime, MetaCommunity& com)
   double curTime = com.getTime();
 
   while( curTime <= targetTime ) {
-    double const deltaT = timeToNextDeath(randomizer);
+    double const deltaT = timeToNextDeath(rng);
     curTime += deltaT;
-    uint const k = pickGlobIndividual(randomizer);
+    uint const k = pickGlobIndividual(rng);
     uint const np = k / plotSize;         assert(0 <= np && np < nPlots);
     uint const nt = k - np * plotSize;    assert(0 <= nt && nt < plotSize );
-    double const r = zeroOne(randomizer);
+    double const r = zeroOne(rng);
 
     uint np1,nt1,sx;
     
     if( r < pLocal ) {
-      uint const i = pickLocalIndividual(randomizer);
-      sx = com.get(np, i).speciesIndex;
+      uint const i = pickLocalIndividual(rng);
+      sx = com.species(np, i);
       np1 = np;
       nt1 = i;
     } else {
-      uint const k1 = pickGlobIndividual(randomizer);
+      uint const k1 = pickGlobIndividual(rng);
       np1 = k1 / plotSize;         
       nt1 = k1 - np1 * plotSize; 
       if( r < pLocalOrImi ) {
-	sx = com.get(np1, nt1).speciesIndex;
+	sx = com.species(np1, nt1);
       } else {
 	lastSpecies += 1;
 	sx = lastSpecies;
@@ -517,9 +566,8 @@ MetaSimulator::advance(double targetTime, MetaCommunity& com)
       }
     }
     com.setSpecies(np, nt, sx);
-    // Patch& p = com.get(np, nt);
-    // p.speciesIndex = sx;
   }
+  com.setLastSpecies(lastSpecies);
   com.setTime(curTime);
   return curTime;
 }
@@ -555,33 +603,33 @@ MetaSimulator::advance(double targetTime, TracedMetaCommunity& com,
   // look until target time or CA time > minimum CA time
   while( curTime <= targetTime ) {
     {
-      double deltaT = timeToNextDeath(randomizer);
+      double deltaT = timeToNextDeath(rng);
       double cpd = curTime + deltaT;
       while( cpd == curTime ) {
-	deltaT = timeToNextDeath(randomizer);
+	deltaT = timeToNextDeath(rng);
 	cpd = curTime + deltaT;
       }
       curTime = cpd;
     }
       
-    uint const k = pickGlobIndividual(randomizer);
+    uint const k = pickGlobIndividual(rng);
     uint const np = k / plotSize;         assert(0 <= np && np < nPlots);
     uint const nt = k - np * plotSize;    assert(0 <= nt && nt < plotSize );
-    double const r = zeroOne(randomizer);
+    double const r = zeroOne(rng);
 
     uint np1,nt1,sx;
     
     if( r < pLocal ) {
-      uint const i = pickLocalIndividual(randomizer);
-      sx = com.get(np, i).speciesIndex;
+      uint const i = pickLocalIndividual(rng);
+      sx = com.species(np, i);
       np1 = np;
       nt1 = i;
     } else {
-      uint const k1 = pickGlobIndividual(randomizer);
+      uint const k1 = pickGlobIndividual(rng);
       np1 = k1 / plotSize;         
       nt1 = k1 - np1 * plotSize; 
       if( r < pLocalOrImi ) {
-	sx = com.get(np1, nt1).speciesIndex;
+	sx = com.species(np1, nt1);
       } else {
 	lastSpecies += 1;
 	sx = lastSpecies;
@@ -601,6 +649,89 @@ MetaSimulator::advance(double targetTime, TracedMetaCommunity& com,
     }
   }
 
+  com.setLastSpecies(lastSpecies);
+  com.setTime(curTime);
+  return curTime;
+}
+
+double
+MetaSimulator::advance(double const targetTime, MetaCommunity& com, double const tau)
+{
+  uint const nPlots = com.nPlots;
+  uint const plotSize = com.plotSize;
+  uint const nIndividuals = com.nIndividuals();
+
+  uint lastSpecies = com.getLastSpecies();
+
+  // positions in each plot, in the order of a partial shuffle
+  vector<uint> positions(nIndividuals);
+  for(uint k = 0; k < nIndividuals; ++k) {
+    positions[k] = k % plotSize;
+  }
+  
+  // replaced individuals in each plot and their new species, set when all
+  // plots are done (parents are from the community at the start of the step)
+  vector< vector<uint> > replaced(nPlots), newSpecies(nPlots);
+  // raw random bits drawn in bulk for each plot
+  vector<uint32_t> bits;
+  // uniform in [0,n) from 32 bits
+  auto const below = [](uint32_t const b, uint const n) -> uint {
+    return (uint64_t(b) * n) >> 32; };
+  // immigration among non local births
+  double const pImi = pLocal < 1 ? std::min((pLocalOrImi - pLocal) / (1 - pLocal), 1.0) : 0;
+  
+  double curTime = com.getTime();
+  
+  while( curTime < targetTime ) {
+    double const dt = std::min(tau, targetTime - curTime);
+
+    // An individual dies (at least once) in the step with probability pDie.
+    // The last death alone decides its species at the end of the step.
+    std::binomial_distribution<uint> nDie(plotSize, 1 - exp(-mu * dt));
+    
+    for(uint np = 0; np < nPlots; ++np) {
+      uint const d = nDie(rng);
+      uint const nLocal = std::binomial_distribution<uint>(d, pLocal)(rng);
+      uint const nImi = std::binomial_distribution<uint>(d - nLocal, pImi)(rng);
+      
+      bits.resize(d + nLocal + nImi);
+      for(auto& b : bits) {
+	b = rng();
+      }
+      const uint32_t* b = bits.empty() ? 0 : &bits[0];
+
+      // d distinct victims, in random order
+      uint* const pos = &positions[np * plotSize];
+      vector<uint>& r = replaced[np];
+      r.resize(d);
+      for(uint i = 0; i < d; ++i) {
+	std::swap(pos[i], pos[i + below(*b++, plotSize - i)]);
+	r[i] = pos[i];
+      }
+
+      // local parents, then immigrants, then new species
+      vector<uint>& sp = newSpecies[np];
+      sp.resize(d);
+      const uint* const all = com.speciesArray();
+      const uint* const local = all + np * plotSize;
+      for(uint i = 0; i < d; ++i) {
+	if( i < nLocal ) {
+	  sp[i] = local[below(*b++, plotSize)];
+	} else if( i < nLocal + nImi ) {
+	  sp[i] = all[below(*b++, nIndividuals)];
+	} else {
+	  lastSpecies += 1;
+	  sp[i] = lastSpecies;
+	}
+      }
+    }
+
+    for(uint np = 0; np < nPlots; ++np) {
+      com.setSpecies(np, replaced[np], newSpecies[np]);
+    }
+    curTime += dt;
+  }
+  com.setLastSpecies(lastSpecies);
   com.setTime(curTime);
   return curTime;
 }
@@ -617,6 +748,20 @@ metaDestructor(PyObject* const o)
   }
 }
 
+// Community of either kind, 0 if not a valid one
+
+static MetaCommunity*
+asCommunity(PyObject* const o)
+{
+  if( PyCapsule_IsValid(o, "TMC") ) {
+    return reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(o, "TMC"));
+  }
+  if( PyCapsule_IsValid(o, "MC") ) {
+    return reinterpret_cast<MetaCommunity*>(PyCapsule_GetPointer(o, "MC"));
+  }
+  return 0;
+}
+
 PyObject*
 newCommunity(PyObject*, PyObject* args, PyObject* kwds)
 {
@@ -710,7 +855,7 @@ PyObject*
 forwardSim(PyObject*, PyObject* args, PyObject* kwds)
 {
   static const char *kwlist[] = {"metaCommunity","targetTime", "mu", "lam", "rho", 
-				 "minCAtime", "seed", "cleanEvery",
+				 "minCAtime", "seed", "cleanEvery", "tau", "snapshot",
 				 static_cast<const char*>(0)};
   PyObject* metaCom = 0;
   double targetTime;
@@ -718,14 +863,22 @@ forwardSim(PyObject*, PyObject* args, PyObject* kwds)
   double cleanEvery = 1;
   double mu = 1, lam = 1, rho = 1;
   double seed = -1;
+  double tau = 0;
+  PyObject* pySnapshot = 0;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "Odddd|ddd", const_cast<char**>(kwlist),
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "Odddd|ddddO", const_cast<char**>(kwlist),
 				    &metaCom,&targetTime,&mu,&lam,&rho,&minCAtime,&seed,
-				    &cleanEvery)) {
+				    &cleanEvery,&tau,&pySnapshot)) {
     PyErr_SetString(PyExc_ValueError, "wrong args.") ;
     return 0;
   }
 
+  if( ! validRates(mu, lam, rho) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: invalid rates (need mu > 0, lam, rho >= 0"
+		    " and lam + rho <= mu)");
+    return 0;
+  }
+  
   if( seed >= 0 ) {
     randomizer.seed(seed);
   }
@@ -735,27 +888,44 @@ forwardSim(PyObject*, PyObject* args, PyObject* kwds)
   //MetaCommunity* com = 0;
   //TracedMetaCommunity* tcom = 0;
 
+  bool const snapshot = ! pySnapshot || PyObject_IsTrue(pySnapshot);
+  
   MetaSimulator s(mu, lam, rho);
   double endTime;
   PyObject* retVal = 0;
   
   if( PyCapsule_IsValid(metaCom, "TMC") ) {
+    if( tau > 0 ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: tau steps are not traced") ;
+      return 0;
+    }
     TracedMetaCommunity& tcom =
       *reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(metaCom, "TMC"));
     //trace = true;
     endTime = s.advance(targetTime, tcom, minCAtime, cleanEvery);
-    retVal = tcom.asPyObject();
+    if( snapshot ) {
+      retVal = tcom.asPyObject();
+    } else {
+      tcom.cleanUp();
+    }
   } else if( PyCapsule_IsValid(metaCom, "MC") ) {
     MetaCommunity& com =
       *reinterpret_cast<MetaCommunity*>(PyCapsule_GetPointer(metaCom, "MC"));
     // trace = false;
-    endTime = s.advance(targetTime, com);
-    retVal = com.asPyObject();
+    endTime = tau > 0 ? s.advance(targetTime, com, tau) : s.advance(targetTime, com);
+    if( snapshot ) {
+      retVal = com.asPyObject();
+    }
   } else {
     PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
     return 0;
   }
 
+  if( ! retVal ) {
+    Py_INCREF(Py_None);
+    retVal = Py_None;
+  }
+  
   PyObject* o = PyTuple_New(2);
   PyTuple_SET_ITEM(o, 0, PyFloat_FromDouble(endTime));
   PyTuple_SET_ITEM(o, 1, retVal);
@@ -763,6 +933,62 @@ forwardSim(PyObject*, PyObject* args, PyObject* kwds)
   return o;
 }
 
+// Number of individuals in a plot (within) or in another plot (between)
+// whose common ancestor with a randomly picked individual is newer than time
+// 0. Each count is for a new random pick.
+
+static void
+caCounts(TracedMetaCommunity const& tcom, uint const nwithin, uint const nbetween,
+	 std::mt19937& rng, vector<uint>& within, vector<uint>& between)
+{
+  std::uniform_int_distribution<int> pickPlot(0, tcom.nPlots-1);
+  std::uniform_int_distribution<int> pickLocalIndividual(0, tcom.plotSize-1);
+
+  within.clear();
+  for(uint k = 0; k < nwithin; ++k) {
+    uint const np = pickPlot(rng);
+    uint const j = pickLocalIndividual(rng);
+    uint count = 0;
+    for(uint i = 0; i < tcom.plotSize; ++i) {
+      if( i != j ) {
+	const PatchTrace* const p = tcom.ca(np, i, np, j);
+	count += p->pTime > 0;
+      }
+    }
+    within.push_back(count);
+  }
+
+  between.clear();
+  if( tcom.nPlots < 2 ) {
+    return;
+  }
+  for(uint k = 0; k < nbetween; ++k) {
+    uint const np0 = pickPlot(rng);
+    uint np1 = np0;
+    while( np1 == np0 ) {
+      np1 = pickPlot(rng);
+    }
+    uint const j = pickLocalIndividual(rng);
+    uint count = 0;
+    for(uint i = 0; i < tcom.plotSize; ++i) {
+      const PatchTrace* const p = tcom.ca(np0, j, np1, i);
+      count += p->pTime > 0;
+    }
+    between.push_back(count);
+  }
+}
+
+template<typename T>
+static PyObject*
+asTuple(vector<T> const& v)
+{
+  PyObject* const t = PyTuple_New(v.size());
+  for(uint i = 0; i < v.size(); ++i) {
+    PyTuple_SET_ITEM(t, i, PyInt_FromLong(v[i]));
+  }
+  return t;
+}
+
 PyObject*
 CAcounts(PyObject*, PyObject* args, PyObject* kwds)
 {
@@ -785,41 +1011,270 @@ CAcounts(PyObject*, PyObject* args, PyObject* kwds)
   TracedMetaCommunity& tcom =
     *reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(metaCom, "TMC"));
 
-  std::uniform_int_distribution<int> pickPlot(0, tcom.nPlots-1);
-  std::uniform_int_distribution<int> pickLocalIndividual(0, tcom.plotSize-1);
-
-  PyObject* tup0 = PyTuple_New(nwithin);
+  vector<uint> within, between;
+  caCounts(tcom, std::max(nwithin, 0), std::max(nbetween, 0), randomizer, within, between);
   
-  for(int k = 0; k < nwithin; ++k) {
-    uint const np = pickPlot(randomizer);
-    uint const j = pickLocalIndividual(randomizer);
-    uint count = 0;
-    for(uint i = 0; i < tcom.plotSize; ++i) {
-      if( i != j ) {
-	const PatchTrace* const p = tcom.ca(np, i, np, j);
-	count += p->pTime > 0;
-      }
+  return Py_BuildValue("NN", asTuple(within), asTuple(between));
+}
+
+// Species abundances in community, largest first
+
+static void
+speciesAbundances(MetaCommunity const& com, vector<uint>& sad)
+{
+  // merge the plot abundances, which hold only the living species
+  MetaCommunity::Abundances counts;
+  for(uint np = 0; np < com.nPlots; ++np) {
+    for(auto const& a : com.abundances(np)) {
+      counts[a.first] += a.second;
     }
-    PyTuple_SET_ITEM(tup0, k, PyInt_FromLong(count));
   }
+  sad.clear();
+  sad.reserve(counts.size());
+  for(auto const& c : counts) {
+    sad.push_back(c.second);
+  }
+  std::sort(sad.begin(), sad.end(), [](uint a, uint b) { return a > b; });
+}
 
-  PyObject* tup1 = PyTuple_New(nbetween);
-  for(int k = 0; k < nbetween; ++k) {
-    uint const np0 = pickPlot(randomizer);
-    uint np1 = np0;
-    while( np1 == np0 ) {
-      np1 = pickPlot(randomizer);
+PyObject*
+replicates(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"n", "nPlots", "plotSize", "mu", "lam", "rho", "targetTime",
+				 "threads", "seed", "nwithin", "nbetween", "tau",
+				 static_cast<const char*>(0)};
+  uint n, nPlots, plotSize;
+  double mu, lam, rho, targetTime;
+  uint nThreads = 1;
+  long long seed = -1;
+  uint nwithin = 0, nbetween = 0;
+  double tau = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "IIIdddd|ILIId", const_cast<char**>(kwlist),
+				    &n,&nPlots,&plotSize,&mu,&lam,&rho,&targetTime,
+				    &nThreads,&seed,&nwithin,&nbetween,&tau)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( nPlots == 0 || plotSize == 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: no community or valid sizes");
+    return 0;
+  }
+
+  if( ! validRates(mu, lam, rho) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: invalid rates (need mu > 0, lam, rho >= 0"
+		    " and lam + rho <= mu)");
+    return 0;
+  }
+
+  if( seed < 0 ) {
+    seed = (static_cast<long long>(randomizer()) << 31) ^ randomizer();
+  }
+  bool const traced = nwithin > 0 || nbetween > 0;
+  if( traced && tau > 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: tau steps are not traced");
+    return 0;
+  }
+  
+  struct Replicate {
+    double endTime;
+    vector<uint> sad;
+    vector<uint> within;
+    vector<uint> between;
+  };
+  vector<Replicate> reps(n);
+  std::atomic<uint> next(0);
+
+  // Replicate k draws from its own generator, seeded by (seed,k), so results
+  // do not depend on the number of threads.
+  auto const work = [&](void) {
+    for(uint k = next++; k < n; k = next++) {
+      std::seed_seq ss = {uint(seed), uint(seed >> 32), k};
+      std::mt19937 rng(ss);
+      MetaSimulator s(mu, lam, rho, rng);
+      Replicate& r = reps[k];
+      if( traced ) {
+	TracedMetaCommunity com(nPlots, plotSize);
+	r.endTime = s.advance(targetTime, com, -1);
+	caCounts(com, nwithin, nbetween, rng, r.within, r.between);
+	speciesAbundances(com, r.sad);
+      } else {
+	MetaCommunity com(nPlots, plotSize);
+	r.endTime = tau > 0 ? s.advance(targetTime, com, tau) : s.advance(targetTime, com);
+	speciesAbundances(com, r.sad);
+      }
     }
-    uint const j = pickLocalIndividual(randomizer);
-    uint count = 0;
-    for(uint i = 0; i < tcom.plotSize; ++i) {
-      const PatchTrace* const p = tcom.ca(np0, j, np1, i);
-      count += p->pTime > 0;
+  };
+  
+  Py_BEGIN_ALLOW_THREADS
+  uint const nt = std::max(1U, std::min(nThreads, n));
+  vector<std::thread> pool;
+  for(uint t = 1; t < nt; ++t) {
+    pool.push_back(std::thread(work));
+  }
+  work();
+  for(auto& t : pool) {
+    t.join();
+  }
+  Py_END_ALLOW_THREADS
+
+  PyObject* const o = PyList_New(n);
+  for(uint k = 0; k < n; ++k) {
+    Replicate const& r = reps[k];
+    PyObject* cas;
+    if( traced ) {
+      cas = Py_BuildValue("NN", asTuple(r.within), asTuple(r.between));
+    } else {
+      Py_INCREF(Py_None);
+      cas = Py_None;
     }
-    PyTuple_SET_ITEM(tup1, k, PyInt_FromLong(count));
+    PyList_SET_ITEM(o, k, Py_BuildValue("dNN", r.endTime, asTuple(r.sad), cas));
   }
+  return o;
+}
+
+// Buffer over the species array of a community, which it keeps alive. The
+// array is never reallocated, so the buffer follows the community as it is
+// simulated.
+
+struct SpeciesViewObject {
+  PyObject_HEAD
+  PyObject*	community;
+  const uint*	species;
+  Py_ssize_t	n;
+  Py_ssize_t	stride;
+};
+
+static void
+SpeciesView_dealloc(SpeciesViewObject* self)
+{
+  Py_DECREF(self->community);
+  PyObject_Del(self);
+}
+
+static int
+SpeciesView_getbuffer(SpeciesViewObject* self, Py_buffer* view, int flags)
+{
+  if( (flags & PyBUF_WRITABLE) == PyBUF_WRITABLE ) {
+    PyErr_SetString(PyExc_BufferError, "species view is read only");
+    return -1;
+  }
+  view->buf = const_cast<uint*>(self->species);
+  view->obj = reinterpret_cast<PyObject*>(self);
+  Py_INCREF(self);
+  view->len = self->n * sizeof(uint);
+  view->readonly = 1;
+  view->itemsize = sizeof(uint);
+  view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>("I") : 0;
+  view->ndim = 1;
+  view->shape = (flags & PyBUF_ND) ? &self->n : 0;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &self->stride : 0;
+  view->suboffsets = 0;
+  view->internal = 0;
+  return 0;
+}
+
+static PyBufferProcs speciesView_as_buffer = {
+    0,                         /* bf_getreadbuffer */
+    0,                         /* bf_getwritebuffer */
+    0,                         /* bf_getsegcount */
+    0,                         /* bf_getcharbuffer */
+    (getbufferproc)SpeciesView_getbuffer, /* bf_getbuffer */
+    0,                         /* bf_releasebuffer */
+};
+
+static PyTypeObject SpeciesViewType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "neutralsim.SpeciesView",  /*tp_name*/
+    sizeof(SpeciesViewObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)SpeciesView_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash*/
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    &speciesView_as_buffer,    /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+    "Species of all individuals in a community (see communityView).", /* tp_doc */
+};
+
+PyObject*
+communityView(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
   
-  return Py_BuildValue("NN", tup0, tup1);
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O", const_cast<char**>(kwlist),
+				    &metaCom)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  MetaCommunity* const com = asCommunity(metaCom);
+  if( ! com ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+
+  SpeciesViewObject* const v = PyObject_New(SpeciesViewObject, &SpeciesViewType);
+  if( ! v ) {
+    return 0;
+  }
+  Py_INCREF(metaCom);
+  v->community = metaCom;
+  v->species = com->speciesArray();
+  v->n = com->nIndividuals();
+  v->stride = sizeof(uint);
+
+  PyObject* const o = PyMemoryView_FromObject(reinterpret_cast<PyObject*>(v));
+  Py_DECREF(v);
+  return o;
+}
+
+PyObject*
+abundances(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O", const_cast<char**>(kwlist),
+				    &metaCom)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  MetaCommunity* const com = asCommunity(metaCom);
+  if( ! com ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+
+  PyObject* o = PyTuple_New(com->nPlots);
+  for(uint np = 0; np < com->nPlots; ++np) {
+    PyObject* const d = PyDict_New();
+    for(auto const& a : com->abundances(np)) {
+      PyObject* const k = PyInt_FromLong(a.first);
+      PyObject* const v = PyInt_FromLong(a.second);
+      PyDict_SetItem(d, k, v);
+      Py_DECREF(k);
+      Py_DECREF(v);
+    }
+    PyTuple_SET_ITEM(o, np, d);
+  }
+  return o;
 }
 
 PyObject*
@@ -851,13 +1306,31 @@ optTraces(PyObject*, PyObject* args, PyObject* kwds)
 
 static PyMethodDef neutralsimMethods[] = {
   {"forwardSimulation",	(PyCFunction)forwardSim, METH_VARARGS|METH_KEYWORDS,
-   ""},
+   "Returns (end time, community). The community is None when 'snapshot' is false, which"
+   " saves its conversion when the state is read with abundances or communityView. With"
+   " 'tau' > 0 (untraced only) time advances in approximate steps of 'tau' (see replicates)."},
   {"newCommunity",  	(PyCFunction)newCommunity, METH_VARARGS|METH_KEYWORDS,
    ""},
   {"CAcounts",		(PyCFunction)CAcounts, METH_VARARGS|METH_KEYWORDS,
    ""},
   {"optTraces",		(PyCFunction)optTraces, METH_VARARGS|METH_KEYWORDS,
    ""},
+  {"communityView",	(PyCFunction)communityView, METH_VARARGS|METH_KEYWORDS,
+   "Read-only memoryview (format 'I') of the species of all individuals in the community,"
+   " plot after plot. The view is not a copy, and follows later simulation of the"
+   " community (numpy.asarray(v).reshape(nPlots,plotSize) for an array)."},
+  {"abundances",	(PyCFunction)abundances, METH_VARARGS|METH_KEYWORDS,
+   "Species abundances of community, as a dictionary (species -> count) for each plot."},
+  {"replicates",	(PyCFunction)replicates, METH_VARARGS|METH_KEYWORDS,
+   "Run 'n' independent forward simulations of 'nPlots' plots of 'plotSize' individuals"
+   " to 'targetTime', in parallel with 'threads'. The speciation and immigration rates"
+   " 'lam' and 'rho' are part of the death rate 'mu' (lam + rho <= mu). Replicate k uses its own random stream"
+   " seeded by ('seed',k). Returns for each (end time, species abundances sorted"
+   " decreasing, (within, between) CAcounts when 'nwithin' or 'nbetween' are positive,"
+   " else None). With 'tau' > 0 (untraced only) time advances in approximate steps of"
+   " 'tau', each replacing a binomial number of individuals per plot with parents from"
+   " the community at the start of the step. Faster when many deaths fall in a step, but"
+   " biased as mu*tau grows; keep mu*tau around 0.1 or below."},
   {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
@@ -865,6 +1338,10 @@ PyMODINIT_FUNC
 initneutralsim(void)
 {
   randomizer.seed( time(0) );
+
+  if( PyType_Ready(&SpeciesViewType) < 0 ) {
+    return;
+  }
   
   //import_array();
   
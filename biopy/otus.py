@@ -10,7 +10,7 @@ import time, gzip, random, math
 
 from collections import defaultdict, namedtuple
 from itertools import ifilter, count
-from numpy import mean
+from numpy import mean, float32
 
 from genericutils import tohms, fileFromName
 
@@ -26,7 +26,7 @@ from scipy.optimize import brentq
 
 __all__ = ["findDuplicates", "deClutter", "deClutterDown", "treeFromSeqs",
            "defaultMatchScores", "declutterToTrees",
-           "saveDistancesMatrix", "getDistanceMatrix",
+           "saveDistancesMatrix", "getDistanceMatrix", "MappedDistances",
            "clusterFromTree", "assembleTree", "doTheCons", "getMates"]
 
 from align import defaultMatchScores
@@ -80,6 +80,92 @@ def getDistanceMatrix(saveName) :
   fl.close()
   return dists,labs
 
+class MappedDistances(object) :
+  """ Condensed distance matrix (as from calign.distances) of float32 values,
+  kept in file 'fname' and memory mapped, so that it need not fit in memory.
+
+  The labels and the number of rows filled so far are kept in 'fname.hdr'.
+  Filling checkpoints that count periodically, so an interrupted fill resumes
+  where it stopped.
+  """
+  
+  def __init__(self, fname, labels = None) :
+    import numpy
+    self.fname = fname
+    if labels is not None :
+      self.labels = list(labels)
+      self.rowsDone = 0
+      assert(all(['\t' not in x for x in self.labels]))
+      self.dists = numpy.memmap(fname, dtype = float32, mode = 'w+',
+                                shape = (max(nPairs(self.labels),1),))
+      self._saveHeader()
+    else :
+      fs = file(fname + '.hdr')
+      self.labels = next(fs).rstrip('\n').split('\t')
+      self.rowsDone = int(next(fs))
+      fs.close()
+      self.dists = numpy.memmap(fname, dtype = float32, mode = 'r+',
+                                shape = (max(nPairs(self.labels),1),))
+
+  def _saveHeader(self) :
+    fs = file(self.fname + '.hdr.tmp', 'w')
+    print >> fs, '\t'.join(self.labels)
+    print >> fs, self.rowsDone
+    fs.close()
+    import os
+    os.rename(self.fname + '.hdr.tmp', self.fname + '.hdr')
+    
+  def complete(self) :
+    return self.rowsDone >= len(self.labels) - 1
+  
+  def fill(self, seqs, matchScores = None, correction = True, checkpointEvery = 300) :
+    """ Fill distances between sequences 'seqs', in the order of the labels.
+    Resume a partial fill. Save progress every 'checkpointEvery' seconds."""
+    
+    assert len(seqs) == len(self.labels)
+
+    last = [time.time()]
+    def checkpoint(rowsDone) :
+      if time.time() - last[0] > checkpointEvery :
+        self.dists.flush()
+        self.rowsDone = rowsDone
+        self._saveHeader()
+        last[0] = time.time()
+      return True
+    
+    if not self.complete() :
+      # the same (deterministic) internal order is required to resume
+      calign.distances(seqs, align = True, scores = matchScores, reorder = True,
+                       report = calign.JCcorrection if correction else calign.DIVERGENCE,
+                       out = self.dists, start = self.rowsDone, progress = checkpoint)
+      self.dists.flush()
+      self.rowsDone = len(self.labels) - 1
+      self._saveHeader()
+    return self.dists
+
+  def tree(self, weights = None, asString = False, overwrite = False) :
+    """ UPGMA tree of the labels. Clustering works in place on a mapped copy
+    of the distances file (in the same directory), so the matrix need not
+    fit in memory, but needs its size again on disk. With 'overwrite',
+    clustering works directly on the mapped file, destroying the
+    distances."""
+    assert self.complete()
+    if overwrite :
+      return treeFromDists(self.dists, tax = self.labels, weights = weights,
+                           asString = asString, overwrite = True)
+    import numpy, shutil, os
+    self.dists.flush()
+    work = self.fname + '.work'
+    shutil.copyfile(self.fname, work)
+    try :
+      ds = numpy.memmap(work, dtype = float32, mode = 'r+', shape = self.dists.shape)
+      tr = treeFromDists(ds, tax = self.labels, weights = weights,
+                         asString = asString, overwrite = True)
+      del ds
+    finally :
+      os.remove(work)
+    return tr
+  
 def findDuplicates(allSeqs, verbose = None) :
   """ Locate duplicate sequences in 'allSeqs'. Return a list C with one entry
   for each uniq sequence with more than one copy, where C[k] is a list with
@@ -871,10 +957,10 @@ def upgma2tree(upgma, tax = None) :
   tr = scipy.cluster.hierarchy.to_tree(upgma, True)
   return _cln2newick(tr[1], tax)
 
-def treeFromDists(ds, tax = None, weights = None, asString = False) :
+def treeFromDists(ds, tax = None, weights = None, asString = False, overwrite = False) :
   #up = scipy.cluster.hierarchy.average([x/2. for x in ds])
   #up = calign.upgma([x/2. for x in ds], weights = weights)
-  up = calign.upgma(ds, weights = weights)
+  up = calign.upgma(ds, weights = weights, overwrite = overwrite)
   if weights and any([x>1 for x in weights]) :
     lw = len(weights)
     #wt = lambda i : weights[i] if i < lw else nup[i-lw][3]
@@ -907,9 +993,8 @@ def treeFromSeqs(seqs, tax = None, matchScores = None, correction = True,
     verbose.flush()
     tnow = time.clock()
 
-  sseqs,order = zip(*sorted(zip(seqs,count())))
-
-  ds = calign.distances(sseqs, align = True, scores = matchScores, reorder = order,
+  ds = calign.distances(seqs, align = True, scores = matchScores, reorder = True,
+                        dtype = float32,
                         report = calign.JCcorrection if correction else calign.DIVERGENCE)
   if saveDists is not None :
     saveDistancesMatrix(saveDists[0], ds, saveDists[1], compress = saveDists[2])
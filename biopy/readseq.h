@@ -13,6 +13,25 @@ typedef unsigned char byte;
 static byte const anynuc = 4;
 static byte const gap = 5;
 
+// Code of each character: A G C T as 0-3, '-' as gap, anything else anynuc.
+// A table, since a switch on random nucleotides is mostly mispredicted.
+
+struct NucleotideCodes {
+  byte code[256];
+
+  NucleotideCodes(void) {
+    for(uint c = 0; c < 256; ++c) {
+      code[c] = anynuc;
+    }
+    const char* const nucs = "AGCT";
+    for(uint k = 0; k < 4; ++k) {
+      code[uint(nucs[k])] = k;
+      code[uint(nucs[k]) + ('a' - 'A')] = k;
+    }
+    code[uint('-')] = gap;
+  }
+};
+
 static byte*
 readSequence(PyObject* seq, uint& nseq, bool const strip = false)
 {
@@ -27,38 +46,14 @@ readSequence(PyObject* seq, uint& nseq, bool const strip = false)
   int nsite = 0;
   
   if( PyString_Check(seq) ) {
+    static NucleotideCodes const codes;
     const char* const c = PyString_AsString(seq);
     for(uint i = 0; i < nseq; ++i) {
-      switch( c[i] ) {
-	case 'a': case 'A': {
-	  s[nsite] = 0;
-	  break;
-	}
-	case 'g': case 'G': {
-	  s[nsite] = 1;
-	  break;
-	}
-	case 'c': case 'C': {
-	  s[nsite] = 2;
-	  break;
-	}
-	case 't': case 'T': {
-	  s[nsite] = 3;
-	  break;
-	}
-	case '-' : {
-	  if( ! strip ) {
-	    s[nsite] = gap;
-	  } else {
-	    nsite -= 1;
-	  }
-	  break;
-	}
-	default : {
-	  s[nsite] = anynuc;
-	  break;
-	}
+      byte const x = codes.code[static_cast<unsigned char>(c[i])];
+      if( x == gap && strip ) {
+	continue;
       }
+      s[nsite] = x;
       nsite += 1;
     }
   } else {
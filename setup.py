@@ -14,20 +14,24 @@ module3 = Extension('biopy.treesset',
 
 module4 = Extension('biopy.neutralsim',
                     sources = ['biopy/neutralsim.cc'],
-                    extra_compile_args=['-std=c++0x'])
+                    extra_compile_args=['-std=c++0x', '-pthread'],
+                    extra_link_args=['-pthread'])
 
 module5 = Extension('biopy.calign',
                     sources = ['biopy/calign.cc'],
-                    extra_compile_args=['-std=c++0x'])
+                    extra_compile_args=['-std=c++0x', '-pthread'],
+                    extra_link_args=['-pthread'])
 
 module7 = Extension('biopy.aalign',
                     sources = ['biopy/aalign.cc'],
-                    extra_compile_args=['-std=c++0x'])
+                    extra_compile_args=['-std=c++0x', '-pthread'],
+                    extra_link_args=['-pthread'])
 
 
 module6 = Extension('biopy.cclust',
                     sources = ['biopy/cclust.cc'],
-                    extra_compile_args=['-std=c++0x'])
+                    extra_compile_args=['-std=c++0x', '-pthread'],
+                    extra_link_args=['-pthread'])
 
 classifiers=[
   "Development Status :: 3 - Alpha",
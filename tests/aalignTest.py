@@ -0,0 +1,67 @@
+from array import array
+from aalign import acorrect, acorrectMany, aacons, proteinIndex, shortlist, AAorder
+
+# standard genetic code, nucleotides in AGCT order (stop codons as -1)
+_aas = "FFLLSSSSYY**CC*WLLLLPPPPHHQQRRRRIIIMTTTTNNKKSSRRVVVVAAAADDEEGGGG"
+_std = dict((a+b+c, _aas[16*i+4*j+k]) for i,a in enumerate("TCAG")
+            for j,b in enumerate("TCAG") for k,c in enumerate("TCAG"))
+gc = [(AAorder.index(_std[a+b+c]) if _std[a+b+c] != '*' else -1)
+      for a in "AGCT" for b in "AGCT" for c in "AGCT"]
+msc = [(5 if a == b else -1) for a in AAorder for b in AAorder]
+
+reads = ["ATGGCTAAAGGTCTGTTTCAT", "ATGGCTAAGGTCTGTTTCAT", "ATGGCTAAAAGGTCTGTTTCAT", "CCATGGCTAAA"]
+prots = ["MAKGLFH", "MAKG"]
+
+def same(r, s) :
+  a, x = acorrect(r, s, msc, gc), acorrectMany([r], [s], msc, gc)[0]
+  return (tuple(array('b', x[0])), tuple(array('b', x[1])), tuple(array('b', x[3]))) == (a[0], a[1], a[3])
+
+def test00() :
+  """
+>>> all(same(s, prots[0]) for s in reads)
+True
+>>> r = acorrectMany(reads, prots[:1], msc, gc, threads=3)
+>>> [x[2] for x in r]
+[(7, 0, 0, 0, 0, 0, 0, 0, 0), (7, 0, 0, 0, 1, 0, 0, 0, 0), (7, 0, 0, 1, 0, 0, 0, 0, 0), (3, 0, 0, 0, 0, 2, 0, 0, 4)]
+>>> [x[2] for x in acorrectMany(reads, prots, msc, gc, refIndex=[0,0,0,1], threads=2)][3]
+(3, 0, 0, 0, 0, 2, 0, 0, 1)
+>>> [acorrect(s, prots[0], msc, gc, band=1) for s in reads] == [acorrect(s, prots[0], msc, gc) for s in reads]
+True
+>>> len(set(str(acorrect('ATATTCGTGTATTTA', 'INSCHY', msc, gc, band=b)) for b in (0, 1, 10)))
+1
+>>> acorrectMany(reads[:2], prots, msc, gc)[1][2] == acorrectMany(reads[1:2], prots[1:], msc, gc)[0][2]
+True
+"""
+  pass
+
+aln = ["ATGGCTAAAGGTCTGTTTCAT", "ATGGCTAA-GGTCTGTTTCAT", "ATGGCTAAAGGTCTGTTTCAT",
+       "ATGGCTAAAGGTCAGTTTCAT", "ATGGCTAAAGGTCTG-TTCAT"]
+
+def test01() :
+  """
+>>> c = aacons(aln, gc) ; "".join("AGCT-"[x] for x in c[0])
+'ATGGCTAAAGGTCTGTTTCAT'
+>>> aacons(aln * 50, gc, threads=3) == aacons(aln * 50, gc)
+True
+"""
+  pass
+
+refs = ["MAKGLFHWE", "MSTPQRYVD", "MAKGLFHQE"]
+
+def revcomp(s) :
+  return "".join({'A':'T','T':'A','G':'C','C':'G'}[c] for c in reversed(s))
+
+def test02() :
+  """
+>>> idx = proteinIndex(refs, k=3)
+>>> shortlist([reads[0], revcomp(reads[0]), "ATGTCTACTCCTCAA", "NNN"], idx, gc, top=2)
+[[(0, 5, False), (2, 5, False)], [(0, 5, True), (2, 5, True)], [(1, 3, False)], []]
+>>> r = acorrectMany([reads[0], revcomp(reads[0])], idx, msc, gc) ; [x[4:] for x in r], r[0][:4] == r[1][:4]
+([(0, False), (0, True)], True)
+>>> acorrectMany(["NNNNNN", reads[0]], idx, msc, gc)[0]
+"""
+  pass
+
+if __name__ == '__main__':
+  import doctest
+  doctest.testmod()
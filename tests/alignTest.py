@@ -1,11 +1,14 @@
 from __future__ import division
 from math import log,exp
 
-from calign import globalAlign, createProfile, profileAlign, distances, DIVERGENCE, IDENTITY, JCcorrection
+from calign import globalAlign, globalAffineAlign, createProfile, profileAlign, prof2profAlign, \
+     progressiveAlign, refineAlignment, distances, allpairs, upgma, Profile, \
+     DIVERGENCE, IDENTITY, JCcorrection
 
 #scores = (10,-5,-6,None,False)
 scores = (10,-5,-6,-6,False)
 fescores = (10,-5,-6,-6,True)
+affscores = (10,-5,-10,-1,True)
 
 s1 = """AAGTCGTAACAAGGTTTCCGTAGGTGAACCTGCGGAAGGATCATTAGTGATTGCCATCTTGGCTTAAACTATATCCATCTACACCTGTGAACTGTTTGATTGAATCTCACGATTCAATTCTTTACAAACATTGTGTAATGAACGTCATTAGATCATAACAAAAAAACTTTAACTAACGGATCTCTTGGCTCTCGCATCGATGAAGAACGCAGCGGTCATAGCTGTTTCC"""
 
@@ -38,6 +41,119 @@ True
 """
   pass
 
+def test01() :
+  """
+>>> globalAlign("AGGAACTT", "ATAGA", scores=scores)
+((0, 5, 1, 1, 0, 0, 2, 3, 3), (0, 3, 0, 1, 5, 0, 5, 5, 5))
+>>> globalAffineAlign("AGGAACTT", "ATAGA", -1, scores=scores)
+((0, 5, 1, 1, 0, 0, 2, 3, 3), (0, 3, 0, 1, 0, 5, 5, 5, 5))
+>>> globalAffineAlign("AGGAACTT", "ATAGA", -6, scores=scores) == globalAlign("AGGAACTT", "ATAGA", scores=scores)
+True
+>>> d = distances((s1,s2,s3), scores=affscores) ; d == distances((s1,s2,s3), scores=affscores, reorder=(0,1,2))
+True
+>>> p = createProfile(("ACGTTTTACG","ACGTTTTACG")) ; profileAlign("ACGACG", p, gapPenalty=-10, gapExtend=-1)
+(0, 2, 1, 5, 5, 5, 5, 0, 2, 1)
+>>> len(prof2profAlign(p, createProfile(("ACGACG",)), scores=affscores))
+10
+>>> ss = (s3, s1, s2, s1[:200], s2[:220] + s1[220:])
+>>> distances(ss, scores=scores, reorder=True) == distances(ss, scores=scores)
+True
+>>> distances(ss, scores=affscores, reorder=True) == distances(ss, scores=affscores)
+True
+"""
+  pass
+
+def test02() :
+  """
+>>> from ctypes import c_float, c_double
+>>> ss = (s1, s2, s3, s1[:200])
+>>> d = distances(ss, scores=scores)
+>>> b = (c_double * 6)() ; distances(ss, scores=scores, out=b) is b
+True
+>>> tuple(b) == d
+True
+>>> b = (c_double * 6)() ; x = distances(ss, scores=scores, reorder=True, out=b) ; tuple(b) == d
+True
+>>> distances(ss, out=(c_float * 5)())
+Traceback (most recent call last):
+...
+ValueError: wrong args: output size 5, expecting 6
+>>> b = (c_double * 4)() ; x = allpairs(ss[:2], ss[2:], scores=scores, out=b)
+>>> tuple(b) == sum(allpairs(ss[:2], ss[2:], scores=scores), ())
+True
+>>> b = (c_double * 6)(*d) ; u = upgma(b) ; tuple(b) == d
+True
+>>> all(x[:2] + (x[3],) == y[:2] + (y[3],) and abs(x[2] - y[2]) < 1e-6 for x, y in zip(u, upgma(d)))
+True
+>>> x = upgma(b, overwrite=True) ; tuple(b) == d, x == u
+(False, True)
+>>> b = (c_double * 6)() ; x = distances(ss, scores=scores, reorder=True, out=b, progress=lambda r : r < 2)
+Traceback (most recent call last):
+...
+RuntimeError: stopped by progress
+>>> x = distances(ss, scores=scores, reorder=True, out=b, start=2) ; tuple(b) == d
+True
+>>> p = [(i, j, d[k]) for k, (i, j) in enumerate([(i,j) for i in range(4) for j in range(i+1,4)])]
+>>> [x[:2] + (x[3],) for x in upgma(pairs=p, n=4, cutoff=2)] == [x[:2] + (x[3],) for x in upgma(d)]
+True
+>>> upgma(pairs=[(0,1,.1),(1,2,.3)], n=4, cutoff=1.)
+((0, 1, 0.1, 2), (2, 4, 0.65, 3), (3, 5, 1.0, 4))
+"""
+  pass
+
+def test03() :
+  """
+>>> al = globalAlign(s1, s2, scores=fescores)
+>>> p = createProfile(al) ; q = createProfile(al, native=True)
+>>> len(q) == len(p) and q.nSeqs == 2 and q.columns() == p and q[0] == p[0]
+True
+>>> tuple(Profile(p)) == p
+True
+>>> profileAlign(s3, q) == profileAlign(s3, p)
+True
+>>> q.remove(al[0]) ; tuple(q) == createProfile(al[1:])
+True
+>>> q.add(al[0]) ; q.pad(2, 1) ; q[0], q[-1], len(q) == len(p) + 3
+([0, 0, 0, 0, 0, 2], [0, 0, 0, 0, 0, 2], True)
+>>> q.removeColumns([0, 1, len(q)-1]) ; q.columns() == p
+True
+>>> p3 = createProfile([s3]) ; r = prof2profAlign(q, p3, scores=fescores)
+>>> tuple(r) == tuple(list(x) for x in prof2profAlign(p, p3, scores=fescores))
+True
+>>> q.merge(createProfile([s3], native=True), scores=fescores) ; q.nSeqs, tuple(q) == tuple(r)
+(3, True)
+>>> q.merge(q, scores=(1,2))
+Traceback (most recent call last):
+ValueError: wrong args: invalid scores
+>>> e = createProfile(["ACG"], native=True) ; e.removeColumns([0, 1, 2]) ; len(e), e.nSeqs
+(0, 1)
+>>> e.merge(createProfile(["ACG"], native=True)) ; e.nSeqs, e.columns()
+(2, ([1, 0, 0, 0, 0, 1], [0, 0, 1, 0, 0, 1], [0, 1, 0, 0, 0, 1]))
+>>> ss = (s1, s2, s3, s1[20:], s2[:-30])
+>>> al, p = progressiveAlign(ss, upgma(seqs=ss, scores=fescores), scores=fescores)
+>>> [''.join("AGCTN-"[x] for x in a if x != 5) for a in al] == list(ss), tuple(p) == createProfile(al)
+(True, True)
+>>> progressiveAlign(ss, upgma(seqs=ss, scores=fescores), scores=fescores, threads=3)[0] == al
+True
+>>> progressiveAlign(ss, upgma(seqs=ss, scores=fescores), scores=(1,2))
+Traceback (most recent call last):
+ValueError: wrong args: invalid scores
+>>> r0, sp0 = refineAlignment(al, scores=fescores, rounds=0)
+>>> r, sp = refineAlignment(al, scores=fescores, joins=upgma(seqs=ss, scores=fescores), threads=2)
+>>> sp >= sp0, [''.join("AGCTN-"[x] for x in a if x != 5) for a in r] == list(ss)
+(True, True)
+>>> [refineAlignment(al, scores=fescores, joins=upgma(seqs=ss, scores=fescores), threads=t) == (r, sp) for t in (1,4)]
+[True, True]
+>>> r0, sp0 = refineAlignment(al, scores=affscores, rounds=0)
+>>> r, sp = refineAlignment(al, scores=affscores, joins=upgma(seqs=ss, scores=fescores))
+>>> sp >= sp0, [''.join("AGCTN-"[x] for x in a if x != 5) for a in r] == list(ss)
+(True, True)
+>>> refineAlignment(al, scores=(1,2))
+Traceback (most recent call last):
+ValueError: wrong args: invalid scores
+"""
+  pass
+
 if __name__ == '__main__':
   import doctest
   doctest.testmod()
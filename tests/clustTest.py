@@ -0,0 +1,88 @@
+from cclust import lookupTable, counts, popq, countsMany, addSequences, removeSequences, \
+     greedyCluster, dereplicate
+
+seqs = ["ACGTTGCAACGTAGCTAGGCTAACGTAGGCTTAACGGA", "ACGTTGCAACGTAGCTAGGCTAACGTAGGCTTAACGGT",
+        "TTGCAACGTAGCTAGGCTAACGTAGG", "GGCATCGATTACGGCATCGACCTAGCAT", "ACGTTGCAANGTAGCTAGGCTAACG"]
+
+def test00() :
+  """
+>>> d = lookupTable(seqs, 11, False) ; n = lookupTable(seqs, 11, False, native=True)
+>>> c0 = [0]*len(seqs) ; x = counts(seqs[0], d, c0) ; c0
+[27, 27, 15, 0, 4]
+>>> c1 = [0]*len(seqs) ; x = counts(seqs[0], n, c1) ; c1 == c0
+True
+>>> c1 = [0]*len(seqs) ; x = counts(seqs[4], n, c1) ; c1
+[4, 4, 4, 0, 4]
+>>> n = lookupTable(seqs, 25, native=True, threads=2) ; c = [0]*len(seqs) ; x = counts(seqs[1], n, c) ; c
+[13, 13, 1, 0, 0]
+>>> q = counts(seqs[2], n, len(seqs), [len(s) for s in seqs]) ; [popq(q)[1] for k in range(3)], popq(q)
+([0, 1, 2], None)
+>>> n = lookupTable(seqs, 11, False, native=True) ; countsMany(seqs, n, topK=2)
+[[(0, 27), (1, 27)], [(0, 27), (1, 27)], [(0, 15), (1, 15)], [(3, 17)], [(0, 4), (1, 4)]]
+>>> r = countsMany(seqs, n, 3, [len(s) for s in seqs], range(len(seqs)), threads=2)
+>>> [[(i, round(x, 3)) for i,x in c] for c in r[:2]], r[3]
+([[(1, 0.711), (2, 0.577), (4, 0.16)], [(0, 0.711), (2, 0.577), (4, 0.16)]], [])
+"""
+  pass
+
+def test01() :
+  """
+>>> n = lookupTable(seqs, 11, False, native=True, sampling="minimizer", window=4)
+>>> countsMany(seqs, n, topK=3)[:4]
+[[(0, 13), (1, 13), (2, 7)], [(0, 13), (1, 13), (2, 7)], [(0, 7), (1, 7), (2, 7)], [(3, 5)]]
+>>> n = lookupTable(seqs, 11, False, native=True, sampling="syncmer", window=4)
+>>> c = [0]*len(seqs) ; x = counts(seqs[0], n, c) ; c
+[3, 3, 1, 0, 0]
+>>> n = lookupTable(seqs, 11, False, native=True, sampling="minimizer", window=1)
+>>> c = [0]*len(seqs) ; x = counts(seqs[0], n, c) ; c
+[27, 27, 15, 0, 4]
+"""
+  pass
+
+def test02() :
+  """
+>>> n = lookupTable(seqs[:3], 11, False, native=True) ; addSequences(n, seqs[3:])
+[3, 4]
+>>> c = [0]*len(seqs) ; x = counts(seqs[0], n, c) ; c
+[27, 27, 15, 0, 4]
+>>> x = counts(seqs[0], n, [0]*3)
+Traceback (most recent call last):
+ValueError: wrong args: result shorter than the table
+>>> removeSequences(n, [1]) ; c = [0]*len(seqs) ; x = counts(seqs[0], n, c) ; c
+[27, 0, 15, 0, 4]
+>>> countsMany(seqs[:1], n, topK=5)
+[[(0, 27), (2, 15), (4, 4)]]
+"""
+  pass
+
+def test03() :
+  """
+>>> c,d = greedyCluster(seqs, .1) ; c, [round(x, 4) for x in d]
+([0, 0, 0, 3, 0], [0.0, 0.0263, 0.0, 0.0, 0.0])
+>>> greedyCluster(seqs, .1, threads=2, abundances=[1,5,1,1,1])[0]
+[1, 1, 1, 3, 1]
+>>> greedyCluster(seqs, .1, correction=True, scores=(10,-5,-6,None,False))[0]
+[0, 0, 2, 3, 4]
+"""
+  pass
+
+def test04() :
+  """
+>>> s = ['ACGTAC', 'ACGTAC', 'ACG', 'GTAC', 'TTGCA', 'acgtac', 'TTGCAN', 'AC-GTAC']
+>>> dereplicate(s)
+[([0, 1, 2, 3, 5, 7], 6.0), ([4, 6], 2.0)]
+>>> dereplicate(s, containment=False)
+[([0, 1, 5, 7], 4.0), ([2], 1.0), ([3], 1.0), ([4], 1.0), ([6], 1.0)]
+>>> dereplicate(s, abundances=[1,1,1,1,5,1,1,1])[1]
+([4, 6], 6.0)
+>>> dereplicate(s, abundances=[1,1,1,1,1,1,3,1])[1]
+([6, 4], 4.0)
+>>> b = 'ACGTTGCA'
+>>> dereplicate([b, b+'CC', b+'CCGA', b+'TT'], abundances=[1,100,1,50])
+[([1, 0, 2], 102.0), ([3], 50.0)]
+"""
+  pass
+
+if __name__ == '__main__':
+  import doctest
+  doctest.testmod()
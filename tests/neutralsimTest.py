@@ -0,0 +1,71 @@
+from neutralsim import replicates, newCommunity, forwardSimulation, communityView, abundances
+import array
+
+def test00() :
+  """
+>>> r = replicates(6, 3, 20, 1, .05, .01, 10, seed=5)
+>>> r == replicates(6, 3, 20, 1, .05, .01, 10, seed=5, threads=3)
+True
+>>> [sum(x[1]) for x in r], [x[2] for x in r] == [None]*6
+([60, 60, 60, 60, 60, 60], True)
+>>> c = replicates(4, 3, 20, 1, .05, .01, 10, seed=5, threads=2, nwithin=3, nbetween=2)
+>>> [(len(x[2][0]), len(x[2][1])) for x in c], [x[1] for x in c] == [x[1] for x in r[:4]]
+([(3, 2), (3, 2), (3, 2), (3, 2)], True)
+"""
+  pass
+
+def test01() :
+  """
+>>> t = replicates(6, 3, 20, 1, .05, .01, 10, seed=5, tau=.1)
+>>> t == replicates(6, 3, 20, 1, .05, .01, 10, seed=5, tau=.1, threads=3)
+True
+>>> [x[0] for x in t] == [10]*6, [sum(x[1]) for x in t]
+(True, [60, 60, 60, 60, 60, 60])
+>>> replicates(2, 3, 20, 1, .05, .01, 10, tau=.1, nwithin=3)
+Traceback (most recent call last):
+ValueError: wrong args: tau steps are not traced
+"""
+  pass
+
+def test02() :
+  """
+>>> c = newCommunity(3, 20)
+>>> v = communityView(c)
+>>> v.format, v.shape, v.readonly, abundances(c)
+('I', (60L,), True, ({0: 20}, {0: 20}, {0: 20}))
+>>> e, s = forwardSimulation(c, 5, 1, .1, .1, seed=3)
+>>> e, x = forwardSimulation(c, 10, 1, .1, .1, snapshot=False)
+>>> b = v.tobytes() ; e, s = forwardSimulation(c, 15, 1, .1, .1)
+>>> x, v.tobytes() != b, tuple(array.array('I', v.tobytes())) == sum(s, ())
+(None, True, True)
+>>> e, x = forwardSimulation(c, 20, 1, .1, .1, snapshot=False)
+>>> a = abundances(c)
+>>> s = forwardSimulation(c, 20, 1, .1, .1)[1]
+>>> a == tuple(dict((x, p.count(x)) for x in set(p)) for p in s)
+True
+"""
+  pass
+
+def test03() :
+  """
+>>> for tau in (0, .1) :
+...   c = newCommunity(1, 10)
+...   m = max(forwardSimulation(c, 2, 1, .9, 0, seed=4, tau=tau)[1][0])
+...   e, x = forwardSimulation(c, 100, 1, 0, 0, seed=5, tau=tau, snapshot=False)
+...   old = set(abundances(c)[0])
+...   e, x = forwardSimulation(c, 100.5, 1, .9, 0, seed=6, tau=tau, snapshot=False)
+...   print m, sorted(old), min(set(abundances(c)[0]) - old) > m
+28 [26] True
+12 [9] True
+>>> forwardSimulation(c, 200, 1, 2, 0, tau=.1)
+Traceback (most recent call last):
+ValueError: wrong args: invalid rates (need mu > 0, lam, rho >= 0 and lam + rho <= mu)
+>>> replicates(2, 3, 20, 1, .5, -.1, 10)
+Traceback (most recent call last):
+ValueError: wrong args: invalid rates (need mu > 0, lam, rho >= 0 and lam + rho <= mu)
+"""
+  pass
+
+if __name__ == '__main__':
+  import doctest
+  doctest.testmod()